@@ -0,0 +1,359 @@
+#ifndef BANDWIDTH_H // Prevents multiple inclusions of this header file
+#define BANDWIDTH_H // Defines the header guard macro
+
+#include <algorithm> // Includes std::min, std::max and std::remove
+#include <chrono> // Includes steady_clock for token refills
+#include <condition_variable> // Includes condition_variable for the scheduler thread
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <deque> // Includes deque for the wait queues
+#include <functional> // Includes std::function for wake-ups
+#include <memory> // Includes shared_ptr for flows and clients
+#include <mutex> // Includes mutex for the scheduler state
+#include <sstream> // Includes ostringstream for the JSON report
+#include <string> // Includes the string library for client IDs
+#include <thread> // Includes the scheduler thread
+#include <unordered_map> // Includes hash maps for clients and weights
+#include <vector> // Includes the vector library for wake-up lists
+#include "metrics.h" // Includes the throttling counter
+
+// Server-wide send scheduler: a global bandwidth cap, shared fairly by the sessions that are sending.
+//
+// Each connection joins as a Flow of the client (session UUID) it speaks for. The flows of one client
+// share that client's token bucket, so a client striping over several connections gets no more than
+// one would. Before queueing data, a flow asks grant() how much it may send:
+//
+//   - Small transfers (SMALL_TRANSFER bytes or less in total) draw straight from the global bucket,
+//     ahead of any bulk flows that are waiting.
+//   - Bulk data also draws straight from it while no other flow waits. Once the link is contended,
+//     bulk flows queue for a deficit round robin: each waiting flow in turn is credited weight *
+//     QUANTUM bytes from the tokens that accrue every tick, and sends once its credit is positive, so
+//     flows share the cap in proportion to their weights whatever sizes they send in.
+//   - With a per-client rate, every grant also draws from the client's bucket. A flow whose client
+//     has spent its own bucket waits apart from the round robin until that bucket refills, so it
+//     never holds up other clients; without a global cap it is the only reason a flow waits.
+//
+// Buckets may go into debt by one grant, so grants are not split into slivers; the debt is repaid
+// before the next grant. A refused flow's wake() is called from the scheduler thread once it may try
+// again. Without limits, grant() allows everything and only counts bytes for the report.
+class Bandwidth
+{
+public:
+    static constexpr uint64_t SMALL_TRANSFER = 256 * 1024; // Transfers up to this size jump the queue
+    static constexpr uint64_t QUANTUM = 64 * 1024; // Bytes per unit of weight credited per round
+    static constexpr uint64_t MAX_GRANT = 256 * 1024; // Largest single grant while a limit is set
+    static constexpr int TICK_MS = 2; // Scheduler period while flows wait
+
+    // Token bucket and statistics of one session UUID
+    class Client
+    {
+    private:
+        friend class Bandwidth; // The scheduler owns every field
+
+        std::string id; // Session UUID
+        uint32_t weight = 1; // Share relative to other clients
+        size_t flows = 0; // Connections speaking for this client
+        double tokens = 0; // Bytes the client may still send (negative = debt)
+        std::chrono::steady_clock::time_point refilled; // Last refill of tokens
+        uint64_t bytes = 0; // Bytes granted in total
+        uint64_t waits = 0; // Grants refused
+        uint64_t rate = 0; // Bytes per second over the last full window
+        uint64_t windowBytes = 0; // Bytes granted in the current window
+        std::chrono::steady_clock::time_point windowStart; // Start of the current window
+    };
+
+    // One connection's share of the scheduler
+    class Flow
+    {
+    private:
+        friend class Bandwidth; // The scheduler owns every field
+
+        std::shared_ptr<Client> client; // Bucket the flow draws from
+        std::function<void()> wake; // Called once a refused flow may try again
+        double credit = 0; // Bytes granted by the round robin and not yet used (negative = debt)
+        double turnLeft = 0; // Bytes still due in the flow's current round-robin turn
+        bool queued = false; // True while in a wait queue
+    };
+    typedef std::shared_ptr<Flow> FlowPtr; // Held by the session
+
+    // globalRate and clientRate in bytes per second (0 = unlimited); weights by session UUID (default 1)
+    Bandwidth(uint64_t globalRate, uint64_t clientRate, std::unordered_map<std::string, uint32_t> weights)
+        : globalRate(globalRate), clientRate(clientRate), weights(std::move(weights)), last(std::chrono::steady_clock::now())
+    {
+        global = static_cast<double>(burst(globalRate)); // Starts full
+        if (limited()) // Someone may have to wait
+            scheduler = std::thread(&Bandwidth::run, this);
+    }
+
+    ~Bandwidth() // Stops the scheduler
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        if (scheduler.joinable())
+            scheduler.join();
+    }
+
+    Bandwidth(const Bandwidth &) = delete; // Owns a thread, not copyable
+    Bandwidth &operator=(const Bandwidth &) = delete;
+
+    bool limited() const { return globalRate > 0 || clientRate > 0; } // True if grants can be refused
+
+    // Registers a connection of client; wake may be called from any thread
+    FlowPtr join(const std::string &client, std::function<void()> wake)
+    {
+        FlowPtr flow = std::make_shared<Flow>(); // New flow
+        flow->wake = std::move(wake);
+        std::lock_guard<std::mutex> lock(mutex); // Protects the clients
+        flow->client = clientLocked(client);
+        ++flow->client->flows;
+        return flow;
+    }
+
+    // Unregisters a connection; unused credit goes back to the global bucket
+    void leave(const FlowPtr &flow)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the queues
+        unqueueLocked(flow);
+        if (flow->credit > 0 && globalRate > 0) // Granted but never sent
+            global += flow->credit;
+        flow->credit = 0;
+        detachLocked(flow);
+    }
+
+    // Moves a connection to another client (a session resumed under its earlier UUID)
+    void moveTo(const FlowPtr &flow, const std::string &client)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the clients
+        detachLocked(flow);
+        flow->client = clientLocked(client);
+        ++flow->client->flows;
+    }
+
+    // Bytes flow may queue now, at most want (0 = wait for wake()). small marks a transfer of at most
+    // SMALL_TRANSFER bytes in total.
+    uint64_t grant(const FlowPtr &flow, uint64_t want, bool small)
+    {
+        auto now = std::chrono::steady_clock::now(); // For refills and the rate window
+        std::lock_guard<std::mutex> lock(mutex); // Protects the buckets
+        Client &c = *flow->client; // Bucket of the flow's client
+        if (!limited()) // Only counted
+        {
+            countLocked(c, want, now);
+            return want;
+        }
+        refillLocked(now);
+        refillClientLocked(c, now);
+        want = std::min(want, MAX_GRANT); // Keeps debts small
+        bool clientOk = clientRate == 0 || c.tokens > 0; // Client's own cap allows more
+        if (flow->credit > 0) // Credited by the round robin (already drawn from both buckets)
+            flow->credit -= static_cast<double>(want);
+        else if (clientOk && (globalRate == 0 || (global > 0 && (small || bulk.empty())))) // Uncontended, or allowed to jump ahead
+        {
+            if (globalRate > 0)
+                global -= static_cast<double>(want);
+            if (clientRate > 0)
+                c.tokens -= static_cast<double>(want);
+        }
+        else // Waits for its own bucket, or its turn at the global one
+        {
+            Metrics::add(Metrics::BANDWIDTH_WAITS);
+            ++c.waits;
+            if (!flow->queued) // Queued once, however often it asks
+            {
+                flow->queued = true;
+                (!clientOk ? capped : small ? urgent : bulk).push_back(flow);
+            }
+            wakeup.notify_one();
+            return 0;
+        }
+        countLocked(c, want, now);
+        return want;
+    }
+
+    // Caps, waiting flows and every connected client's share as one JSON object
+    std::string json()
+    {
+        auto now = std::chrono::steady_clock::now(); // For stale rate windows
+        std::ostringstream out; // Report being built
+        std::lock_guard<std::mutex> lock(mutex); // Protects the clients
+        out << "{\"global_rate\":" << globalRate << ",\"client_rate\":" << clientRate << ",\"waiting\":" << urgent.size() + bulk.size() + capped.size() << ",\"clients\":[";
+        bool first = true; // No comma before the first entry
+        for (const auto &entry : clients)
+        {
+            const Client &c = *entry.second;
+            bool fresh = now - c.windowStart < std::chrono::seconds(2); // Rate measured recently
+            out << (first ? "" : ",") << "{\"client\":\"" << entry.first << "\",\"weight\":" << c.weight << ",\"connections\":" << c.flows
+                << ",\"bytes\":" << c.bytes << ",\"rate\":" << (fresh ? c.rate : 0) << ",\"waits\":" << c.waits << "}";
+            first = false;
+        }
+        out << "]}";
+        return out.str();
+    }
+
+private:
+    static uint64_t burst(uint64_t rate) { return std::max(MAX_GRANT, rate / 20); } // Bucket size: 50 ms at the rate
+
+    // Finds or creates the bucket of a client (scheduler mutex)
+    std::shared_ptr<Client> clientLocked(const std::string &id)
+    {
+        std::shared_ptr<Client> &c = clients[id];
+        if (!c) // First connection of this client
+        {
+            c = std::make_shared<Client>();
+            c->id = id;
+            auto weight = weights.find(id); // Configured share
+            c->weight = weight != weights.end() ? std::max<uint32_t>(1, weight->second) : 1;
+            c->tokens = static_cast<double>(burst(clientRate));
+            c->refilled = c->windowStart = std::chrono::steady_clock::now();
+        }
+        return c;
+    }
+
+    // Drops a flow from its client, forgetting clients with no connections left (scheduler mutex)
+    void detachLocked(const FlowPtr &flow)
+    {
+        if (!flow->client)
+            return;
+        if (--flow->client->flows == 0) // Last connection of the client
+            clients.erase(flow->client->id);
+        flow->client.reset();
+    }
+
+    // Removes a flow from the wait queues (scheduler mutex)
+    void unqueueLocked(const FlowPtr &flow)
+    {
+        if (!flow->queued)
+            return;
+        for (std::deque<FlowPtr> *queue : {&urgent, &bulk, &capped})
+            queue->erase(std::remove(queue->begin(), queue->end(), flow), queue->end());
+        flow->queued = false;
+    }
+
+    // Adds the global tokens earned since the last refill (scheduler mutex); unused without a global cap
+    void refillLocked(std::chrono::steady_clock::time_point now)
+    {
+        double seconds = std::chrono::duration<double>(now - last).count(); // Time since the last refill
+        last = now;
+        if (globalRate > 0)
+            global = std::min(global + seconds * globalRate, static_cast<double>(burst(globalRate)));
+    }
+
+    // Adds the client tokens earned since the client's last refill (scheduler mutex)
+    void refillClientLocked(Client &c, std::chrono::steady_clock::time_point now)
+    {
+        double seconds = std::chrono::duration<double>(now - c.refilled).count(); // Time since the last refill
+        c.refilled = now;
+        if (clientRate > 0)
+            c.tokens = std::min(c.tokens + seconds * clientRate, static_cast<double>(burst(clientRate)));
+    }
+
+    // Counts granted bytes for the report (scheduler mutex)
+    static void countLocked(Client &c, uint64_t bytes, std::chrono::steady_clock::time_point now)
+    {
+        c.bytes += bytes;
+        c.windowBytes += bytes;
+        double seconds = std::chrono::duration<double>(now - c.windowStart).count(); // Length of the current window
+        if (seconds >= 1) // Window complete
+        {
+            c.rate = static_cast<uint64_t>(c.windowBytes / seconds);
+            c.windowBytes = 0;
+            c.windowStart = now;
+        }
+    }
+
+    // Scheduler thread: while flows wait, hands out each tick's tokens and wakes the flows that may go on
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex); // Held except while waking flows
+        while (!stopping)
+        {
+            if (urgent.empty() && bulk.empty() && capped.empty()) // Nothing to schedule
+            {
+                wakeup.wait(lock);
+                continue;
+            }
+            wakeup.wait_for(lock, std::chrono::milliseconds(TICK_MS)); // Lets tokens accumulate
+            auto now = std::chrono::steady_clock::now();
+            refillLocked(now);
+            std::vector<FlowPtr> ready; // Flows to wake outside the lock
+            for (auto it = capped.begin(); it != capped.end();) // Flows held only by their own client's cap
+            {
+                Client &c = *(*it)->client;
+                refillClientLocked(c, now);
+                if (c.tokens > 0) // Its bucket refilled: asks again (and queues for the global one if that is short)
+                {
+                    (*it)->queued = false;
+                    ready.push_back(*it);
+                    it = capped.erase(it);
+                }
+                else
+                    ++it;
+            }
+            for (auto it = urgent.begin(); it != urgent.end();) // Small transfers go first
+            {
+                Client &c = *(*it)->client;
+                refillClientLocked(c, now);
+                if (global > 0 && (clientRate == 0 || c.tokens > 0)) // May draw again
+                {
+                    (*it)->queued = false;
+                    ready.push_back(*it);
+                    it = urgent.erase(it);
+                }
+                else
+                    ++it;
+            }
+            for (size_t turns = bulk.size(); turns > 0 && global > 0; --turns) // Continues the round while tokens last
+            {
+                FlowPtr flow = bulk.front(); // Flow whose turn it is
+                Client &c = *flow->client;
+                refillClientLocked(c, now);
+                if (flow->turnLeft <= 0) // New turn: its weight's worth
+                    flow->turnLeft = static_cast<double>(QUANTUM * c.weight);
+                double give = std::min(flow->turnLeft, global); // As much of the turn as this tick affords
+                if (clientRate > 0) // Also capped by its own bucket
+                    give = std::min(give, std::max(c.tokens, 0.0));
+                flow->credit += give;
+                flow->turnLeft -= give;
+                global -= give;
+                if (clientRate > 0)
+                    c.tokens -= give;
+                if (flow->turnLeft > 0 && (clientRate == 0 || c.tokens > 0)) // Turn continues next tick
+                    break;
+                bulk.pop_front(); // Turn over (or the client's own cap is spent)
+                if (flow->credit > 0) // Debt repaid: may send again
+                {
+                    flow->queued = false;
+                    ready.push_back(flow);
+                }
+                else if (clientRate > 0 && c.tokens <= 0) // Held by its own cap: leaves the round to the others
+                    capped.push_back(flow);
+                else // Still in debt: waits for its next turn
+                    bulk.push_back(flow);
+            }
+            lock.unlock();
+            for (const FlowPtr &flow : ready)
+                if (flow->wake)
+                    flow->wake();
+            lock.lock();
+        }
+    }
+
+    const uint64_t globalRate; // Server-wide cap (0 = unlimited)
+    const uint64_t clientRate; // Cap of each client (0 = unlimited)
+    const std::unordered_map<std::string, uint32_t> weights; // Configured shares by session UUID
+
+    std::mutex mutex; // Protects the fields below, and every Flow and Client
+    std::condition_variable wakeup; // Signals the scheduler that flows wait or that it should stop
+    std::thread scheduler; // Runs run() while limits are set
+    bool stopping = false; // Set by the destructor
+    double global = 0; // Bytes the server may still send (negative = debt; unused without a global cap)
+    std::chrono::steady_clock::time_point last; // Last refill of global
+    std::unordered_map<std::string, std::shared_ptr<Client>> clients; // Connected clients by UUID
+    std::deque<FlowPtr> urgent; // Small transfers waiting for tokens
+    std::deque<FlowPtr> bulk; // Bulk flows waiting for their round-robin turn
+    std::deque<FlowPtr> capped; // Flows waiting for their own client's bucket to refill
+};
+
+#endif // Ends the header guard
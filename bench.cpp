@@ -0,0 +1,360 @@
+#include <iostream> // Includes the standard input-output stream library for console I/O
+#include <winsock2.h> // Includes the Winsock 2 library for socket programming
+#include <ws2tcpip.h> // Includes additional Winsock functions for IP address handling
+#include <algorithm> // Includes sort and min
+#include <atomic> // Includes atomics for the shared counters
+#include <chrono> // Includes clocks for timing
+#include <cstdint> // Includes standard integer types like uint32_t and uint64_t
+#include <mutex> // Includes mutex for merging per-client results
+#include <random> // Includes the random library for payloads and think times
+#include <string> // Includes the string library for std::string operations
+#include <thread> // Includes threads for simulated clients
+#include <vector> // Includes the vector library for dynamic arrays
+#include "crc32.h" // Includes the shared CRC32 engine
+#include "socket_io.h" // Includes sendAll and recvExact, the helpers being measured
+
+#pragma comment(lib, "ws2_32.lib") // Links the Winsock library to the program
+using namespace std; // Uses the standard namespace to avoid prefixing std::
+typedef chrono::steady_clock Clock; // Monotonic clock for every measurement
+
+// Load generator and microbenchmarks for the transfer server.
+//
+// Load: M simulated clients connect to a running server, take their UUID, and issue 'D' and 'U'
+// transfers with the same wire format as client.cpp, reconnecting after a number of transfers so
+// connection setup is part of the load. Each transfer's latency (command sent to CRC received) is
+// recorded; the report gives aggregate throughput, connections per second and latency percentiles.
+//
+// Micro: CRC kernels over several block sizes, and sendAll/recvExact over a loopback connection
+// at several buffer sizes. Neither needs the server.
+
+struct BenchConfig
+{
+    string host = "127.0.0.1"; // Server address
+    int port = 54000; // Server port
+    int clients = 8; // Concurrent simulated clients
+    double seconds = 10; // Length of the load phase
+    uint64_t uploadBytes = 1 << 20; // Size of each upload
+    double uploadShare = 0.5; // Fraction of transfers that are uploads
+    int thinkMs = 0; // Pause between transfers of one client
+    int transfersPerConnection = 10; // Transfers before a client reconnects (0 = never)
+    bool load = true; // Runs the load phase
+    bool micro = true; // Runs the microbenchmarks
+};
+
+// Totals of one simulated client, merged at the end
+struct ClientStats
+{
+    vector<double> latencies; // Seconds per transfer
+    uint64_t bytes = 0; // Payload bytes moved
+    uint64_t connections = 0; // UUID handshakes completed
+    uint64_t failures = 0; // Transfers that failed or did not verify
+};
+
+// Connects and completes the UUID handshake; returns INVALID_SOCKET on failure
+SOCKET connectAndHandshake(const BenchConfig &config)
+{
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0); // Creates a TCP socket
+    sockaddr_in addr{}; // Server address
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<u_short>(config.port));
+    inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr);
+    if (connect(sock, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) // Connects to the server
+    {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    uint32_t uuidLen = 0; // Length of the UUID
+    char uuid[64]; // The UUID itself (discarded)
+    if (!recvExact(sock, reinterpret_cast<char *>(&uuidLen), sizeof(uuidLen)) || uuidLen > sizeof(uuid) ||
+        !recvExact(sock, uuid, static_cast<int>(uuidLen))) // Receives the UUID like a real client
+    {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// One 'D': receives the file and checks its CRC; returns false on failure or mismatch
+bool benchDownload(SOCKET sock, vector<char> &buffer, uint64_t &bytes)
+{
+    char cmd = 'D'; // Download command
+    uint64_t fileSize = 0; // Size announced by the server
+    if (!sendAll(sock, &cmd, 1) || !recvExact(sock, reinterpret_cast<char *>(&fileSize), sizeof(fileSize)) || fileSize == 0)
+        return false;
+    uint32_t crc = 0; // CRC of the received data
+    for (uint64_t got = 0; got < fileSize;) // Receives the payload
+    {
+        int r = recv(sock, buffer.data(), static_cast<int>(min<uint64_t>(buffer.size(), fileSize - got)), 0); // Whatever has arrived
+        if (r <= 0)
+            return false;
+        crc = CRC32::update(crc, buffer.data(), r);
+        got += static_cast<uint64_t>(r);
+    }
+    uint32_t serverCRC = 0; // CRC sent by the server
+    if (!recvExact(sock, reinterpret_cast<char *>(&serverCRC), sizeof(serverCRC)))
+        return false;
+    bytes += fileSize;
+    return crc == serverCRC;
+}
+
+// One 'U' of payload; returns false on failure or mismatch
+bool benchUpload(SOCKET sock, const vector<char> &payload, uint32_t payloadCRC, uint64_t &bytes)
+{
+    char cmd = 'U'; // Upload command
+    uint64_t size = payload.size(); // Announced size
+    if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(&size), sizeof(size)))
+        return false;
+    for (size_t sent = 0; sent < payload.size();) // Sends in 64 KiB pieces, like a streaming client
+    {
+        int n = static_cast<int>(min<size_t>(payload.size() - sent, 64 * 1024));
+        if (!sendAll(sock, payload.data() + sent, n))
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    uint32_t serverCRC = 0; // CRC computed by the server
+    if (!recvExact(sock, reinterpret_cast<char *>(&serverCRC), sizeof(serverCRC)))
+        return false;
+    bytes += payload.size();
+    return serverCRC == payloadCRC;
+}
+
+// Runs one simulated client until the deadline
+void simulatedClient(const BenchConfig &config, int index, Clock::time_point deadline, const vector<char> &payload, uint32_t payloadCRC, ClientStats &stats)
+{
+    mt19937 rng(static_cast<unsigned>(index) * 7919u + 1); // Per-client sequence, reproducible across runs
+    uniform_real_distribution<double> coin(0.0, 1.0); // Picks upload or download
+    vector<char> buffer(64 * 1024); // Receive buffer for downloads
+    SOCKET sock = INVALID_SOCKET; // Current connection
+    int onConnection = 0; // Transfers on it so far
+    while (Clock::now() < deadline) // Until the load phase ends
+    {
+        if (sock == INVALID_SOCKET) // Needs a (new) connection
+        {
+            sock = connectAndHandshake(config);
+            if (sock == INVALID_SOCKET) // Server unreachable or overloaded
+            {
+                ++stats.failures;
+                this_thread::sleep_for(chrono::milliseconds(100)); // Backs off before retrying
+                continue;
+            }
+            ++stats.connections;
+            onConnection = 0;
+        }
+
+        bool upload = coin(rng) < config.uploadShare; // Transfer type
+        Clock::time_point start = Clock::now(); // Latency starts with the command
+        bool ok = upload ? benchUpload(sock, payload, payloadCRC, stats.bytes) : benchDownload(sock, buffer, stats.bytes);
+        stats.latencies.push_back(chrono::duration<double>(Clock::now() - start).count());
+        if (!ok) // Connection state unknown: starts over
+        {
+            ++stats.failures;
+            closesocket(sock);
+            sock = INVALID_SOCKET;
+            continue;
+        }
+        if (config.transfersPerConnection > 0 && ++onConnection >= config.transfersPerConnection) // Reconnects
+        {
+            char quit = 'Q'; // Leaves like a real client
+            sendAll(sock, &quit, 1);
+            closesocket(sock);
+            sock = INVALID_SOCKET;
+        }
+        if (config.thinkMs > 0) // Simulated user think time
+            this_thread::sleep_for(chrono::milliseconds(config.thinkMs));
+    }
+    if (sock != INVALID_SOCKET) // Leaves cleanly
+    {
+        char quit = 'Q';
+        sendAll(sock, &quit, 1);
+        closesocket(sock);
+    }
+}
+
+// Value at fraction p of sorted samples
+double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5); // Nearest rank
+    return sorted[min(i, sorted.size() - 1)];
+}
+
+// Runs the load phase against a live server and prints the report
+void runLoad(const BenchConfig &config)
+{
+    vector<char> payload(static_cast<size_t>(config.uploadBytes)); // Upload data: random, so it does not compress or deduplicate
+    mt19937 rng(12345);
+    for (char &c : payload)
+        c = static_cast<char>(rng());
+    uint32_t payloadCRC = CRC32::update(0, payload.data(), payload.size()); // Expected server CRC
+
+    cout << "[Bench] Load: " << config.clients << " clients for " << config.seconds << " s, uploads of " << config.uploadBytes
+         << " bytes (" << config.uploadShare * 100 << "%), think " << config.thinkMs << " ms.\n"; // Prints the scenario
+    vector<ClientStats> stats(config.clients); // One per client, merged afterwards
+    vector<thread> threads; // Simulated clients
+    Clock::time_point start = Clock::now(); // Start of the phase
+    Clock::time_point deadline = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(config.seconds));
+    for (int i = 0; i < config.clients; ++i) // Starts every client
+        threads.emplace_back(simulatedClient, cref(config), i, deadline, cref(payload), payloadCRC, ref(stats[i]));
+    for (thread &t : threads) // Waits for them
+        t.join();
+    double elapsed = chrono::duration<double>(Clock::now() - start).count(); // Includes transfers that ran past the deadline
+
+    ClientStats total; // Merged results
+    for (const ClientStats &s : stats)
+    {
+        total.latencies.insert(total.latencies.end(), s.latencies.begin(), s.latencies.end());
+        total.bytes += s.bytes;
+        total.connections += s.connections;
+        total.failures += s.failures;
+    }
+    sort(total.latencies.begin(), total.latencies.end());
+    cout << "[Bench] Transfers: " << total.latencies.size() << " (" << total.failures << " failed), " << total.latencies.size() / elapsed << "/s\n"; // Prints rates
+    cout << "[Bench] Throughput: " << (total.bytes / 1048576.0) / elapsed << " MiB/s\n";
+    cout << "[Bench] Connections: " << total.connections << ", " << total.connections / elapsed << "/s\n";
+    cout << "[Bench] Latency ms: p50 " << percentile(total.latencies, 0.50) * 1000 << ", p99 " << percentile(total.latencies, 0.99) * 1000
+         << ", p99.9 " << percentile(total.latencies, 0.999) * 1000 << ", max " << (total.latencies.empty() ? 0 : total.latencies.back() * 1000) << "\n";
+}
+
+// Times one CRC kernel over blocks of the given size; returns MiB/s
+double timeKernel(CRC32::Kernel kernel, const vector<char> &data, size_t block)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data()); // Input
+    uint64_t processed = 0; // Bytes checksummed
+    uint32_t sink = 0; // Keeps the result observable
+    Clock::time_point start = Clock::now(); // Start of the measurement
+    double elapsed = 0; // Seconds so far
+    while (elapsed < 0.25) // Long enough to be stable, short enough for many configurations
+    {
+        for (size_t off = 0; off + block <= data.size(); off += block) // Independent blocks, like per-chunk checksums
+            sink ^= kernel(~0u, bytes + off, block);
+        processed += data.size() / block * block;
+        elapsed = chrono::duration<double>(Clock::now() - start).count();
+    }
+    if (sink == 0x12345678) // Practically never; stops the compiler from dropping the work
+        cout << "";
+    return (processed / 1048576.0) / elapsed;
+}
+
+// CRC kernels at several block sizes
+void runCrcMicro()
+{
+    vector<char> data(4 << 20); // 4 MiB of input, larger than most caches' fast levels
+    mt19937 rng(1);
+    for (char &c : data)
+        c = static_cast<char>(rng());
+    struct Named
+    {
+        const char *name; // Kernel name
+        CRC32::Kernel kernel; // Kernel
+    };
+    vector<Named> kernels = {{"slicing-by-8", &CRC32::slicing8Kernel}, {"slicing-by-16", &CRC32::slicing16Kernel}}; // Always available
+#ifdef CRC32_HAVE_PCLMUL
+    if (string(CRC32::engineName()) == "pclmul") // CPU supports it
+        kernels.push_back({"pclmul", &CRC32::pclmulKernel});
+#endif
+    cout << "[Bench] CRC32 MiB/s (dispatch picks " << CRC32::engineName() << ")\n";
+    cout << "[Bench]   bitwise, 4096 B blocks: " << timeKernel(&CRC32::bitwiseKernel, vector<char>(data.begin(), data.begin() + (256 << 10)), 4096) << "\n"; // Reference, on less data
+    for (const Named &k : kernels) // Every table and hardware kernel
+        for (size_t block : {64, 1024, 4096, 65536, 1 << 20})
+            cout << "[Bench]   " << k.name << ", " << block << " B blocks: " << timeKernel(k.kernel, data, block) << "\n";
+}
+
+// sendAll/recvExact throughput over loopback at several buffer sizes
+void runSocketMicro()
+{
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, 0); // Ephemeral loopback listener
+    sockaddr_in addr{}; // Bound address
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0; // Any free port
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int addrLen = sizeof(addr); // For getsockname
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR || listen(listener, 1) == SOCKET_ERROR ||
+        getsockname(listener, (sockaddr *)&addr, &addrLen) == SOCKET_ERROR) // Learns the port
+    {
+        cerr << "[Bench] Cannot open a loopback listener.\n"; // Prints error message
+        closesocket(listener);
+        return;
+    }
+    SOCKET sender = socket(AF_INET, SOCK_STREAM, 0); // Sending side
+    if (connect(sender, (sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR)
+    {
+        cerr << "[Bench] Cannot connect over loopback.\n"; // Prints error message
+        closesocket(sender);
+        closesocket(listener);
+        return;
+    }
+    SOCKET receiver = accept(listener, nullptr, nullptr); // Receiving side
+    closesocket(listener);
+
+    const uint64_t total = 256ull << 20; // Bytes per buffer size
+    cout << "[Bench] sendAll/recvExact over loopback, MiB/s\n";
+    for (int size : {512, 4096, 16384, 65536, 262144, 1 << 20}) // Buffer sizes per call
+    {
+        vector<char> out(size, 'x'); // Send buffer
+        uint64_t calls = total / size; // Calls on each side
+        Clock::time_point start = Clock::now(); // Start of the measurement
+        thread reader([receiver, size, calls]() { // Receives in calls of the same size
+            vector<char> in(size); // Receive buffer
+            for (uint64_t i = 0; i < calls; ++i)
+                if (!recvExact(receiver, in.data(), size))
+                    return;
+        });
+        bool ok = true; // False if the connection broke
+        for (uint64_t i = 0; i < calls && ok; ++i)
+            ok = sendAll(sender, out.data(), size);
+        reader.join();
+        double elapsed = chrono::duration<double>(Clock::now() - start).count(); // Until the last byte was received
+        cout << "[Bench]   " << size << " B: " << (ok ? (calls * size / 1048576.0) / elapsed : 0) << "\n";
+    }
+    closesocket(sender);
+    closesocket(receiver);
+}
+
+// Main function, entry point of the program
+int main(int argc, char *argv[])
+{
+    BenchConfig config; // Scenario
+    for (int i = 1; i < argc; ++i) // Parses command-line options
+    {
+        string arg = argv[i]; // Current option
+        if (arg == "--host" && i + 1 < argc) // Server address
+            config.host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc) // Server port
+            config.port = stoi(argv[++i]);
+        else if (arg == "--clients" && i + 1 < argc) // Concurrent simulated clients
+            config.clients = max(1, stoi(argv[++i]));
+        else if (arg == "--seconds" && i + 1 < argc) // Length of the load phase
+            config.seconds = max(0.1, stod(argv[++i]));
+        else if (arg == "--upload-kb" && i + 1 < argc) // Size of each upload
+            config.uploadBytes = max<uint64_t>(1, stoull(argv[++i])) * 1024;
+        else if (arg == "--upload-share" && i + 1 < argc) // Fraction of uploads, 0 to 1
+            config.uploadShare = min(1.0, max(0.0, stod(argv[++i])));
+        else if (arg == "--think-ms" && i + 1 < argc) // Pause between transfers
+            config.thinkMs = max(0, stoi(argv[++i]));
+        else if (arg == "--per-connection" && i + 1 < argc) // Transfers before reconnecting (0 = never)
+            config.transfersPerConnection = max(0, stoi(argv[++i]));
+        else if (arg == "--micro-only") // Skips the load phase (no server needed)
+            config.load = false;
+        else if (arg == "--load-only") // Skips the microbenchmarks
+            config.micro = false;
+        else
+        {
+            cerr << "Usage: bench [--host A] [--port N] [--clients M] [--seconds S] [--upload-kb N] [--upload-share F]"
+                    " [--think-ms N] [--per-connection N] [--micro-only | --load-only]\n"; // Prints usage for unknown options
+            return 1; // Exits with error code
+        }
+    }
+
+    WSADATA wsaData; // Structure to hold Winsock initialization data
+    WSAStartup(MAKEWORD(2, 2), &wsaData); // Initializes Winsock version 2.2
+    if (config.micro) // No server needed
+    {
+        runCrcMicro();
+        runSocketMicro();
+    }
+    if (config.load) // Needs a running server
+        runLoad(config);
+    WSACleanup(); // Cleans up Winsock resources
+    return 0; // Exits the program successfully
+}
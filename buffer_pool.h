@@ -0,0 +1,189 @@
+#ifndef BUFFER_POOL_H // Prevents multiple inclusions of this header file
+#define BUFFER_POOL_H // Defines the header guard macro
+
+#include <algorithm> // Includes std::max
+#include <cstddef> // Includes size_t
+#include <functional> // Includes std::function for wake-ups
+#include <memory> // Includes shared_ptr for chunks and accounts
+#include <mutex> // Includes mutex for the pool state
+#include <vector> // Includes the vector library for chunk storage
+#include "metrics.h" // Includes the backpressure counter
+
+// Memory for transfer data that sessions hold in user space, shared by every connection.
+//
+// Outgoing data that has to be copied (file reads without TransmitFile, compressed frames) goes
+// through chunks of chunkSize bytes that are recycled instead of freed. Each connection has an
+// Account; a chunk is charged to it until the socket has sent it. Bytes a connection holds in other
+// buffers (upload data the disk has not taken yet) are charged with charge()/uncharge().
+//
+// acquire() and admit() refuse once the process-wide budget or the connection's cap is spent. The
+// caller then stops producing or pauses reading, so TCP pushes back on the peer, and the account's
+// wake() is called once memory is returned. Charged bytes plus idle chunks never exceed the budget.
+class BufferPool
+{
+public:
+    // Memory charged to one connection. wake() may be called from any thread.
+    class Account
+    {
+    public:
+        explicit Account(std::function<void()> wake) : wake(std::move(wake)) {}
+
+        size_t bytes() const { return used; } // Bytes charged (approximate outside the pool lock)
+
+    private:
+        friend class BufferPool; // The pool updates the charge
+
+        std::function<void()> wake; // Called once memory is returned after a refusal
+        size_t used = 0; // Bytes charged (pool mutex)
+        bool waiting = false; // True while registered for a wake-up (pool mutex)
+    };
+
+    typedef std::shared_ptr<Account> AccountPtr; // Kept alive by the chunks charged to it
+    typedef std::shared_ptr<std::vector<char>> ChunkPtr; // Returned to the pool when the last reference goes
+
+    // Chunks of chunkSize bytes, at most budget bytes in total and perConnection per account
+    BufferPool(size_t chunkSize, size_t budget, size_t perConnection)
+        : chunk(chunkSize), budget(std::max(budget, chunkSize)), perConnection(std::max(perConnection, chunkSize))
+    {
+    }
+
+    ~BufferPool() // Frees the idle chunks (live ones are owned by send queues)
+    {
+        for (std::vector<char> *c : idle)
+            delete c;
+    }
+
+    BufferPool(const BufferPool &) = delete; // Owns the idle chunks, not copyable
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    size_t chunkSize() const { return chunk; } // Bytes in every chunk
+
+    // Takes a chunk charged to account, or returns null (and arranges a wake-up) if the budget is spent
+    ChunkPtr acquire(const AccountPtr &account)
+    {
+        std::vector<char> *c = nullptr; // Chunk handed out
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the pool
+            if (!fits(*account, chunk)) // Over the budget or the connection's cap
+            {
+                refuse(account);
+                return nullptr;
+            }
+            used += chunk;
+            account->used += chunk;
+            if (!idle.empty()) // Recycles a returned chunk
+            {
+                c = idle.back();
+                idle.pop_back();
+            }
+        }
+        if (!c) // First use of this slot of the budget
+            c = new std::vector<char>(chunk);
+        return ChunkPtr(c, [this, account](std::vector<char> *done) { release(done, account); }); // Sent or dropped: back to the pool
+    }
+
+    // True if account may take on headroom more bytes; otherwise arranges a wake-up
+    bool admit(const AccountPtr &account, size_t headroom)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the pool
+        if (fits(*account, headroom))
+            return true;
+        refuse(account);
+        return false;
+    }
+
+    // Charges bytes already held outside the pool (never refused: the memory exists; admit() first)
+    void charge(const AccountPtr &account, size_t bytes)
+    {
+        if (bytes == 0)
+            return;
+        std::lock_guard<std::mutex> lock(mutex); // Protects the pool
+        used += bytes;
+        account->used += bytes;
+        while (!idle.empty() && used + idle.size() * chunk > budget) // Idle chunks give way to live data
+        {
+            delete idle.back();
+            idle.pop_back();
+        }
+    }
+
+    // Releases bytes charged with charge()
+    void uncharge(const AccountPtr &account, size_t bytes)
+    {
+        if (bytes == 0)
+            return;
+        std::vector<AccountPtr> wakeups; // Accounts to wake outside the lock
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the pool
+            used -= bytes;
+            account->used -= bytes;
+            takeWaiters(wakeups);
+        }
+        wakeAll(wakeups);
+    }
+
+    size_t bytesInUse() // Bytes charged across all accounts
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the counter
+        return used;
+    }
+
+private:
+    bool fits(const Account &account, size_t bytes) const // Both limits allow bytes more (pool mutex)
+    {
+        return used + bytes <= budget && account.used + bytes <= perConnection;
+    }
+
+    void refuse(const AccountPtr &account) // Registers account for a wake-up once (pool mutex)
+    {
+        Metrics::add(Metrics::MEMORY_WAITS);
+        if (account->waiting)
+            return;
+        account->waiting = true;
+        waiting.push_back(account);
+    }
+
+    void takeWaiters(std::vector<AccountPtr> &out) // Everyone waiting may try again (pool mutex)
+    {
+        out.swap(waiting);
+        for (auto &a : out)
+            a->waiting = false;
+    }
+
+    static void wakeAll(std::vector<AccountPtr> &accounts) // Calls each wake-up
+    {
+        for (auto &a : accounts)
+            if (a->wake)
+                a->wake();
+    }
+
+    // Returns a chunk once its last reference is gone
+    void release(std::vector<char> *c, const AccountPtr &account)
+    {
+        std::vector<AccountPtr> wakeups; // Accounts to wake outside the lock
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the pool
+            used -= chunk;
+            account->used -= chunk;
+            if (used + (idle.size() + 1) * chunk <= budget) // Kept for reuse
+            {
+                idle.push_back(c);
+                c = nullptr;
+            }
+            takeWaiters(wakeups);
+        }
+        delete c; // No room to keep it idle
+        wakeAll(wakeups);
+    }
+
+    const size_t chunk; // Bytes in every chunk
+    const size_t budget; // Process-wide limit
+    const size_t perConnection; // Limit of one account
+
+    std::mutex mutex; // Protects the fields below and every Account's used and waiting
+    size_t used = 0; // Bytes charged across all accounts
+    std::vector<std::vector<char> *> idle; // Returned chunks ready for reuse
+    std::vector<AccountPtr> waiting; // Accounts refused since the last release
+};
+
+#endif // Ends the header guard
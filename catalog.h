@@ -0,0 +1,419 @@
+#ifndef CATALOG_H // Prevents multiple inclusions of this header file
+#define CATALOG_H // Defines the header guard macro
+
+#include <windows.h> // Includes directory enumeration and change notification functions
+#include <algorithm> // Includes std::min
+#include <atomic> // Includes atomics for the watcher state
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <cstring> // Includes memset
+#include <mutex> // Includes unique_lock for writers
+#include <set> // Includes set for the name order used by listings
+#include <shared_mutex> // Includes shared_mutex: lookups from every loop share the lock
+#include <string> // Includes the string library for names and paths
+#include <thread> // Includes the thread library for the watcher
+#include <unordered_map> // Includes unordered_map for O(1) lookups by name
+#include <utility> // Includes pair for listing entries
+#include <vector> // Includes the vector library for scan stacks and listings
+
+// Index of the files served from one root directory: name -> size, modification time and (once
+// known) CRC32. Built by one scan at startup and kept current by a watcher thread reading
+// ReadDirectoryChangesW for the whole tree; when the change buffer overflows, the tree is scanned
+// again. Lookups are one hash probe under a shared lock; listings walk a sorted set of the same
+// names, so a page costs O(log n + page size) however large the tree is.
+//
+// Names are relative paths with '/' separators. A name component may not start with '.', so the
+// staging directory for uploads (.incoming) and other hidden entries are never served or listed.
+// CRCs are not computed by the catalog: they are learned from the content cache and from uploads,
+// and forgotten when the file changes.
+class Catalog
+{
+public:
+    static constexpr size_t MAX_NAME = 1024; // Longest name accepted
+    static constexpr uint32_t MAX_LIST = 1000; // Most entries in one listing page
+
+    // What the catalog knows about one file
+    struct Info
+    {
+        uint64_t size = 0; // File size in bytes
+        uint64_t mtime = 0; // Last write time (FILETIME ticks, as in FileIdentity)
+        uint32_t crc = 0; // CRC32 of the whole file (valid if crcKnown)
+        bool crcKnown = false; // True once this version was hashed or uploaded
+    };
+    typedef std::pair<std::string, Info> Listing; // One entry of a listing
+
+    // Scans root; watch keeps the index current afterwards
+    Catalog(const std::string &root, bool watch) : root(root)
+    {
+        CreateDirectoryA(root.c_str(), nullptr); // Creates the root (fails harmlessly if it exists)
+        CreateDirectoryA(stagingDir().c_str(), nullptr); // Creates the staging directory
+        if (watch) // Watches before scanning, so nothing changes unseen in between
+        {
+            dir = CreateFileA(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr); // Directory handle for change notifications
+            ioEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr); // Signals a batch of changes
+            stopEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr); // Signals shutdown
+            if (dir != INVALID_HANDLE_VALUE && ioEvent && stopEvent && arm()) // First read queued
+            {
+                watchingNow = true;
+                watcher = std::thread(&Catalog::watchLoop, this);
+            }
+        }
+        rescan(); // Builds the index
+    }
+
+    ~Catalog() // Stops the watcher
+    {
+        if (watcher.joinable()) // Watcher running
+        {
+            SetEvent(stopEvent); // Asks it to exit
+            watcher.join();
+        }
+        if (dir != INVALID_HANDLE_VALUE)
+            CloseHandle(dir);
+        if (ioEvent)
+            CloseHandle(ioEvent);
+        if (stopEvent)
+            CloseHandle(stopEvent);
+    }
+
+    Catalog(const Catalog &) = delete; // Owns a thread and handles, not copyable
+    Catalog &operator=(const Catalog &) = delete;
+
+    bool watching() const { return watchingNow.load(); } // False if changes are not being tracked
+
+    // True for a relative path of visible components without characters Windows treats specially
+    static bool validName(const std::string &name)
+    {
+        if (name.empty() || name.size() > MAX_NAME) // Empty or absurdly long
+            return false;
+        size_t start = 0; // Start of the current component
+        for (size_t i = 0; i <= name.size(); ++i) // Checks each component
+        {
+            if (i < name.size() && name[i] != '/') // Inside a component
+            {
+                unsigned char c = static_cast<unsigned char>(name[i]);
+                if (c < 32 || c == '\\' || c == ':' || c == '*' || c == '?' || c == '"' || c == '<' || c == '>' || c == '|') // Reserved
+                    return false;
+                continue;
+            }
+            if (i == start || name[start] == '.') // Empty, ".", ".." or hidden component
+                return false;
+            if (name[i - 1] == '.' || name[i - 1] == ' ') // Windows drops trailing dots and spaces, so the file would have another name
+                return false;
+            if (deviceName(name.substr(start, i - start))) // CON, NUL, COM1...: opens a device, not a file
+                return false;
+            start = i + 1;
+        }
+        return true;
+    }
+
+    // True if a path component names a reserved DOS device, with or without an extension ("nul.txt" is NUL too)
+    static bool deviceName(const std::string &component)
+    {
+        std::string base = component.substr(0, component.find('.')); // Devices ignore the extension
+        while (!base.empty() && base.back() == ' ') // And spaces before it
+            base.pop_back();
+        if (base.size() != 3 && base.size() != 4)
+            return false;
+        std::string upper; // Case-insensitive comparison
+        for (char c : base)
+            upper += static_cast<char>(c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c);
+        if (upper == "CON" || upper == "PRN" || upper == "AUX" || upper == "NUL")
+            return true;
+        std::string prefix = upper.substr(0, 3); // COM1-COM9, LPT1-LPT9
+        return upper.size() == 4 && (prefix == "COM" || prefix == "LPT") && upper[3] >= '1' && upper[3] <= '9';
+    }
+
+    // Path of a name on disk
+    std::string pathOf(const std::string &name) const
+    {
+        std::string path = root + "\\" + name; // Root-relative
+        for (size_t i = root.size() + 1; i < path.size(); ++i) // Windows separators
+            if (path[i] == '/')
+                path[i] = '\\';
+        return path;
+    }
+
+    // Temp file for an upload, on the root's volume so publishing it is an atomic rename
+    std::string stagingPath(const std::string &tag) const { return stagingDir() + "\\" + tag + ".tmp"; }
+
+    // Creates the directories a name lives in; returns false if one cannot be created
+    bool makeParents(const std::string &name) const
+    {
+        for (size_t slash = name.find('/'); slash != std::string::npos; slash = name.find('/', slash + 1)) // Each parent, outermost first
+        {
+            std::string parent = pathOf(name.substr(0, slash)); // Directory path
+            if (!CreateDirectoryA(parent.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) // Missing and cannot be made
+                return false;
+        }
+        return true;
+    }
+
+    // Looks a name up; returns false if no such file is served
+    bool find(const std::string &name, Info &info) const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex); // Readers share the index
+        auto it = entries.find(name);
+        if (it == entries.end())
+            return false;
+        info = it->second;
+        return true;
+    }
+
+    // Records the CRC of a name's version (size and mtime) if that version is still the current one
+    void learnCrc(const std::string &name, uint64_t size, uint64_t mtime, uint32_t crc)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex); // Writer
+        auto it = entries.find(name);
+        if (it != entries.end() && it->second.size == size && it->second.mtime == mtime) // Same version
+        {
+            it->second.crc = crc;
+            it->second.crcKnown = true;
+        }
+    }
+
+    // Indexes a file this server just published, with its CRC, without waiting for the watcher
+    void published(const std::string &name, uint32_t crc)
+    {
+        Info info; // Version on disk
+        if (!stat(name, info)) // Gone already
+            return;
+        info.crc = crc;
+        info.crcKnown = true;
+        std::unique_lock<std::shared_mutex> lock(mutex); // Writer
+        putLocked(name, info);
+    }
+
+    // Up to max entries (at most MAX_LIST) whose names start with prefix and sort after after, in
+    // name order; more is set if the listing was cut short
+    std::vector<Listing> list(const std::string &prefix, const std::string &after, uint32_t max, bool &more) const
+    {
+        std::vector<Listing> out; // Page being built
+        max = std::min(max, MAX_LIST);
+        std::shared_lock<std::shared_mutex> lock(mutex); // Readers share the index
+        auto it = after < prefix ? order.lower_bound(&prefix) : order.upper_bound(&after); // First candidate
+        for (; it != order.end() && (*it)->compare(0, prefix.size(), prefix) == 0; ++it) // Stops at the end of the prefix range
+        {
+            if (out.size() == max) // Page full
+            {
+                more = true;
+                return out;
+            }
+            out.emplace_back(**it, entries.find(**it)->second);
+        }
+        more = false;
+        return out;
+    }
+
+    size_t count() const // Files served
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return entries.size();
+    }
+
+private:
+    struct NameLess // Orders name pointers by the names
+    {
+        bool operator()(const std::string *a, const std::string *b) const { return *a < *b; }
+    };
+    typedef std::unordered_map<std::string, Info> Index; // Files by name
+
+    static constexpr DWORD WATCH_FILTER = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                                          FILE_NOTIFY_CHANGE_LAST_WRITE; // Changes that affect the index
+    static constexpr size_t WATCH_BUFFER = 64 * 1024; // Bytes of notifications per read (larger is not allowed over the network)
+
+    std::string stagingDir() const { return root + "\\.incoming"; } // Upload temp files
+
+    static Info infoOf(DWORD sizeHigh, DWORD sizeLow, const FILETIME &written) // Index fields from Win32 metadata
+    {
+        Info info;
+        info.size = (static_cast<uint64_t>(sizeHigh) << 32) | sizeLow;
+        info.mtime = (static_cast<uint64_t>(written.dwHighDateTime) << 32) | written.dwLowDateTime;
+        return info;
+    }
+
+    // Reads the metadata of a name; returns false if it is not a regular file
+    bool stat(const std::string &name, Info &info) const
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data; // Receives the metadata
+        if (!GetFileAttributesExA(pathOf(name).c_str(), GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            return false;
+        info = infoOf(data.nFileSizeHigh, data.nFileSizeLow, data.ftLastWriteTime);
+        return true;
+    }
+
+    // Adds every file under the directory name ("" = the root) to out
+    void scanTree(const std::string &top, Index &out) const
+    {
+        std::vector<std::string> pending{top}; // Directories still to list
+        while (!pending.empty()) // Iterative, so deep trees cannot overflow the stack
+        {
+            std::string dirName = pending.back(); // Directory to list
+            pending.pop_back();
+            std::string pattern = (dirName.empty() ? root : pathOf(dirName)) + "\\*"; // Everything in it
+            WIN32_FIND_DATAA found; // One directory entry
+            HANDLE search = FindFirstFileExA(pattern.c_str(), FindExInfoBasic, &found, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+            if (search == INVALID_HANDLE_VALUE) // Empty, vanished or unreadable
+                continue;
+            do
+            {
+                std::string name = dirName.empty() ? std::string(found.cFileName) : dirName + "/" + found.cFileName; // Catalog name
+                if (!validName(name)) // ".", "..", hidden entries, the staging directory
+                    continue;
+                if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) // A file
+                    out[name] = infoOf(found.nFileSizeHigh, found.nFileSizeLow, found.ftLastWriteTime);
+                else if (!(found.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) // A real subdirectory (links could loop)
+                    pending.push_back(name);
+            } while (FindNextFileA(search, &found));
+            FindClose(search);
+        }
+    }
+
+    // Inserts or updates a file, keeping a known CRC if the version did not change (writer lock held)
+    void putLocked(const std::string &name, Info info)
+    {
+        auto inserted = entries.emplace(name, info); // New name, or the existing entry
+        if (inserted.second) // New name
+        {
+            order.insert(&inserted.first->first); // Keys of an unordered_map never move
+            return;
+        }
+        Info &old = inserted.first->second; // Current entry
+        if (!info.crcKnown && old.crcKnown && old.size == info.size && old.mtime == info.mtime) // Same version: the CRC still holds
+        {
+            info.crc = old.crc;
+            info.crcKnown = true;
+        }
+        old = info;
+    }
+
+    // Removes a file, or every file under a directory name (writer lock held)
+    void forgetLocked(const std::string &name)
+    {
+        auto it = entries.find(name);
+        if (it != entries.end()) // A file
+        {
+            order.erase(&it->first);
+            entries.erase(it);
+        }
+        std::string below = name + "/"; // Contents, if it was a directory
+        auto first = order.lower_bound(&below);
+        auto last = first;
+        while (last != order.end() && (*last)->compare(0, below.size(), below) == 0) // Every name under it
+            ++last;
+        std::vector<std::string> gone; // Names to erase once out of the set
+        for (auto i = first; i != last; ++i)
+            gone.push_back(**i);
+        order.erase(first, last);
+        for (const std::string &g : gone)
+            entries.erase(g);
+    }
+
+    // Rebuilds the index from disk, keeping the CRCs of unchanged files
+    void rescan()
+    {
+        Index fresh; // New index, built without the lock
+        scanTree("", fresh);
+        std::unique_lock<std::shared_mutex> lock(mutex); // Writer
+        for (auto &entry : fresh) // Carries over what is still valid
+        {
+            auto old = entries.find(entry.first);
+            if (old != entries.end() && old->second.crcKnown && old->second.size == entry.second.size && old->second.mtime == entry.second.mtime)
+                entry.second = old->second;
+        }
+        order.clear();
+        entries.swap(fresh);
+        for (const auto &entry : entries) // Orders the new keys
+            order.insert(&entry.first);
+    }
+
+    // Brings one name up to date after a change notification; added directories are scanned whole
+    void refresh(const std::string &name, bool added)
+    {
+        if (!validName(name)) // Staging and hidden entries are not served
+            return;
+        WIN32_FILE_ATTRIBUTE_DATA data; // Current state on disk
+        if (!GetFileAttributesExA(pathOf(name).c_str(), GetFileExInfoStandard, &data)) // Deleted or renamed away
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            forgetLocked(name);
+            return;
+        }
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) // A file was created or changed
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            putLocked(name, infoOf(data.nFileSizeHigh, data.nFileSizeLow, data.ftLastWriteTime));
+            return;
+        }
+        if (!added || (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) // A directory's own timestamps changed, or a link
+            return;
+        Index found; // A directory appeared (created or moved in): its contents arrive with no events of their own
+        scanTree(name, found);
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (auto &entry : found)
+            putLocked(entry.first, entry.second);
+    }
+
+    // Queues the next change notification read; returns false if the directory cannot be watched
+    bool arm()
+    {
+        memset(&overlapped, 0, sizeof(overlapped)); // Resets the OVERLAPPED for reuse
+        overlapped.hEvent = ioEvent; // Completion is signalled on the event
+        return ReadDirectoryChangesW(dir, notifications.data(), static_cast<DWORD>(WATCH_BUFFER), TRUE, WATCH_FILTER, nullptr, &overlapped, nullptr) != FALSE;
+    }
+
+    // Watcher thread: applies change notifications until the catalog is destroyed
+    void watchLoop()
+    {
+        HANDLE waits[2] = {ioEvent, stopEvent}; // A batch of changes, or shutdown
+        while (WaitForMultipleObjects(2, waits, FALSE, INFINITE) == WAIT_OBJECT_0) // Changes arrived
+        {
+            DWORD got = 0; // Bytes of notifications
+            bool overflowed = !GetOverlappedResult(dir, &overlapped, &got, FALSE) || got == 0; // Changes were lost
+            const char *raw = reinterpret_cast<const char *>(notifications.data()); // Records as bytes
+            std::vector<char> batch(raw, raw + (overflowed ? 0 : got)); // Copied, so the next read can start at once
+            if (!arm()) // Directory gone or no longer watchable
+            {
+                watchingNow = false;
+                return;
+            }
+            if (overflowed) // Too many changes at once: starts over
+            {
+                rescan();
+                continue;
+            }
+            for (size_t at = 0; at < batch.size();) // Walks the FILE_NOTIFY_INFORMATION records
+            {
+                const FILE_NOTIFY_INFORMATION *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(batch.data() + at); // Next record
+                int wide = static_cast<int>(info->FileNameLength / sizeof(WCHAR)); // Name length in UTF-16 units
+                std::string name(static_cast<size_t>(WideCharToMultiByte(CP_ACP, 0, info->FileName, wide, nullptr, 0, nullptr, nullptr)), '\0'); // Same code page as the *A functions
+                WideCharToMultiByte(CP_ACP, 0, info->FileName, wide, &name[0], static_cast<int>(name.size()), nullptr, nullptr);
+                for (char &c : name) // Catalog separators
+                    if (c == '\\')
+                        c = '/';
+                refresh(name, info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME);
+                if (info->NextEntryOffset == 0) // Last record
+                    break;
+                at += info->NextEntryOffset;
+            }
+        }
+        CancelIoEx(dir, &overlapped); // Shutdown: withdraws the outstanding read
+        DWORD ignored = 0;
+        GetOverlappedResult(dir, &overlapped, &ignored, TRUE); // Waits until the kernel is done with the buffer
+    }
+
+    std::string root; // Served directory
+    HANDLE dir = INVALID_HANDLE_VALUE; // Root handle for change notifications
+    HANDLE ioEvent = nullptr; // Set when a notification read completes
+    HANDLE stopEvent = nullptr; // Set on shutdown
+    OVERLAPPED overlapped{}; // State of the outstanding notification read
+    std::vector<DWORD> notifications = std::vector<DWORD>(WATCH_BUFFER / sizeof(DWORD)); // DWORD-aligned, as ReadDirectoryChangesW requires
+    std::atomic<bool> watchingNow{false}; // True while the watcher runs
+    std::thread watcher; // Applies change notifications
+
+    mutable std::shared_mutex mutex; // Protects entries and order
+    Index entries; // Files by name
+    std::set<const std::string *, NameLess> order; // The same names, sorted (point at the keys of entries)
+};
+
+#endif // Ends the header guard
@@ -3,56 +3,47 @@
 #include <winsock2.h> // Includes the Winsock 2 library for socket programming
 #include <ws2tcpip.h> // Includes additional Winsock functions for IP address handling
 #include <algorithm> // Includes the algorithm library for functions like std::min
+#include <atomic> // Includes atomics for the shared chunk counter
+#include <chrono> // Includes clocks for throughput measurement
 #include <cstdint> // Includes standard integer types like uint32_t and uint64_t
+#include <cstring> // Includes memcpy for packing delta ops
+#include <functional> // Includes std::function for the batch refill step
+#include <memory> // Includes unique_ptr for the v2 multiplexer
+#include <sstream> // Includes string streams for parsing manifest lines
 #include <string> // Includes the string library for std::string operations
+#include <thread> // Includes threads for striped transfers
+#include <vector> // Includes the vector library for dynamic arrays
+#include <unordered_map> // Includes hash maps for matching delta chunks
+#include "crc32.h" // Includes the shared CRC32 engine
+#include "delta_sync.h" // Includes content-defined chunking for delta uploads
+#include "file_io.h" // Includes positioned file reads and writes
+#include "local_transport.h" // Includes the same-host AF_UNIX transport
+#include "merkle.h" // Includes chunk hash trees for verified downloads
+#include "mux_client.h" // Includes the protocol v2 stream multiplexer
+#include "socket_io.h" // Includes sendAll and recvExact
 
 #pragma comment(lib, "ws2_32.lib") // Links the Winsock library to the program
 using namespace std; // Uses the standard namespace to avoid prefixing std::
 
 const char *SERVER_IP = "127.0.0.1"; // Defines the server IP address (localhost)
 const int PORT = 54000; // Defines the port number for the server
-const int BUFFER_SIZE = 4096; // Defines the buffer size for data transfer
+const int BUFFER_SIZE = 256 * 1024; // Defines the buffer size for data transfer (large, so each call moves a lot)
+const uint64_t RANGE_SIZE = 4ull * 1024 * 1024; // Bytes per verified range in resumable transfers
+const size_t RANGE_BUFFER_SIZE = 64 * 1024; // Buffer size for resumable transfers
+const int MAX_RETRIES = 5; // Reconnects (and resends of a damaged range) before giving up
+const uint64_t STRIPE_CHUNK = 8ull * 1024 * 1024; // Unit of work handed to one stream of a striped transfer
+const int MAX_STREAMS = 16; // Upper bound on parallel connections
+const int STRIPE_SOCKET_BUFFER = 4 * 1024 * 1024; // Socket buffer size for striped streams
+const int TUNE_INTERVAL_MS = 500; // Throughput sampling interval of the stream auto-tuner
+const double TUNE_GAIN = 1.1; // Minimum throughput gain that justifies one more stream
+const uint32_t LIST_PAGE = 1000; // Entries asked for per listing request
+const size_t BATCH_DEPTH = 32; // Default number of batch files in flight at once
+const uint64_t LOCAL_VIEW = 64ull * 1024 * 1024; // Bytes of a handed-over file mapped and copied at a time
 
-// Computes the CRC32 checksum for data integrity verification
-uint32_t crc32(const char *data, size_t length, uint32_t prev = 0)
-{
-    uint32_t crc = ~prev; // Inverts the previous CRC value (or 0 if none)
-    for (size_t i = 0; i < length; ++i) // Iterates over each byte of the data
-    {
-        crc ^= static_cast<uint8_t>(data[i]); // XORs the current byte with the CRC
-        for (int j = 0; j < 8; ++j) // Processes each bit of the byte
-            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1)); // Updates CRC using the polynomial
-    }
-    return ~crc; // Returns the inverted CRC value
-}
-
-// Sends all data in the buffer, handling partial sends
-bool sendAll(SOCKET sock, const char *data, int totalLen)
-{
-    int sent = 0; // Tracks the number of bytes sent
-    while (sent < totalLen) // Continues until all bytes are sent
-    {
-        int r = send(sock, data + sent, totalLen - sent, 0); // Sends remaining data
-        if (r <= 0) // Checks for errors or disconnection
-            return false; // Returns false if send fails
-        sent += r; // Updates the number of bytes sent
-    }
-    return true; // Returns true if all data is sent successfully
-}
-
-// Receives exactly the specified number of bytes
-bool recvExact(SOCKET sock, char *buffer, int bytesToRecv)
-{
-    int received = 0; // Tracks the number of bytes received
-    while (received < bytesToRecv) // Continues until all bytes are received
-    {
-        int r = recv(sock, buffer + received, bytesToRecv - received, 0); // Receives remaining data
-        if (r <= 0) // Checks for errors or disconnection
-            return false; // Returns false if receive fails
-        received += r; // Updates the number of bytes received
-    }
-    return true; // Returns true if all data is received successfully
-}
+string remoteName; // Server file selected with 'O' (empty = the server's default files), re-sent on every new connection
+bool preferLocal = true; // Tries the server's AF_UNIX socket before TCP when it runs on this machine
+string localPath; // That socket file (default: the server's default for PORT)
+bool localConnection = false; // True if the last connection went over the AF_UNIX socket
 
 // Handles file download from the server
 bool downloadFile(SOCKET sock)
@@ -69,18 +60,18 @@ bool downloadFile(SOCKET sock)
     cout << "[Client] Downloading " << fileSize << " bytes...\n"; // Prints download start message
 
     ofstream outFile("received.txt", ios::binary); // Opens output file in binary mode
-    char buffer[BUFFER_SIZE]; // Buffer for receiving file data
+    vector<char> buffer(BUFFER_SIZE); // Buffer for receiving file data (too large for the stack)
     uint32_t crc = 0; // Initializes CRC for integrity check
     uint64_t totalReceived = 0; // Tracks total bytes received
 
     while (totalReceived < fileSize) // Continues until all file bytes are received
     {
-        int bytesToRead = (int)min<uint64_t>(sizeof(buffer), fileSize - totalReceived); // Calculates bytes to read
-        int bytesRead = recv(sock, buffer, bytesToRead, 0); // Receives data into buffer
+        int bytesToRead = (int)min<uint64_t>(buffer.size(), fileSize - totalReceived); // Calculates bytes to read
+        int bytesRead = recv(sock, buffer.data(), bytesToRead, 0); // Receives data into buffer
         if (bytesRead <= 0) // Checks for errors or disconnection
             return false; // Returns false if receive fails
-        outFile.write(buffer, bytesRead); // Writes received data to file
-        crc = crc32(buffer, bytesRead, crc); // Updates CRC with received data
+        outFile.write(buffer.data(), bytesRead); // Writes received data to file
+        crc = CRC32::update(crc, buffer.data(), bytesRead); // Updates CRC with received data
         totalReceived += bytesRead; // Updates total bytes received
     }
 
@@ -98,6 +89,52 @@ bool downloadFile(SOCKET sock)
     return true; // Returns true to indicate successful download
 }
 
+// Copies the selected file out of a handle the server duplicated into this process ('H'). served is
+// false if the server refused (a TCP connection, or no such file), so the caller falls back to 'D'.
+// Returns false if the connection failed.
+bool localDownload(SOCKET sock, bool &served)
+{
+    char cmd = 'H'; // Handoff command
+    char status = 0; // 1 if a handle follows
+    served = false;
+    if (!sendAll(sock, &cmd, 1) || !recvExact(sock, &status, 1)) // Asks for the handle
+        return false;
+    if (status != 1) // Not available this way
+        return true;
+    uint64_t value = 0, fileSize = 0; // Handle value and file size
+    if (!recvExact(sock, reinterpret_cast<char *>(&value), sizeof(value)) || !recvExact(sock, reinterpret_cast<char *>(&fileSize), sizeof(fileSize)))
+        return false;
+    FileIO::Handle file = FileIO::wrap(reinterpret_cast<HANDLE>(static_cast<uintptr_t>(value))); // Ours now: closed when done
+    served = true;
+
+    auto start = chrono::steady_clock::now(); // For the throughput report
+    FileIO::Handle out = FileIO::create("received.txt", 0); // Output file
+    HANDLE section = fileSize > 0 ? CreateFileMappingA(static_cast<HANDLE>(file.get()), nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr; // Empty files cannot be mapped
+    FileIO::Handle mapping = section ? FileIO::wrap(section) : FileIO::Handle(); // CreateFileMapping reports failure as null, not INVALID_HANDLE_VALUE
+    if (!out || (fileSize > 0 && !mapping)) // Cannot write locally, or cannot map the server's file
+    {
+        cerr << "[Client] Cannot copy the handed-over file.\n"; // Prints error message
+        return true;
+    }
+    for (uint64_t offset = 0; offset < fileSize; offset += LOCAL_VIEW) // Copies one view at a time (offsets stay aligned to the allocation granularity)
+    {
+        size_t length = static_cast<size_t>(min(LOCAL_VIEW, fileSize - offset)); // Bytes in this view
+        const char *view = static_cast<const char *>(MapViewOfFile(static_cast<HANDLE>(mapping.get()), FILE_MAP_READ, static_cast<DWORD>(offset >> 32),
+                                                                   static_cast<DWORD>(offset), length)); // Server's page cache, read-only
+        bool written = view && FileIO::writeAt(out, offset, view, length); // One write per view
+        if (view)
+            UnmapViewOfFile(view);
+        if (!written)
+        {
+            cerr << "[Client] Copy failed at " << offset << " bytes.\n"; // Prints error message
+            return true;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count(); // Copy time
+    cout << "[Client] Copied " << fileSize << " bytes from the server's file in " << seconds * 1000 << " ms (same host, nothing sent over the socket).\n"; // Prints the result
+    return true;
+}
+
 // Handles file upload to the server
 bool uploadFile(SOCKET sock)
 {
@@ -114,16 +151,16 @@ bool uploadFile(SOCKET sock)
 
     sendAll(sock, reinterpret_cast<const char *>(&fileSize), sizeof(fileSize)); // Sends file size to server
 
-    char buffer[BUFFER_SIZE]; // Buffer for reading file data
+    vector<char> buffer(BUFFER_SIZE); // Buffer for reading file data (too large for the stack)
     uint32_t crc = 0; // Initializes CRC for integrity check
     while (file) // Continues until the entire file is read
     {
-        file.read(buffer, sizeof(buffer)); // Reads data into buffer
+        file.read(buffer.data(), buffer.size()); // Reads data into buffer
         streamsize bytesRead = file.gcount(); // Gets the number of bytes read
         if (bytesRead > 0) // Checks if data was read
         {
-            crc = crc32(buffer, bytesRead, crc); // Updates CRC with read data
-            sendAll(sock, buffer, static_cast<int>(bytesRead)); // Sends data to server
+            crc = CRC32::update(crc, buffer.data(), bytesRead); // Updates CRC with read data
+            sendAll(sock, buffer.data(), static_cast<int>(bytesRead)); // Sends data to server
         }
     }
 
@@ -141,40 +178,1233 @@ bool uploadFile(SOCKET sock)
     return true; // Returns true to indicate successful upload
 }
 
+// Uploads upload.txt as a delta against the server's copy ('Y' then 'Z'): chunks the server already
+// has are sent as references, only the rest as literal bytes
+bool deltaUpload(SOCKET sock)
+{
+    FileIO::Handle file = FileIO::openRead("upload.txt"); // Opens the file to upload
+    uint64_t fileSize = 0; // Size of the file
+    if (!file || !FileIO::sizeOf(file, fileSize)) // Checks if the file was opened successfully
+    {
+        cerr << "[Client] upload.txt not found.\n"; // Prints error message if file not found
+        return false; // Returns false to indicate failure
+    }
+
+    char cmd = 'Y'; // Asks for the signature of the server's copy
+    uint32_t count = 0; // Chunks in the signature
+    if (!sendAll(sock, &cmd, 1) || !recvExact(sock, reinterpret_cast<char *>(&count), sizeof(count)))
+        return false;
+    vector<char> signature(static_cast<size_t>(count) * 12); // {length(4) hash(8)}*count
+    if (count > 0 && !recvExact(sock, signature.data(), static_cast<int>(signature.size())))
+        return false;
+    unordered_map<uint64_t, pair<uint32_t, uint32_t>> known; // Chunk hash -> index in the signature and length
+    for (uint32_t i = 0; i < count; ++i) // Indexes the server's chunks
+    {
+        uint32_t length = 0; // Chunk length
+        uint64_t hash = 0; // Chunk hash
+        memcpy(&length, signature.data() + i * 12, 4);
+        memcpy(&hash, signature.data() + i * 12 + 4, 8);
+        known.emplace(hash, make_pair(i, length)); // Keeps the first of duplicate chunks
+    }
+
+    struct Piece
+    {
+        uint64_t offset; // Position in upload.txt
+        uint32_t length; // Bytes
+        int64_t index; // Server chunk to copy, or -1 for literal bytes
+    };
+    vector<Piece> pieces; // The file as copies and literal runs
+    uint32_t crc = 0; // Whole-file CRC, checked by the server before it publishes
+    uint64_t literalBytes = 0; // Bytes that have to be sent
+    bool scanned = DeltaSync::scan(file, fileSize, [&](const DeltaSync::Chunk &c, const char *data) {
+        crc = CRC32::update(crc, data, c.length); // Chunks arrive in file order
+        auto it = known.find(c.hash); // Does the server have this chunk?
+        if (it != known.end() && it->second.second == c.length) // Same hash and length
+        {
+            pieces.push_back({c.offset, c.length, it->second.first});
+            return;
+        }
+        literalBytes += c.length; // Has to be sent
+        if (!pieces.empty() && pieces.back().index < 0 && pieces.back().length + c.length <= DeltaSync::MAX_LITERAL) // Extends the literal run
+            pieces.back().length += c.length;
+        else
+            pieces.push_back({c.offset, c.length, -1});
+    });
+    if (!scanned) // upload.txt changed while reading it
+    {
+        cerr << "[Client] Cannot read upload.txt.\n"; // Prints error message
+        return false;
+    }
+
+    cmd = 'Z'; // Sends the delta
+    char header[12]; // size(8) crc(4)
+    memcpy(header, &fileSize, 8);
+    memcpy(header + 8, &crc, 4);
+    if (!sendAll(sock, &cmd, 1) || !sendAll(sock, header, sizeof(header)))
+        return false;
+    vector<char> buffer; // Literal bytes
+    for (const Piece &p : pieces) // One op per piece
+    {
+        char op[5]; // op(1) value(4)
+        uint32_t value = p.index >= 0 ? static_cast<uint32_t>(p.index) : p.length; // Chunk index or literal length
+        op[0] = p.index >= 0 ? 'C' : 'L';
+        memcpy(op + 1, &value, 4);
+        if (!sendAll(sock, op, sizeof(op)))
+            return false;
+        if (p.index >= 0) // Copy: nothing else to send
+            continue;
+        buffer.resize(p.length);
+        if (FileIO::readAt(file, p.offset, buffer.data(), p.length) != p.length || !sendAll(sock, buffer.data(), static_cast<int>(p.length))) // Sends the literal bytes
+            return false;
+    }
+    cmd = 'E'; // End of the file
+    char status = 0; // Stored and verified
+    uint32_t serverCRC = 0; // CRC of what the server rebuilt
+    if (!sendAll(sock, &cmd, 1) || !recvExact(sock, &status, 1) || !recvExact(sock, reinterpret_cast<char *>(&serverCRC), sizeof(serverCRC)))
+        return false;
+
+    cout << "[Client] Delta upload: " << literalBytes << " of " << fileSize << " bytes sent, " << (fileSize - literalBytes) << " reused.\n"; // Prints savings
+    cout << "[Client] Upload CRC: computed=" << crc << ", server=" << serverCRC << "\n"; // Prints computed and server CRCs
+    if (status == 1 && crc == serverCRC) // Checks if CRCs match
+        cout << "[Client] Integrity verified.\n"; // Prints success message
+    else
+        cout << "[Client] Integrity mismatch!\n"; // Prints failure message
+    return true;
+}
+
+// Prints the server's metrics ('S'): length(4) followed by a JSON report
+bool printStats(SOCKET sock)
+{
+    char cmd = 'S'; // Asks for the report
+    if (!sendAll(sock, &cmd, 1)) // Sends the command
+        return false;
+    uint32_t length = 0; // Bytes in the report
+    if (!recvExact(sock, reinterpret_cast<char *>(&length), sizeof(length)) || length > 1024 * 1024) // Receives the length
+        return false;
+    string report(length, '\0'); // JSON text
+    if (length > 0 && !recvExact(sock, &report[0], static_cast<int>(length))) // Receives the report
+        return false;
+    cout << "[Client] Server stats: " << report << "\n"; // Prints the report
+    return true;
+}
+
+// Selects the server file later commands on this connection work on ('O'); status is 0 for an invalid
+// name, 1 if the file exists and 2 if an upload will create it. Returns false if the connection failed.
+bool selectRemote(SOCKET sock, const string &name, char &status)
+{
+    char cmd = 'O'; // Open command
+    uint16_t nameLen = static_cast<uint16_t>(name.size()); // Length of the name
+    return sendAll(sock, &cmd, 1) && sendAll(sock, reinterpret_cast<const char *>(&nameLen), sizeof(nameLen)) &&
+           sendAll(sock, name.data(), nameLen) && recvExact(sock, &status, 1); // Sends the name and reads the verdict
+}
+
+// Prints the server files whose names start with prefix ('L'), one page at a time
+bool listRemote(SOCKET sock, const string &prefix)
+{
+    string after; // Last name received (the server continues after it)
+    uint64_t files = 0; // Entries printed
+    while (true) // One request per page
+    {
+        char cmd = 'L'; // List command
+        uint16_t prefixLen = static_cast<uint16_t>(prefix.size()); // Length of the filter
+        uint16_t afterLen = static_cast<uint16_t>(after.size()); // Length of the cursor
+        uint32_t max = LIST_PAGE; // Page size
+        if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(&prefixLen), sizeof(prefixLen)) ||
+            !sendAll(sock, prefix.data(), prefixLen) || !sendAll(sock, reinterpret_cast<const char *>(&afterLen), sizeof(afterLen)) ||
+            !sendAll(sock, after.data(), afterLen) || !sendAll(sock, reinterpret_cast<const char *>(&max), sizeof(max))) // Sends the request
+            return false;
+        uint32_t count = 0; // Entries in this page
+        char more = 0; // True if another page follows
+        if (!recvExact(sock, reinterpret_cast<char *>(&count), sizeof(count)) || !recvExact(sock, &more, 1)) // Receives the page header
+            return false;
+        for (uint32_t i = 0; i < count; ++i) // One record per file
+        {
+            uint16_t nameLen = 0; // Length of the name
+            char fields[21]; // size(8) mtime(8) crc(4) crcKnown(1)
+            if (!recvExact(sock, reinterpret_cast<char *>(&nameLen), sizeof(nameLen))) // Receives the name length
+                return false;
+            after.assign(nameLen, '\0');
+            if ((nameLen > 0 && !recvExact(sock, &after[0], nameLen)) || !recvExact(sock, fields, sizeof(fields))) // Receives the record
+                return false;
+            uint64_t size = 0; // File size
+            uint32_t crc = 0; // File CRC, if known
+            memcpy(&size, fields, sizeof(size));
+            memcpy(&crc, fields + 16, sizeof(crc));
+            cout << "  " << after << "  " << size << " bytes"; // Prints name and size
+            if (fields[20]) // The server has hashed this version
+                cout << "  CRC " << crc;
+            cout << "\n";
+        }
+        files += count;
+        if (!more) // Last page
+            break;
+    }
+    cout << "[Client] " << files << " files.\n"; // Prints the total
+    return true;
+}
+
+// Connects to the server and receives the session UUID it assigns; returns INVALID_SOCKET on failure
+SOCKET connectToServer(string &clientUUID)
+{
+    SOCKET sock = INVALID_SOCKET; // Connected socket
+    if (preferLocal && LocalTransport::isLocalHost(SERVER_IP)) // Same machine: skips the TCP stack if the server listens locally
+        sock = LocalTransport::connectTo(localPath.empty() ? LocalTransport::defaultPath(PORT) : localPath);
+    localConnection = sock != INVALID_SOCKET;
+    if (!localConnection) // Remote server, or no local socket
+    {
+        sock = socket(AF_INET, SOCK_STREAM, 0); // Creates a TCP socket
+        sockaddr_in serverAddr{}; // Structure to hold server address information
+        serverAddr.sin_family = AF_INET; // Sets address family to IPv4
+        serverAddr.sin_port = htons(PORT); // Sets port number (converts to network byte order)
+        inet_pton(AF_INET, SERVER_IP, &serverAddr.sin_addr); // Converts IP string to binary
+
+        if (connect(sock, (sockaddr *)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) // Connects to the server
+        {
+            closesocket(sock); // Releases the unconnected socket
+            return INVALID_SOCKET; // Reports the failure
+        }
+    }
+
+    uint32_t uuidLen = 0; // Stores the length of the UUID
+    if (!recvExact(sock, reinterpret_cast<char *>(&uuidLen), sizeof(uuidLen)) || uuidLen > 64) // Receives UUID length
+    {
+        closesocket(sock); // Closes the socket
+        return INVALID_SOCKET; // Reports the failure
+    }
+    clientUUID.assign(uuidLen, 0); // Creates a string to hold the UUID
+    if (!recvExact(sock, &clientUUID[0], uuidLen)) // Receives the UUID
+    {
+        closesocket(sock); // Closes the socket
+        return INVALID_SOCKET; // Reports the failure
+    }
+    char status = 0; // Verdict on the selected file
+    if (!remoteName.empty() && !selectRemote(sock, remoteName, status)) // New connections work on the same file
+    {
+        closesocket(sock); // Closes the socket
+        return INVALID_SOCKET; // Reports the failure
+    }
+    return sock; // Returns the connected socket
+}
+
+// Asks the server to continue an earlier session ('I'), or with join to add this connection to a live
+// one as an extra stream ('J'); returns false if the connection failed
+bool resumeSession(SOCKET sock, const string &uuid, bool &accepted, bool join = false)
+{
+    char cmd = join ? 'J' : 'I'; // Resume or join command
+    uint32_t uuidLen = static_cast<uint32_t>(uuid.size()); // Length of the UUID
+    char status = 0; // Server answer
+    if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(&uuidLen), sizeof(uuidLen)) ||
+        !sendAll(sock, uuid.data(), static_cast<int>(uuidLen)) || !recvExact(sock, &status, 1)) // Sends the UUID and reads the verdict
+        return false;
+    accepted = status == 1; // True if the server now treats this connection as that session
+    return true;
+}
+
+// Fetches the hash tree of the selected file ('M'); returns false if the connection failed or the tree is inconsistent
+bool fetchTree(SOCKET sock, Merkle::Tree &tree, bool &available)
+{
+    char cmd = 'M'; // Hash tree command
+    char status = 0; // 1 if the server could hash the file
+    if (!sendAll(sock, &cmd, 1) || !recvExact(sock, &status, 1)) // Asks for the tree
+        return false;
+    available = status == 1;
+    if (!available) // Missing, unreadable or too large
+        return true;
+    uint32_t count = 0; // Leaves that follow
+    if (!recvExact(sock, reinterpret_cast<char *>(&tree.size), sizeof(tree.size)) ||
+        !recvExact(sock, reinterpret_cast<char *>(&tree.chunkSize), sizeof(tree.chunkSize)) ||
+        !recvExact(sock, reinterpret_cast<char *>(&count), sizeof(count)) ||
+        !recvExact(sock, reinterpret_cast<char *>(&tree.root), sizeof(tree.root))) // Receives the header
+        return false;
+    if (tree.chunkSize == 0 || tree.chunkSize > RANGE_SIZE || count > Merkle::MAX_LEAVES || count != Merkle::chunkCount(tree.size, tree.chunkSize)) // Not a tree we can use
+        return false;
+    tree.leaves.resize(count);
+    if (count > 0 && !recvExact(sock, reinterpret_cast<char *>(tree.leaves.data()), static_cast<int>(count * 8))) // Receives the leaves
+        return false;
+    return Merkle::rootOf(tree.leaves) == tree.root; // Leaves damaged in transit fail here
+}
+
+// Downloads the selected file into received.txt.part one chunk of its hash tree at a time. Each chunk
+// is checked against its leaf as it arrives, so a damaged chunk is fetched again on its own, and the
+// chunks an interrupted run left behind are checked in parallel instead of being fetched again.
+// Returns false only if the connection failed; the caller reconnects and calls again.
+bool rangedDownload(SOCKET sock)
+{
+    FileIO::Handle part = FileIO::openReadWrite("received.txt.part", false); // Keeps earlier progress
+    if (!part) // Cannot write locally
+    {
+        cerr << "[Client] Cannot open received.txt.part.\n"; // Prints error message
+        return true; // Reconnecting would not help
+    }
+
+    int restarts = 0; // Times the file changed on the server during this download
+    while (true) // Starts over with a fresh tree when the file changes
+    {
+        Merkle::Tree tree; // Tree of the server's file
+        bool available = false; // True if the server sent a tree
+        if (!fetchTree(sock, tree, available)) // Connection failed or the tree arrived damaged
+            return false;
+        if (!available) // File missing on the server
+        {
+            cerr << "[Client] File not available.\n"; // Prints error message
+            return true;
+        }
+
+        uint64_t have = 0; // Bytes already in the partial file
+        FileIO::sizeOf(part, have);
+        if (have > tree.size) // Left over from a larger version
+            FileIO::resize(part, have = tree.size);
+        uint64_t kept = have == tree.size ? have : have / tree.chunkSize * tree.chunkSize; // Whole chunks (or the whole file) to check
+        Merkle::Tree local; // Tree of those chunks
+        if (kept > 0 && !Merkle::build(part, kept, max(1u, thread::hardware_concurrency()), local, tree.chunkSize)) // Checks them on every core
+            local.leaves.clear();
+        vector<size_t> missing; // Chunks still to fetch
+        vector<uint32_t> chunkCRCs(tree.leaves.size()); // CRC of each verified chunk
+        for (size_t i = 0; i < tree.leaves.size(); ++i) // Compares each chunk with the server's leaf
+        {
+            if (i < local.leaves.size() && local.leaves[i] == tree.leaves[i]) // Already here and intact
+                chunkCRCs[i] = local.crcs[i];
+            else
+                missing.push_back(i);
+        }
+        if (kept > 0) // Resuming
+            cout << "[Client] Resuming download: " << tree.leaves.size() - missing.size() << " of " << tree.leaves.size()
+                 << " chunks already verified.\n"; // Prints resume message
+
+        vector<char> buffer(RANGE_SIZE); // One chunk
+        uint32_t fileCRC = 0; // Whole-file CRC announced with the first range
+        bool known = false; // True once total and fileCRC were received on this connection
+        bool changed = false; // True if the file no longer matches the tree
+        int badRanges = 0; // Consecutive failures of the current chunk
+        for (size_t n = 0; n < missing.size() && !changed;) // Fetches the missing chunks in file order
+        {
+            size_t index = missing[n]; // Chunk to fetch
+            uint64_t offset = static_cast<uint64_t>(index) * tree.chunkSize; // Its position
+            uint32_t length = Merkle::chunkLength(tree, index); // Its length
+            char cmd = 'G'; // Ranged download command
+            uint64_t request[2] = {offset, length}; // Offset and length
+            if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(request), sizeof(request))) // Sends the request
+                return false;
+
+            uint64_t rangeTotal = 0, rangeLength = 0; // Header fields
+            uint32_t rangeFileCRC = 0; // Header whole-file CRC
+            if (!recvExact(sock, reinterpret_cast<char *>(&rangeTotal), sizeof(rangeTotal)) ||
+                !recvExact(sock, reinterpret_cast<char *>(&rangeFileCRC), sizeof(rangeFileCRC)) ||
+                !recvExact(sock, reinterpret_cast<char *>(&rangeLength), sizeof(rangeLength))) // Receives the header
+                return false;
+            if (rangeLength > buffer.size()) // More than was asked for: the stream cannot be trusted
+                return false;
+            uint32_t receivedCRC = 0; // CRC of the range computed by the server
+            if ((rangeLength > 0 && !recvExact(sock, buffer.data(), static_cast<int>(rangeLength))) ||
+                !recvExact(sock, reinterpret_cast<char *>(&receivedCRC), sizeof(receivedCRC))) // Receives the data and the trailer
+                return false;
+
+            if (rangeTotal == 0) // File removed on the server
+            {
+                cerr << "[Client] File not available.\n"; // Prints error message
+                return true;
+            }
+            if (rangeTotal != tree.size || (known && rangeFileCRC != fileCRC)) // File changed since the tree was sent
+            {
+                changed = true;
+                break;
+            }
+            known = true; // Remembers the file version
+            fileCRC = rangeFileCRC;
+
+            uint32_t rangeCRC = CRC32::update(0, buffer.data(), static_cast<size_t>(rangeLength)); // CRC of what arrived
+            if (rangeCRC != receivedCRC || rangeLength != length) // Damaged in transit
+            {
+                if (++badRanges > MAX_RETRIES) // Keeps failing
+                {
+                    cerr << "[Client] Chunk at " << offset << " keeps failing its CRC.\n"; // Prints error message
+                    return true;
+                }
+                cout << "[Client] Chunk at " << offset << " corrupted, requesting it again.\n"; // Prints retry message
+                continue; // Requests the same chunk again
+            }
+            if (Merkle::leafHash(buffer.data(), length) != tree.leaves[index]) // Intact, but not the data the tree describes
+            {
+                changed = true;
+                break;
+            }
+            if (!FileIO::writeAt(part, offset, buffer.data(), length)) // Stores the verified chunk
+            {
+                cerr << "[Client] Cannot write received.txt.part.\n"; // Prints error message
+                return true;
+            }
+            chunkCRCs[index] = rangeCRC;
+            badRanges = 0; // Chunk verified
+            ++n; // Next missing chunk
+            cout << "[Client] " << (tree.leaves.size() - missing.size() + n) << " / " << tree.leaves.size() << " chunks verified.\n"; // Prints progress
+        }
+        if (changed) // Fetches the new tree; chunks that did not change are kept
+        {
+            if (++restarts > MAX_RETRIES) // Keeps changing
+            {
+                cerr << "[Client] File keeps changing on the server.\n"; // Prints error message
+                return true;
+            }
+            cout << "[Client] File changed on the server, checking what is still valid.\n"; // Prints restart message
+            continue;
+        }
+
+        Merkle::Tree received = tree; // Tree the published file matches
+        received.crcs = chunkCRCs;
+        uint32_t crc = Merkle::fileCrc(received); // Whole-file CRC, combined from the chunks
+        FileIO::resize(part, tree.size); // Drops any tail beyond the file
+        part.reset(); // Closes the partial file before renaming it
+        FileIO::replace("received.txt.part", "received.txt"); // Publishes the complete file
+        if (known) // At least one chunk came from the server on this connection
+            cout << "[Client] CRC: computed=" << crc << ", received=" << fileCRC << "\n"; // Prints computed and received CRCs
+        cout << "[Client] Hash tree root " << hex << tree.root << dec << " matched by all " << tree.leaves.size() << " chunks.\n"; // Prints the root
+        if (!known || crc == fileCRC) // The chunk hashes already proved every byte; the CRC is a second check
+            cout << "[Client] Integrity verified.\n"; // Prints success message
+        else
+            cout << "[Client] Integrity mismatch!\n"; // Prints failure message
+        return true;
+    }
+}
+
+// Uploads upload.txt in verified ranges under a session UUID saved in upload.session, so a later
+// connection (or a later run of the client) continues where the server's journal left off.
+// Returns false only if the connection failed; the caller reconnects and calls again.
+bool rangedUpload(SOCKET sock, const string &clientUUID)
+{
+    FileIO::Handle file = FileIO::openRead("upload.txt"); // Opens the file to upload
+    uint64_t fileSize = 0; // Size of the file
+    if (!file || !FileIO::sizeOf(file, fileSize)) // Checks if the file was opened successfully
+    {
+        cerr << "[Client] upload.txt not found.\n"; // Prints error message if file not found
+        return true; // Reconnecting would not help
+    }
+
+    string sessionUUID; // UUID the server keeps the upload under
+    {
+        ifstream session("upload.session"); // UUID of an interrupted upload, if any
+        session >> sessionUUID; // Stays empty if there is none
+    }
+    bool accepted = false; // True if the old session was taken over
+    if (!sessionUUID.empty() && !resumeSession(sock, sessionUUID, accepted)) // Offers the old UUID
+        return false;
+    if (accepted) // Server will look up the old journal
+        cout << "[Client] Continuing upload session " << sessionUUID << ".\n"; // Prints resume message
+    else // Starts a new session under this connection's UUID
+    {
+        sessionUUID = clientUUID;
+        ofstream("upload.session") << sessionUUID; // Remembers it for later connections
+    }
+
+    vector<char> buffer(RANGE_BUFFER_SIZE); // Buffer for reading file data
+    Merkle::Tree local; // Chunk CRCs of the local file, hashed on every core
+    Merkle::build(file, fileSize, max(1u, thread::hardware_concurrency()), local); // A shrinking file fails the server's check anyway
+    uint32_t crc = Merkle::fileCrc(local); // CRC of the whole local file, compared with the server's at the end
+
+    char cmd = 'P'; // Begin ranged upload command
+    uint64_t offset = 0; // Verified prefix on the server
+    if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(&fileSize), sizeof(fileSize)) ||
+        !recvExact(sock, reinterpret_cast<char *>(&offset), sizeof(offset))) // Announces the size, learns where to continue
+        return false;
+    if (offset > 0) // Resuming
+        cout << "[Client] Server already has " << offset << " bytes.\n"; // Prints resume message
+
+    int badRanges = 0; // Consecutive ranges the server rejected
+    while (offset < fileSize) // Sends ranges until the server has verified everything
+    {
+        uint32_t length = static_cast<uint32_t>(min<uint64_t>(RANGE_SIZE, fileSize - offset)); // Range length
+        cmd = 'W'; // Write range command
+        if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(&offset), sizeof(offset)) ||
+            !sendAll(sock, reinterpret_cast<const char *>(&length), sizeof(length))) // Sends the range header
+            return false;
+        uint32_t rangeCRC = 0; // CRC of this range
+        for (uint32_t sent = 0; sent < length;) // Streams the range
+        {
+            size_t got = FileIO::readAt(file, offset + sent, buffer.data(), min<size_t>(buffer.size(), length - sent)); // Reads a chunk
+            if (got == 0) // File shrank underneath us; pads so the stream stays in sync (the CRC check fails)
+            {
+                got = min<size_t>(buffer.size(), length - sent);
+                fill(buffer.begin(), buffer.begin() + got, 0);
+            }
+            rangeCRC = CRC32::update(rangeCRC, buffer.data(), got); // Updates CRC with read data
+            if (!sendAll(sock, buffer.data(), static_cast<int>(got))) // Sends data to server
+                return false;
+            sent += static_cast<uint32_t>(got);
+        }
+        char status = 0; // Server verdict for the range
+        uint64_t verified = 0; // Server's verified prefix
+        if (!sendAll(sock, reinterpret_cast<const char *>(&rangeCRC), sizeof(rangeCRC)) || !recvExact(sock, &status, 1) ||
+            !recvExact(sock, reinterpret_cast<char *>(&verified), sizeof(verified))) // Sends the CRC, reads the verdict
+            return false;
+        if (!status && ++badRanges > MAX_RETRIES) // Keeps failing
+        {
+            cerr << "[Client] Range at " << offset << " keeps being rejected.\n"; // Prints error message
+            return true;
+        }
+        if (status) // Range accepted
+            badRanges = 0;
+        offset = verified; // Continues from what the server has verified
+    }
+
+    cmd = 'F'; // Finalize command
+    char status = 0; // Server verdict
+    uint32_t serverCRC = 0; // CRC the server computed from the verified ranges
+    if (!sendAll(sock, &cmd, 1) || !recvExact(sock, &status, 1) || !recvExact(sock, reinterpret_cast<char *>(&serverCRC), sizeof(serverCRC))) // Publishes the upload
+        return false;
+    if (!status) // Server refused to publish
+    {
+        cerr << "[Client] Server could not finish the upload.\n"; // Prints error message
+        return true;
+    }
+    cout << "[Client] Upload CRC: computed=" << crc << ", server=" << serverCRC << "\n"; // Prints computed and server CRCs
+    if (crc == serverCRC) // Checks if CRCs match
+        cout << "[Client] Integrity verified.\n"; // Prints success message
+    else
+        cout << "[Client] Integrity mismatch!\n"; // Prints failure message
+    DeleteFileA("upload.session"); // The session is finished either way
+    return true;
+}
+
+// Runs a ranged transfer, reconnecting (and resuming) after connection failures
+void withRetries(SOCKET &sock, string &clientUUID, bool upload)
+{
+    for (int attempt = 0; attempt <= MAX_RETRIES; ++attempt) // Bounded number of reconnects
+    {
+        if (sock == INVALID_SOCKET) // Lost the connection earlier
+        {
+            Sleep(1000); // Gives the network (or the server) a moment
+            sock = connectToServer(clientUUID); // Reconnects
+            if (sock == INVALID_SOCKET) // Still unreachable
+                continue;
+            cout << "[Client] Reconnected. UUID: " << clientUUID << "\n"; // Prints the new UUID
+        }
+        if (upload ? rangedUpload(sock, clientUUID) : rangedDownload(sock)) // Finished (successfully or not)
+            return;
+        cerr << "[Client] Connection lost, resuming.\n"; // Prints retry message
+        closesocket(sock); // Drops the broken connection
+        sock = INVALID_SOCKET;
+    }
+    cerr << "[Client] Giving up after " << MAX_RETRIES << " reconnects.\n"; // Prints failure message
+}
+
+// Shared state of one striped transfer. Chunks are handed out in order from a shared counter, so a
+// slow stream simply takes fewer chunks instead of holding up a fixed share of the file.
+struct StripeJob
+{
+    bool upload = false; // Direction of the transfer
+    uint64_t fileSize = 0; // Size of the file being moved
+    uint32_t fileCRC = 0; // Whole-file CRC announced by the server (downloads)
+    string sessionUUID; // Session the upload ranges belong to (uploads)
+    FileIO::Handle file; // Local file, read or written at chunk offsets
+    vector<uint32_t> chunkCRCs; // Verified CRC of each chunk, combined at the end
+    atomic<size_t> nextChunk{0}; // Next chunk to hand out
+    atomic<uint64_t> bytesDone{0}; // Verified bytes so far (drives the auto-tuner)
+    atomic<bool> failed{false}; // Set when a stream gives up
+
+    size_t chunkCount() const { return static_cast<size_t>((fileSize + STRIPE_CHUNK - 1) / STRIPE_CHUNK); } // Number of chunks
+};
+
+// Sends the 'G' probe that returns only the size and CRC of the served file; returns false if the connection failed
+bool probeFile(SOCKET sock, uint64_t &total, uint32_t &fileCRC)
+{
+    char cmd = 'G'; // Ranged download command
+    uint64_t request[2] = {~0ull, 0}; // Offset past any end: the server answers with an empty range
+    uint64_t rangeLength = 0; // Always 0
+    uint32_t rangeCRC = 0; // Always 0
+    return sendAll(sock, &cmd, 1) && sendAll(sock, reinterpret_cast<const char *>(request), sizeof(request)) &&
+           recvExact(sock, reinterpret_cast<char *>(&total), sizeof(total)) &&
+           recvExact(sock, reinterpret_cast<char *>(&fileCRC), sizeof(fileCRC)) &&
+           recvExact(sock, reinterpret_cast<char *>(&rangeLength), sizeof(rangeLength)) &&
+           recvExact(sock, reinterpret_cast<char *>(&rangeCRC), sizeof(rangeCRC)); // Receives the header and empty trailer
+}
+
+// Downloads one chunk with 'G' and writes it at its offset; returns false if the connection failed
+bool fetchChunk(SOCKET sock, StripeJob &job, size_t chunk, vector<char> &buffer)
+{
+    uint64_t offset = chunk * STRIPE_CHUNK; // First byte of the chunk
+    uint64_t length = min<uint64_t>(STRIPE_CHUNK, job.fileSize - offset); // Chunk length
+    for (int attempt = 0; attempt <= MAX_RETRIES; ++attempt) // Re-requests damaged chunks
+    {
+        char cmd = 'G'; // Ranged download command
+        uint64_t request[2] = {offset, length}; // The chunk
+        uint64_t total = 0, rangeLength = 0; // Header fields
+        uint32_t fileCRC = 0; // Header whole-file CRC
+        if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(request), sizeof(request)) ||
+            !recvExact(sock, reinterpret_cast<char *>(&total), sizeof(total)) ||
+            !recvExact(sock, reinterpret_cast<char *>(&fileCRC), sizeof(fileCRC)) ||
+            !recvExact(sock, reinterpret_cast<char *>(&rangeLength), sizeof(rangeLength))) // Requests the chunk, receives the header
+            return false;
+
+        uint32_t crc = 0; // CRC computed over the received chunk
+        for (uint64_t got = 0; got < rangeLength;) // Receives the chunk straight into the file
+        {
+            int r = recv(sock, buffer.data(), static_cast<int>(min<uint64_t>(buffer.size(), rangeLength - got)), 0); // Receives data into buffer
+            if (r <= 0) // Checks for errors or disconnection
+                return false;
+            FileIO::writeAt(job.file, offset + got, buffer.data(), static_cast<size_t>(r)); // Writes at its position
+            crc = CRC32::update(crc, buffer.data(), r); // Updates CRC with received data
+            got += static_cast<uint64_t>(r);
+        }
+        uint32_t receivedCRC = 0; // CRC of the chunk computed by the server
+        if (!recvExact(sock, reinterpret_cast<char *>(&receivedCRC), sizeof(receivedCRC))) // Receives the trailer
+            return false;
+
+        if (total != job.fileSize || fileCRC != job.fileCRC || rangeLength != length) // File changed on the server
+        {
+            cerr << "[Client] File changed on the server during the transfer.\n"; // Prints error message
+            job.failed = true; // Stops all streams
+            return true;
+        }
+        if (crc == receivedCRC) // Chunk intact
+        {
+            job.chunkCRCs[chunk] = crc; // Keeps it for the whole-file check
+            job.bytesDone += length; // Reports progress to the tuner
+            return true;
+        }
+        cout << "[Client] Chunk at " << offset << " corrupted, requesting it again.\n"; // Prints retry message
+    }
+    cerr << "[Client] Chunk at " << offset << " keeps failing its CRC.\n"; // Prints error message
+    job.failed = true; // Stops all streams
+    return true;
+}
+
+// Uploads one chunk with 'W'; returns false if the connection failed
+bool sendChunk(SOCKET sock, StripeJob &job, size_t chunk, vector<char> &buffer)
+{
+    uint64_t offset = chunk * STRIPE_CHUNK; // First byte of the chunk
+    uint32_t length = static_cast<uint32_t>(min<uint64_t>(STRIPE_CHUNK, job.fileSize - offset)); // Chunk length
+    for (int attempt = 0; attempt <= MAX_RETRIES; ++attempt) // Resends rejected chunks
+    {
+        char cmd = 'W'; // Write range command
+        if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(&offset), sizeof(offset)) ||
+            !sendAll(sock, reinterpret_cast<const char *>(&length), sizeof(length))) // Sends the range header
+            return false;
+        uint32_t crc = 0; // CRC of the chunk
+        for (uint32_t sent = 0; sent < length;) // Streams the chunk
+        {
+            size_t got = FileIO::readAt(job.file, offset + sent, buffer.data(), min<size_t>(buffer.size(), length - sent)); // Reads at its position
+            if (got == 0) // File shrank underneath us; pads so the stream stays in sync (the CRC check fails)
+            {
+                got = min<size_t>(buffer.size(), length - sent);
+                fill(buffer.begin(), buffer.begin() + got, 0);
+            }
+            crc = CRC32::update(crc, buffer.data(), got); // Updates CRC with read data
+            if (!sendAll(sock, buffer.data(), static_cast<int>(got))) // Sends data to server
+                return false;
+            sent += static_cast<uint32_t>(got);
+        }
+        char status = 0; // Server verdict
+        uint64_t verified = 0; // Server's verified prefix (unused: chunks complete out of order)
+        if (!sendAll(sock, reinterpret_cast<const char *>(&crc), sizeof(crc)) || !recvExact(sock, &status, 1) ||
+            !recvExact(sock, reinterpret_cast<char *>(&verified), sizeof(verified))) // Sends the CRC, reads the verdict
+            return false;
+        if (status) // Chunk journaled by the server
+        {
+            job.chunkCRCs[chunk] = crc; // Keeps it for the whole-file check
+            job.bytesDone += length; // Reports progress to the tuner
+            return true;
+        }
+        cout << "[Client] Chunk at " << offset << " rejected, sending it again.\n"; // Prints retry message
+    }
+    cerr << "[Client] Chunk at " << offset << " keeps being rejected.\n"; // Prints error message
+    job.failed = true; // Stops all streams
+    return true;
+}
+
+// Opens one stream of a striped transfer; uploads also join the session's partial upload
+SOCKET openStripe(StripeJob &job)
+{
+    string uuid; // UUID the server assigns to this connection
+    SOCKET sock = connectToServer(uuid); // Connects
+    if (sock == INVALID_SOCKET) // Server unreachable
+        return sock;
+    int window = STRIPE_SOCKET_BUFFER; // Large socket buffers so each stream can cover the bandwidth-delay product
+    setsockopt(sock, SOL_SOCKET, job.upload ? SO_SNDBUF : SO_RCVBUF, reinterpret_cast<const char *>(&window), sizeof(window));
+    if (!job.upload) // Downloads need no session
+        return sock;
+
+    bool accepted = false; // True once the connection speaks for the upload session
+    char cmd = 'P'; // Joins the upload (same size: keeps the server's progress)
+    uint64_t verified = 0; // Unused
+    if (!resumeSession(sock, job.sessionUUID, accepted, true) || !accepted || !sendAll(sock, &cmd, 1) ||
+        !sendAll(sock, reinterpret_cast<const char *>(&job.fileSize), sizeof(job.fileSize)) ||
+        !recvExact(sock, reinterpret_cast<char *>(&verified), sizeof(verified))) // Takes over the session UUID
+    {
+        closesocket(sock); // Drops the half-set-up stream
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// Body of one stream: takes chunks until none are left, reconnecting after connection failures
+void stripeWorker(StripeJob &job)
+{
+    vector<char> buffer(RANGE_BUFFER_SIZE); // Per-stream transfer buffer
+    SOCKET sock = INVALID_SOCKET; // This stream's connection
+    int failures = 0; // Consecutive connection failures
+    size_t chunk = job.nextChunk++; // First chunk
+    while (chunk < job.chunkCount() && !job.failed) // Until the work runs out
+    {
+        if (sock == INVALID_SOCKET) // Not connected (first pass or after a failure)
+            sock = openStripe(job);
+        if (sock != INVALID_SOCKET && (job.upload ? sendChunk(sock, job, chunk, buffer) : fetchChunk(sock, job, chunk, buffer))) // Moves the chunk
+        {
+            failures = 0; // Healthy stream
+            chunk = job.nextChunk++; // Takes the next chunk
+            continue;
+        }
+        if (sock != INVALID_SOCKET) // Connection broke mid-chunk
+            closesocket(sock);
+        sock = INVALID_SOCKET; // Reconnects and retries the same chunk
+        if (++failures > MAX_RETRIES) // Keeps failing
+        {
+            cerr << "[Client] Stream gave up after " << MAX_RETRIES << " reconnects.\n"; // Prints error message
+            job.failed = true; // Stops all streams
+            return;
+        }
+        Sleep(1000); // Gives the network (or the server) a moment
+    }
+    if (sock != INVALID_SOCKET) // Ends the stream politely
+    {
+        char quit = 'Q'; // Quit command
+        sendAll(sock, &quit, 1);
+        closesocket(sock);
+    }
+}
+
+// Runs the streams of a job. With streams == 0 the count is tuned while the transfer runs: a stream is
+// added every sampling interval for as long as the last addition raised total throughput noticeably.
+int runStripes(StripeJob &job, int streams)
+{
+    vector<thread> workers; // One thread per stream
+    int start = streams > 0 ? min(streams, MAX_STREAMS) : 1; // Auto-tuning starts from a single stream
+    for (int i = 0; i < start; ++i) // Starts the initial streams
+        workers.emplace_back(stripeWorker, ref(job));
+
+    if (streams == 0) // Auto-tune
+    {
+        double best = 0; // Best aggregate throughput seen so far (bytes per second)
+        uint64_t lastBytes = 0; // Progress at the previous sample
+        auto lastTime = chrono::steady_clock::now(); // Time of the previous sample
+        while (!job.failed && job.nextChunk < job.chunkCount() && static_cast<int>(workers.size()) < MAX_STREAMS) // Work left to spread
+        {
+            this_thread::sleep_for(chrono::milliseconds(TUNE_INTERVAL_MS)); // Lets the current streams settle
+            auto now = chrono::steady_clock::now(); // Sample time
+            uint64_t bytes = job.bytesDone; // Sample progress
+            double rate = (bytes - lastBytes) / chrono::duration<double>(now - lastTime).count(); // Throughput over the interval
+            lastBytes = bytes;
+            lastTime = now;
+            if (rate == 0) // No chunk finished yet: nothing to judge
+                continue;
+            if (rate < best * TUNE_GAIN) // The last stream did not help: stop adding
+                break;
+            best = rate; // Remembers the improvement
+            workers.emplace_back(stripeWorker, ref(job)); // Tries one more stream
+        }
+        cout << "[Client] Auto-tuned to " << workers.size() << " streams.\n"; // Prints the chosen stream count
+    }
+
+    for (auto &w : workers) // Waits for every stream
+        w.join();
+    return static_cast<int>(workers.size()); // Streams actually used
+}
+
+// Combines the per-chunk CRCs in file order into the whole-file CRC
+uint32_t combineChunks(const StripeJob &job)
+{
+    uint32_t crc = 0; // CRC of the empty prefix
+    for (size_t i = 0; i < job.chunkCRCs.size(); ++i) // Appends each chunk
+        crc = CRC32::combine(crc, job.chunkCRCs[i], min<uint64_t>(STRIPE_CHUNK, job.fileSize - i * STRIPE_CHUNK));
+    return crc;
+}
+
+// Downloads the file over several connections into received.txt.part, verifies it, then renames it
+void stripedDownload(SOCKET sock, int streams)
+{
+    StripeJob job; // Shared transfer state
+    if (!probeFile(sock, job.fileSize, job.fileCRC)) // Learns size and CRC on the control connection
+    {
+        cerr << "[Client] Connection lost.\n"; // Prints error message
+        return;
+    }
+    if (job.fileSize == 0) // Checks if the file is available
+    {
+        cerr << "[Client] File not available.\n"; // Prints error message to console
+        return;
+    }
+    job.file = FileIO::openReadWrite("received.txt.part", true); // Fresh output file
+    if (!job.file) // Cannot write locally
+    {
+        cerr << "[Client] Cannot open received.txt.part.\n"; // Prints error message
+        return;
+    }
+    job.chunkCRCs.resize(job.chunkCount()); // One CRC per chunk
+
+    cout << "[Client] Downloading " << job.fileSize << " bytes in " << job.chunkCount() << " chunks...\n"; // Prints download start message
+    auto started = chrono::steady_clock::now(); // Start time for the throughput report
+    int used = runStripes(job, streams); // Moves the chunks
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count(); // Elapsed time
+    if (job.failed) // A stream gave up
+    {
+        cerr << "[Client] Striped download failed.\n"; // Prints failure message
+        return;
+    }
+
+    uint32_t crc = combineChunks(job); // Whole-file CRC from the chunk CRCs, without rereading
+    cout << "[Client] CRC: computed=" << crc << ", received=" << job.fileCRC << "\n"; // Prints computed and received CRCs
+    cout << "[Client] " << used << " streams, " << (job.fileSize / 1048576.0) / seconds << " MiB/s.\n"; // Prints throughput
+    if (crc != job.fileCRC) // Checks if CRCs match
+    {
+        cout << "[Client] Integrity mismatch!\n"; // Prints failure message
+        return;
+    }
+    job.file.reset(); // Closes the file before renaming it
+    FileIO::replace("received.txt.part", "received.txt"); // Publishes the verified file
+    cout << "[Client] Integrity verified.\n"; // Prints success message
+}
+
+// Uploads upload.txt over several connections that all write into this connection's upload session
+void stripedUpload(SOCKET sock, const string &clientUUID, int streams)
+{
+    StripeJob job; // Shared transfer state
+    job.upload = true;
+    job.sessionUUID = clientUUID; // Streams join this connection's session
+    job.file = FileIO::openRead("upload.txt"); // Opens the file to upload
+    if (!job.file || !FileIO::sizeOf(job.file, job.fileSize)) // Checks if the file was opened successfully
+    {
+        cerr << "[Client] upload.txt not found.\n"; // Prints error message if file not found
+        return;
+    }
+    job.chunkCRCs.resize(job.chunkCount()); // One CRC per chunk
+
+    char cmd = 'P'; // Begin ranged upload command
+    uint64_t verified = 0; // Nothing yet: a fresh session UUID has no journal
+    if (!sendAll(sock, &cmd, 1) || !sendAll(sock, reinterpret_cast<const char *>(&job.fileSize), sizeof(job.fileSize)) ||
+        !recvExact(sock, reinterpret_cast<char *>(&verified), sizeof(verified))) // Opens the upload on the server
+    {
+        cerr << "[Client] Connection lost.\n"; // Prints error message
+        return;
+    }
+
+    cout << "[Client] Uploading " << job.fileSize << " bytes in " << job.chunkCount() << " chunks...\n"; // Prints upload start message
+    auto started = chrono::steady_clock::now(); // Start time for the throughput report
+    int used = runStripes(job, streams); // Moves the chunks
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count(); // Elapsed time
+    if (job.failed) // A stream gave up
+    {
+        cerr << "[Client] Striped upload failed.\n"; // Prints failure message
+        return;
+    }
+
+    cmd = 'F'; // Finalize command
+    char status = 0; // Server verdict
+    uint32_t serverCRC = 0; // CRC the server combined from the chunk CRCs
+    if (!sendAll(sock, &cmd, 1) || !recvExact(sock, &status, 1) || !recvExact(sock, reinterpret_cast<char *>(&serverCRC), sizeof(serverCRC)) || !status) // Publishes the upload
+    {
+        cerr << "[Client] Server could not finish the upload.\n"; // Prints error message
+        return;
+    }
+    uint32_t crc = combineChunks(job); // Local whole-file CRC from the chunk CRCs
+    cout << "[Client] Upload CRC: computed=" << crc << ", server=" << serverCRC << "\n"; // Prints computed and server CRCs
+    cout << "[Client] " << used << " streams, " << (job.fileSize / 1048576.0) / seconds << " MiB/s.\n"; // Prints throughput
+    if (crc == serverCRC) // Checks if CRCs match
+        cout << "[Client] Integrity verified.\n"; // Prints success message
+    else
+        cout << "[Client] Integrity mismatch!\n"; // Prints failure message
+}
+
+// Prints how many bytes a compressed stream put on the wire
+void printWire(const MuxClient::Result &r)
+{
+    if (r.wireBytes < r.bytes) // Compression saved something
+        cout << "[Client] " << r.bytes << " bytes sent as " << r.wireBytes << " (" << (100.0 * r.wireBytes / r.bytes) << "%).\n"; // Prints the ratio
+}
+
+// Downloads the whole file as one v2 stream into received.txt.part, renaming it once verified; codecs may compress it
+void v2Download(MuxClient &mux, uint8_t codecs)
+{
+    FileIO::Handle part = FileIO::openReadWrite("received.txt.part", true); // Fresh output file
+    if (!part) // Cannot write locally
+    {
+        cerr << "[Client] Cannot open received.txt.part.\n"; // Prints error message
+        return;
+    }
+    uint32_t id = mux.download(part, 0, 0, 0, codecs, remoteName); // Whole file
+    if (!mux.run()) // Drives the stream
+    {
+        cerr << "[Client] Connection lost.\n"; // Prints error message
+        return;
+    }
+    const MuxClient::Result &r = mux.result(id); // Outcome
+    if (r.error) // Server refused or aborted
+    {
+        cerr << "[Client] File not available.\n"; // Prints error message
+        return;
+    }
+    cout << "[Client] CRC: computed=" << r.crc << ", received=" << r.peerCrc << "\n"; // Prints computed and received CRCs
+    printWire(r);
+    if (!r.ok) // Checks if CRCs match
+    {
+        cout << "[Client] Integrity mismatch!\n"; // Prints failure message
+        return;
+    }
+    part.reset(); // Closes the file before renaming it
+    FileIO::replace("received.txt.part", "received.txt"); // Publishes the verified file
+    cout << "[Client] Integrity verified.\n"; // Prints success message
+}
+
+// Uploads upload.txt as one v2 stream; codecs may compress it
+void v2Upload(MuxClient &mux, uint8_t codecs)
+{
+    FileIO::Handle file = FileIO::openRead("upload.txt"); // Opens the file to upload
+    uint64_t fileSize = 0; // Size of the file
+    if (!file || !FileIO::sizeOf(file, fileSize)) // Checks if the file was opened successfully
+    {
+        cerr << "[Client] upload.txt not found.\n"; // Prints error message if file not found
+        return;
+    }
+    uint32_t id = mux.upload(file, 0, fileSize, codecs, remoteName); // Whole file
+    if (!mux.run()) // Drives the stream
+    {
+        cerr << "[Client] Connection lost.\n"; // Prints error message
+        return;
+    }
+    const MuxClient::Result &r = mux.result(id); // Outcome
+    cout << "[Client] Upload CRC: computed=" << r.crc << ", server=" << r.peerCrc << "\n"; // Prints computed and server CRCs
+    printWire(r);
+    cout << (r.ok ? "[Client] Integrity verified.\n" : "[Client] Integrity mismatch!\n"); // Prints the verdict
+}
+
+// Runs a download and an upload at the same time over the one v2 connection; codecs may compress them
+void v2Both(MuxClient &mux, uint8_t codecs)
+{
+    FileIO::Handle part = FileIO::openReadWrite("received.txt.part", true); // Download target
+    FileIO::Handle file = FileIO::openRead("upload.txt"); // Upload source
+    uint64_t fileSize = 0; // Size of the upload
+    if (!part || !file || !FileIO::sizeOf(file, fileSize)) // Checks both files
+    {
+        cerr << "[Client] Cannot open received.txt.part or upload.txt.\n"; // Prints error message
+        return;
+    }
+    uint32_t down = mux.download(part, 0, 0, 0, codecs, remoteName); // Opens both streams before running either
+    uint32_t up = mux.upload(file, 0, fileSize, codecs, remoteName);
+    if (!mux.run()) // Interleaves them
+    {
+        cerr << "[Client] Connection lost.\n"; // Prints error message
+        return;
+    }
+    const MuxClient::Result &d = mux.result(down); // Download outcome
+    const MuxClient::Result &u = mux.result(up); // Upload outcome
+    cout << "[Client] Download " << (d.ok ? "verified" : "failed") << ", upload " << (u.ok ? "verified" : "failed") << ".\n"; // Prints both verdicts
+    printWire(d);
+    printWire(u);
+    part.reset(); // Closes the file before renaming it
+    if (d.ok) // Publishes only a verified download
+        FileIO::replace("received.txt.part", "received.txt");
+}
+
+// One line of a batch manifest
+struct BatchJob
+{
+    char op = 0; // 'D' = download remote into local, 'U' = upload local as remote
+    string remote; // Name on the server ('/' separated)
+    string local; // Path on this machine
+};
+
+// Reads a manifest with one "D remote [local]" or "U local [remote]" per line (the other name defaults
+// to the same path); blank lines and lines starting with '#' are skipped. Returns false on errors.
+bool readManifest(const string &path, vector<BatchJob> &jobs)
+{
+    ifstream in(path); // Opens the manifest
+    if (!in) // Checks if the file was opened successfully
+    {
+        cerr << "[Client] Cannot open " << path << ".\n"; // Prints error message
+        return false;
+    }
+    string line; // Current line
+    size_t number = 0; // Its line number, for error messages
+    while (getline(in, line)) // One job per line
+    {
+        ++number;
+        istringstream fields(line); // Whitespace-separated fields
+        string op, first, second; // Operation and up to two paths
+        if (!(fields >> op) || op[0] == '#') // Blank line or comment
+            continue;
+        fields >> first >> second;
+        if ((op != "D" && op != "U") || first.empty()) // Malformed line
+        {
+            cerr << "[Client] " << path << ":" << number << ": expected \"D remote [local]\" or \"U local [remote]\".\n"; // Prints error message
+            return false;
+        }
+        BatchJob job; // Parsed job
+        job.op = op[0];
+        job.remote = op == "D" ? first : (second.empty() ? first : second);
+        job.local = op == "D" ? (second.empty() ? first : second) : first;
+        replace(job.remote.begin(), job.remote.end(), '\\', '/'); // Server names always use '/'
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// Runs every job of a manifest over one v2 connection. Up to depth streams are open at once and a new
+// one is opened as soon as any ends, so the requests for the next files are already at the server
+// while earlier ones are in flight and small files do not each cost a round trip. Writes one
+// tab-separated line per file to report as it finishes; returns the number of files that failed.
+size_t runBatch(MuxClient &mux, const vector<BatchJob> &jobs, uint8_t codecs, size_t depth, ostream &report)
+{
+    struct Active // A job whose stream is open
+    {
+        size_t job = 0; // Index into jobs
+        FileIO::Handle file; // Local file being written or read
+        chrono::steady_clock::time_point started; // When its OPEN was sent
+    };
+    unordered_map<uint32_t, Active> active; // Open streams by ID
+    size_t next = 0; // Next job to start
+    size_t failures = 0; // Files that did not transfer
+    uint64_t bytes = 0; // Bytes moved by successful files
+    auto start = chrono::steady_clock::now(); // Start of the batch
+
+    report << "op\tremote\tlocal\tstatus\tbytes\tms\tcrc\n"; // Column names
+    auto record = [&](size_t index, const char *status, uint64_t moved, double ms, uint32_t crc) { // Writes one result line
+        const BatchJob &job = jobs[index]; // The file
+        if (strcmp(status, "ok") == 0)
+            bytes += moved;
+        else
+            ++failures;
+        report << job.op << '\t' << job.remote << '\t' << job.local << '\t' << status << '\t' << moved << '\t' << ms << '\t' << crc << '\n';
+    };
+
+    function<void()> refill = [&]() { // Opens streams until depth are in flight
+        while (active.size() < depth && next < jobs.size())
+        {
+            size_t index = next++; // Job to start
+            const BatchJob &job = jobs[index];
+            Active a; // Its stream state
+            a.job = index;
+            a.started = chrono::steady_clock::now();
+            uint64_t size = 0; // Upload size
+            if (job.op == 'D') // Written to a .part file, renamed once verified
+                a.file = FileIO::openReadWrite(job.local + ".part", true);
+            else
+                a.file = FileIO::openRead(job.local);
+            if (!a.file || (job.op == 'U' && !FileIO::sizeOf(a.file, size))) // Local file unusable
+            {
+                record(index, "local-error", 0, 0, 0);
+                continue;
+            }
+            uint32_t id = job.op == 'D' ? mux.download(a.file, 0, 0, 0, codecs, job.remote) : mux.upload(a.file, 0, size, codecs, job.remote); // Sends OPEN
+            active.emplace(id, move(a));
+        }
+    };
+
+    refill(); // Fills the pipeline
+    bool connected = mux.run([&](uint32_t id, const MuxClient::Result &r) { // Called as each stream ends
+        auto it = active.find(id); // Job of the stream
+        Active a = move(it->second);
+        active.erase(it);
+        const BatchJob &job = jobs[a.job];
+        const char *status = r.ok ? "ok" : r.error == ProtocolV2::ERR_NOT_FOUND ? "not-found" : r.error ? "refused" : "failed"; // Outcome
+        a.file.reset(); // Closes the local file (a download has to be closed before the rename)
+        if (r.ok && job.op == 'D' && !FileIO::replace(job.local + ".part", job.local)) // Publishes the verified download
+            status = "local-error";
+        record(a.job, status, r.bytes, chrono::duration<double, milli>(chrono::steady_clock::now() - a.started).count(), r.crc);
+        refill(); // Keeps the pipeline full
+    });
+    if (!connected) // Whatever had not finished is lost
+    {
+        for (auto &entry : active)
+            record(entry.second.job, "connection-lost", 0, 0, 0);
+        for (; next < jobs.size(); ++next)
+            record(next, "connection-lost", 0, 0, 0);
+    }
+    report.flush(); // The report is complete
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count(); // Batch duration
+    cout << "[Client] Batch: " << jobs.size() << " files, " << failures << " failed, " << bytes << " bytes in " << seconds << " s ("
+         << (seconds > 0 ? jobs.size() / seconds : 0) << " files/s).\n"; // Prints the summary
+    return failures;
+}
+
 // Main function, entry point of the program
-int main()
+int main(int argc, char *argv[])
 {
+    int streams = 1; // Connections per transfer (1 = classic single stream, 0 = auto-tune)
+    bool useV2 = false; // Negotiates protocol v2 after connecting
+    uint8_t codecs = 0; // Compression offered on v2 streams (0 = none)
+    string batchPath; // Manifest of a batch run (empty = interactive)
+    string reportPath; // Where the batch report goes (empty = console)
+    size_t depth = BATCH_DEPTH; // Batch files in flight at once
+    for (int i = 1; i < argc; ++i) // Parses command-line options
+    {
+        string arg = argv[i]; // Current option
+        if (arg == "--streams" && i + 1 < argc) // Striped transfers over N connections ("auto" tunes N)
+        {
+            string value = argv[++i]; // Option value
+            streams = value == "auto" ? 0 : max(1, min(stoi(value), MAX_STREAMS));
+        }
+        else if (arg == "--v2") // Framed protocol with multiplexed streams
+            useV2 = true;
+        else if (arg == "--compress") // Offers every codec this build has on v2 transfers
+            codecs = Compression::supported();
+        else if (arg == "--batch" && i + 1 < argc) // Transfers the files of a manifest without prompting
+            batchPath = argv[++i];
+        else if (arg == "--report" && i + 1 < argc) // Writes the batch report to a file instead of the console
+            reportPath = argv[++i];
+        else if (arg == "--depth" && i + 1 < argc) // Batch files in flight at once
+            depth = static_cast<size_t>(max(1, min(stoi(argv[++i]), static_cast<int>(ProtocolV2::MAX_STREAMS))));
+        else if (arg == "--local-socket" && i + 1 < argc) // Socket file of a server started with --local-socket
+            localPath = argv[++i];
+        else if (arg == "--no-local") // Always connects over TCP
+            preferLocal = false;
+    }
+    vector<BatchJob> jobs; // Batch manifest
+    if (!batchPath.empty()) // Batch mode runs over v2 streams
+    {
+        if (!readManifest(batchPath, jobs))
+            return 1;
+        useV2 = true;
+    }
+
     WSADATA wsaData; // Structure to hold Winsock initialization data
     WSAStartup(MAKEWORD(2, 2), &wsaData); // Initializes Winsock version 2.2
 
-    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0); // Creates a TCP socket
-    sockaddr_in serverAddr{}; // Structure to hold server address information
-    serverAddr.sin_family = AF_INET; // Sets address family to IPv4
-    serverAddr.sin_port = htons(PORT); // Sets port number (converts to network byte order)
-    inet_pton(AF_INET, SERVER_IP, &serverAddr.sin_addr); // Converts IP string to binary
-
-    if (connect(sock, (sockaddr *)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) // Connects to the server
+    string clientUUID; // UUID assigned by the server
+    SOCKET sock = connectToServer(clientUUID); // Connects and receives the UUID
+    if (sock == INVALID_SOCKET) // Checks if the connection succeeded
     {
         cerr << "[Client] Connection failed.\n"; // Prints error message if connection fails
         return 1; // Exits with error code
     }
 
-    // Receive UUID from server
-    uint32_t uuidLen = 0; // Stores the length of the UUID
-    if (!recvExact(sock, reinterpret_cast<char *>(&uuidLen), sizeof(uuidLen))) // Receives UUID length
-        return 1; // Exits with error code if receiving fails
+    cout << "[Client] Connected" << (localConnection ? " (same host)" : "") << ". UUID: " << clientUUID << "\n"; // Prints the assigned UUID
 
-    string clientUUID(uuidLen, 0); // Creates a string to hold the UUID
-    if (!recvExact(sock, clientUUID.data(), uuidLen)) // Receives the UUID
-        return 1; // Exits with error code if receiving fails
+    unique_ptr<MuxClient> mux; // v2 stream multiplexer, if negotiated
+    if (useV2) // Offers v2
+    {
+        uint32_t version = MuxClient::negotiate(sock); // Version the server picked
+        if (version == 0) // Connection failed
+        {
+            cerr << "[Client] Version negotiation failed.\n"; // Prints error message
+            return 1;
+        }
+        cout << "[Client] Using protocol v" << version << ".\n"; // Prints the version
+        if (version >= 2) // Framed from now on
+            mux.reset(new MuxClient(sock));
+    }
 
-    cout << "[Client] Connected. UUID: " << clientUUID << "\n"; // Prints the assigned UUID
+    if (!batchPath.empty()) // Non-interactive: runs the manifest and exits
+    {
+        if (!mux) // Pipelining needs streams
+        {
+            cerr << "[Client] Batch mode needs a protocol v2 server.\n"; // Prints error message
+            return 1;
+        }
+        int noDelay = 1; // Small OPEN and END frames go out at once instead of waiting for Nagle
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&noDelay), sizeof(noDelay));
+        ofstream reportFile; // Report file, if one was asked for
+        if (!reportPath.empty())
+        {
+            reportFile.open(reportPath);
+            if (!reportFile) // Checks if the file was opened successfully
+            {
+                cerr << "[Client] Cannot write " << reportPath << ".\n"; // Prints error message
+                return 1;
+            }
+        }
+        size_t failures = runBatch(*mux, jobs, codecs, depth, reportPath.empty() ? static_cast<ostream &>(cout) : reportFile); // Transfers every file
+        mux->goAway(); // Tells the server we are done
+        closesocket(sock); // Closes the socket
+        WSACleanup(); // Cleans up Winsock resources
+        return failures == 0 ? 0 : 2; // Scripts can tell a partial failure from a usage error
+    }
 
     while (true) // Main loop for user commands
     {
-        cout << "Enter command (D=Download, U=Upload, Q=Quit): "; // Prompts user for command
+        cout << "Enter command (D=Download, U=Upload, R=Resumable download, P=Resumable upload, Y=Delta upload, O=Open server file, " << (mux ? "B=Both at once, " : "L=List files, S=Server stats, ") << "Q=Quit): "; // Prompts user for command
         char cmd; // Stores the user command
         cin >> cmd; // Reads the command from user input
+        if (mux && (cmd == 'D' || cmd == 'U' || cmd == 'B' || cmd == 'Q')) // v2 connection: transfers are streams
+        {
+            if (cmd == 'D')
+                v2Download(*mux, codecs); // One download stream
+            else if (cmd == 'U')
+                v2Upload(*mux, codecs); // One upload stream
+            else if (cmd == 'B')
+                v2Both(*mux, codecs); // Download and upload interleaved
+            else
+            {
+                mux->goAway(); // Tells the server we are done
+                break; // Exits the loop
+            }
+            continue;
+        }
+        if (cmd == 'R' || cmd == 'P') // Ranged transfers send their own commands
+        {
+            withRetries(sock, clientUUID, cmd == 'P'); // Survives dropped connections
+            if (sock == INVALID_SOCKET) // Could not reconnect
+                break; // Exits the loop
+            continue;
+        }
+        if (cmd == 'Y') // Delta upload sends its own commands
+        {
+            deltaUpload(sock);
+            continue;
+        }
+        if (cmd == 'O') // Picks the server file later transfers use
+        {
+            string name; // Name relative to the server's root, '/' separated
+            cout << "Server file name: "; // Prompts for the name
+            cin >> name;
+            char status = 2; // v2 streams name the file in OPEN, so the server checks it there
+            if (!mux && !selectRemote(sock, name, status)) // v1: the server checks it now
+            {
+                cerr << "[Client] Connection lost.\n"; // Prints error message
+                break; // Exits the loop
+            }
+            if (status == 0) // Rejected: keeps the previous selection
+                cout << "[Client] Invalid file name.\n";
+            else
+            {
+                remoteName = name; // Also selected on connections opened later
+                cout << "[Client] Selected " << name << (status == 1 ? ".\n" : " (new file).\n"); // Prints the selection
+            }
+            continue;
+        }
+        if (cmd == 'L' && !mux) // Listing is a v1 command
+        {
+            string prefix; // Name filter
+            cout << "Name prefix (- for all files): "; // Prompts for the filter
+            cin >> prefix;
+            if (!listRemote(sock, prefix == "-" ? string() : prefix)) // Pages through the catalog
+            {
+                cerr << "[Client] Connection lost.\n"; // Prints error message
+                break; // Exits the loop
+            }
+            continue;
+        }
+        if (cmd == 'S' && !mux) // Stats is a v1 command
+        {
+            printStats(sock);
+            continue;
+        }
+        if (streams != 1 && (cmd == 'D' || cmd == 'U')) // Striped transfers send their own commands
+        {
+            if (cmd == 'D')
+                stripedDownload(sock, streams); // Downloads over several connections
+            else
+                stripedUpload(sock, clientUUID, streams); // Uploads over several connections
+            continue;
+        }
+        if (cmd == 'D' && localConnection) // Same host: takes the file as a handle instead of through the socket
+        {
+            bool served = false; // False if the server wants a normal download
+            if (!localDownload(sock, served))
+            {
+                cerr << "[Client] Connection lost.\n"; // Prints error message
+                break; // Exits the loop
+            }
+            if (served)
+                continue;
+        }
         send(sock, &cmd, 1, 0); // Sends the command to the server
 
         if (cmd == 'D') // If user selects download
@@ -0,0 +1,83 @@
+#ifndef COMPRESSION_H // Prevents multiple inclusions of this header file
+#define COMPRESSION_H // Defines the header guard macro
+
+#include <cstddef> // Includes size_t
+#include <cstdint> // Includes standard integer types like uint8_t
+#include <vector> // Includes the vector library for output buffers
+#include "lz4_block.h" // Includes the vendored LZ4 block codec
+
+#ifdef COMPRESSION_WITH_ZSTD // Optional: define it and have zstd installed to offer the zstd codec
+#include <zstd.h> // Includes the zstd single-shot API
+#pragma comment(lib, "zstd.lib") // Links zstd
+#endif
+
+// Codecs for per-chunk transfer compression. Each chunk is compressed on its own, so it can be
+// produced and consumed as the socket drains, and a chunk that does not shrink is sent as it is.
+namespace Compression
+{
+    enum Codec : uint8_t
+    {
+        NONE = 0, // Uncompressed
+        LZ4 = 1, // Vendored LZ4 block format: fast, modest ratio
+        ZSTD = 2 // zstd level 3: better ratio, more CPU (only with COMPRESSION_WITH_ZSTD)
+    };
+
+    // Bit mask of the codecs this build can encode and decode (bit n = codec n)
+    inline uint8_t supported()
+    {
+        uint8_t mask = 1 << LZ4; // Always available
+#ifdef COMPRESSION_WITH_ZSTD
+        mask |= 1 << ZSTD;
+#endif
+        return mask;
+    }
+
+    // Picks the best codec in both masks, or NONE
+    inline Codec choose(uint8_t offered)
+    {
+        uint8_t common = offered & supported(); // Codecs both sides have
+        if (common & (1 << ZSTD)) // Preferred for WAN links, where bytes cost more than CPU
+            return ZSTD;
+        if (common & (1 << LZ4))
+            return LZ4;
+        return NONE;
+    }
+
+    // Compresses length bytes into out; returns the compressed size, or 0 if the chunk does not shrink
+    inline size_t compress(Codec codec, const char *data, size_t length, std::vector<char> &out)
+    {
+        if (codec == LZ4) // Vendored block codec
+        {
+            if (length < 2) // Cannot shrink
+                return 0;
+            out.resize(length - 1); // Anything not smaller is useless, so the output may not reach the input size
+            return LZ4Block::compress(data, length, out.data(), out.size());
+        }
+#ifdef COMPRESSION_WITH_ZSTD
+        if (codec == ZSTD) // zstd single-shot
+        {
+            out.resize(ZSTD_compressBound(length));
+            size_t size = ZSTD_compress(out.data(), out.size(), data, length, 3); // Level 3: zstd's default trade-off
+            return (ZSTD_isError(size) || size >= length) ? 0 : size;
+        }
+#endif
+        return 0; // Unknown codec: send uncompressed
+    }
+
+    // Decompresses a chunk that must expand to exactly length bytes; returns false on malformed input
+    inline bool decompress(Codec codec, const char *data, size_t size, char *out, size_t length)
+    {
+        if (codec == LZ4) // Vendored block codec
+            return LZ4Block::decompress(data, size, out, length);
+#ifdef COMPRESSION_WITH_ZSTD
+        if (codec == ZSTD) // zstd single-shot
+        {
+            size_t got = ZSTD_decompress(out, length, data, size);
+            return !ZSTD_isError(got) && got == length;
+        }
+#endif
+        return false; // Unknown codec
+    }
+}
+
+#endif // Ends the header guard
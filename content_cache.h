@@ -0,0 +1,340 @@
+#ifndef CONTENT_CACHE_H // Prevents multiple inclusions of this header file
+#define CONTENT_CACHE_H // Defines the header guard macro
+
+#include <windows.h> // Includes file mapping and file information functions
+#include <condition_variable> // Includes condition_variable for the hashing workers
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <deque> // Includes deque for the hashing job queue
+#include <functional> // Includes std::function for completion callbacks
+#include <list> // Includes list for LRU ordering
+#include <memory> // Includes shared_ptr for shared entries
+#include <mutex> // Includes mutex for the cache index
+#include <string> // Includes the string library for paths
+#include <thread> // Includes the thread library for hashing workers
+#include <unordered_map> // Includes unordered_map for the path index
+#include <vector> // Includes the vector library for dynamic arrays
+#include "crc32.h" // Includes the shared CRC32 engine
+#include "file_io.h" // Includes shared file handles
+#include "metrics.h" // Includes the hashing time counter
+
+// Identifies one version of a file: (volume, file index) plays the role of the inode.
+struct FileIdentity
+{
+    uint64_t volume = 0; // Volume serial number
+    uint64_t index = 0; // File index on the volume
+    uint64_t size = 0; // File size in bytes
+    uint64_t mtime = 0; // Last write time (FILETIME ticks)
+
+    bool operator==(const FileIdentity &o) const // Two identities match if nothing observable changed
+    {
+        return volume == o.volume && index == o.index && size == o.size && mtime == o.mtime;
+    }
+
+    // Reads the identity of an open file
+    static bool of(const FileIO::Handle &file, FileIdentity &id)
+    {
+        BY_HANDLE_FILE_INFORMATION info; // Receives the file metadata
+        if (!GetFileInformationByHandle(static_cast<HANDLE>(file.get()), &info)) // Queries the metadata
+            return false; // Query failed
+        id.volume = info.dwVolumeSerialNumber; // Volume serial
+        id.index = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow; // File index
+        id.size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow; // File size
+        id.mtime = (static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime; // Write time
+        return true; // Identity is valid
+    }
+};
+
+// Shared cache of served files: checksum, open handle and (optionally) a read-only mapped view.
+// Entries are keyed by path, revalidated against FileIdentity on every lookup and bounded by an
+// LRU byte budget. Concurrent lookups of the same cold file wait on a single hashing pass.
+class ContentCache
+{
+public:
+    static constexpr uint64_t BLOCK_SIZE = 1 << 20; // Granularity of the per-block checksums
+
+    // One immutable, fully hashed version of a file
+    struct Entry
+    {
+        std::string path; // Path the entry was loaded from
+        FileIdentity identity; // Version of the file that was hashed
+        uint32_t crc = 0; // CRC32 of the whole file
+        std::vector<uint32_t> blockCrcs; // CRC32 of each BLOCK_SIZE block, so range checksums need little or no reading
+        FileIO::Handle file; // Open handle, usable for TransmitFile and positioned reads
+        std::shared_ptr<const void> mapping; // Keeps the view mapped while referenced (null if not mapped)
+        const char *view = nullptr; // Start of the mapped view (null if not mapped)
+        uint64_t charge = 0; // Bytes this entry counts against the budget
+    };
+    typedef std::shared_ptr<const Entry> EntryPtr; // Entries are shared by the cache and active downloads
+    typedef std::function<void(EntryPtr)> Callback; // Receives the entry, or null if the file cannot be served
+
+    // byteBudget bounds mapped bytes held by the cache; files above maxMappedFile are served from the handle only
+    ContentCache(uint64_t byteBudget, bool mapFiles, unsigned int hashThreads)
+        : budget(byteBudget), mapFiles(mapFiles), maxMappedFile(byteBudget / 4)
+    {
+        for (unsigned int i = 0; i < hashThreads; ++i) // Starts the hashing workers
+            workers.emplace_back(&ContentCache::workerLoop, this);
+    }
+
+    ~ContentCache() // Stops the workers
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the job queue
+            stopping = true; // Tells workers to exit
+        }
+        jobReady.notify_all(); // Wakes every worker
+        for (auto &t : workers) // Waits for each worker
+            t.join();
+    }
+
+    // Returns the entry immediately if it is cached and current. Otherwise returns null and calls done
+    // exactly once: from a hashing worker thread, or right away with null if the file cannot be opened.
+    EntryPtr lookup(const std::string &path, Callback done)
+    {
+        FileIO::Handle file = FileIO::openRead(path); // Opens the file to read its identity
+        FileIdentity id; // Current identity of the file
+        if (!file || !FileIdentity::of(file, id)) // File missing or unreadable
+        {
+            done(EntryPtr()); // Reports failure right away
+            return EntryPtr();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex); // Protects the index
+        auto it = index.find(path); // Looks for a cached version
+        if (it != index.end()) // Some version is known
+        {
+            Slot &slot = it->second; // Cached slot for this path
+            if (slot.identity == id) // Same version as on disk
+            {
+                if (slot.entry) // Already hashed
+                {
+                    lru.splice(lru.begin(), lru, slot.lruPos); // Marks as most recently used
+                    ++hits; // Counts the hit
+                    return slot.entry; // Serves it without touching the data
+                }
+                slot.pass->waiters.push_back(std::move(done)); // A pass is already running: waits for it
+                ++coalesced; // Counts the shared pass
+                return EntryPtr();
+            }
+            dropLocked(it); // File changed on disk: forgets the stale version
+        }
+
+        Slot &slot = index[path]; // Creates a slot for the new version
+        slot.identity = id; // Records which version is being hashed
+        slot.pass = std::make_shared<Pass>(); // Starts a new hashing pass
+        slot.pass->waiters.push_back(std::move(done)); // The first requester waits too
+        jobs.push_back(Job{path, file, id, slot.pass}); // Schedules the hashing pass
+        ++misses; // Counts the miss
+        jobReady.notify_one(); // Wakes a worker
+        return EntryPtr();
+    }
+
+    // Computes the CRC32 of [offset, offset + length) of an entry; whole blocks come from blockCrcs,
+    // only the partial blocks at either end are read. Returns false if the range cannot be read.
+    static bool rangeCrc(const Entry &entry, uint64_t offset, uint64_t length, uint32_t &crc)
+    {
+        crc = 0; // CRC of the empty prefix
+        uint64_t end = offset + length; // End of the range
+        std::vector<char> buffer; // Read buffer for unmapped partial blocks, allocated on demand
+        for (uint64_t pos = offset; pos < end;) // Walks the range block by block
+        {
+            uint64_t blockStart = pos - pos % BLOCK_SIZE; // Start of the block containing pos
+            uint64_t blockEnd = std::min(blockStart + BLOCK_SIZE, entry.identity.size); // End of that block
+            uint64_t spanEnd = std::min(blockEnd, end); // Part of the block inside the range
+            uint32_t part; // CRC of this span
+            if (pos == blockStart && spanEnd == blockEnd) // Whole block: precomputed
+                part = entry.blockCrcs[static_cast<size_t>(pos / BLOCK_SIZE)];
+            else if (entry.view) // Partial block of a mapped file
+                part = CRC32::update(0, entry.view + pos, static_cast<size_t>(spanEnd - pos));
+            else // Partial block of an unmapped file
+            {
+                buffer.resize(static_cast<size_t>(spanEnd - pos)); // Sizes the buffer for the span
+                if (FileIO::readAt(entry.file, pos, buffer.data(), buffer.size()) != buffer.size()) // Reads the span
+                    return false; // File changed underneath
+                part = CRC32::update(0, buffer.data(), buffer.size());
+            }
+            crc = CRC32::combine(crc, part, spanEnd - pos); // Appends the span's CRC
+            pos = spanEnd; // Moves to the next block
+        }
+        return true; // crc is valid
+    }
+
+    // Snapshot of cache counters
+    struct Stats
+    {
+        uint64_t hits, misses, coalesced, entries, bytes; // Counter values
+    };
+
+    Stats stats() // Returns the current counters
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the counters
+        return Stats{hits, misses, coalesced, static_cast<uint64_t>(lru.size()), usedBytes};
+    }
+
+private:
+    struct Pass // Requests sharing one hashing pass
+    {
+        std::vector<Callback> waiters; // Completed when the pass finishes
+    };
+
+    struct Job // One pending hashing pass
+    {
+        std::string path; // Path being hashed
+        FileIO::Handle file; // Handle opened by lookup()
+        FileIdentity identity; // Version being hashed
+        std::shared_ptr<Pass> pass; // Waiters of this pass
+    };
+
+    struct Slot // Index entry for one path
+    {
+        FileIdentity identity; // Version this slot describes
+        EntryPtr entry; // Hashed entry (null while hashing)
+        std::shared_ptr<Pass> pass; // Running pass (null once hashed)
+        std::list<std::string>::iterator lruPos; // Position in the LRU list (valid once hashed)
+    };
+
+    static constexpr uint64_t ENTRY_OVERHEAD = 256; // Budget charge for an unmapped entry
+
+    // Worker thread: runs hashing passes until the cache is destroyed
+    void workerLoop()
+    {
+        std::vector<char> buffer; // Read buffer for unmapped files, allocated on first use
+        while (true) // Processes jobs until stopped
+        {
+            Job job; // Next job
+            {
+                std::unique_lock<std::mutex> lock(mutex); // Protects the job queue
+                jobReady.wait(lock, [this]() { return stopping || !jobs.empty(); }); // Waits for work
+                if (stopping) // Cache is shutting down
+                    return;
+                job = std::move(jobs.front()); // Takes the oldest job
+                jobs.pop_front();
+            }
+
+            std::shared_ptr<Entry> entry; // Result of the hashing pass
+            {
+                Metrics::Timer timer(Metrics::HASH_NS); // Reading and checksumming the file
+                entry = load(job, buffer); // Hashes the file (outside the lock)
+            }
+            publish(job, entry); // Stores the result and wakes the waiters
+        }
+    }
+
+    // Hashes one file, mapping it when allowed; returns null on read errors
+    std::shared_ptr<Entry> load(const Job &job, std::vector<char> &buffer)
+    {
+        std::shared_ptr<Entry> entry = std::make_shared<Entry>(); // New entry
+        entry->path = job.path; // Records the path
+        entry->identity = job.identity; // Records the version
+        entry->file = job.file; // Keeps the handle for serving
+        uint64_t size = job.identity.size; // File size
+
+        if (mapFiles && size > 0 && size <= maxMappedFile) // Small enough to keep mapped
+        {
+            HANDLE section = CreateFileMappingA(static_cast<HANDLE>(job.file.get()), nullptr, PAGE_READONLY, 0, 0, nullptr); // Creates a read-only section
+            if (section != nullptr) // Section created
+            {
+                const void *view = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0); // Maps the whole file
+                CloseHandle(section); // The view keeps the section alive
+                if (view != nullptr) // Mapping succeeded
+                {
+                    entry->mapping = std::shared_ptr<const void>(view, [](const void *p) { UnmapViewOfFile(p); }); // Unmaps with the last reference
+                    entry->view = static_cast<const char *>(view); // Exposes the bytes
+                    for (uint64_t offset = 0; offset < size; offset += BLOCK_SIZE) // Hashes straight from the mapping, block by block
+                        addBlock(*entry, CRC32::update(0, entry->view + offset, static_cast<size_t>(std::min(BLOCK_SIZE, size - offset))),
+                                 std::min(BLOCK_SIZE, size - offset));
+                    entry->charge = size; // Mapped bytes count against the budget
+                    return entry;
+                }
+            }
+        }
+
+        if (buffer.empty()) // First unmapped file for this worker
+            buffer.resize(static_cast<size_t>(BLOCK_SIZE)); // Allocates the read buffer
+        for (uint64_t offset = 0; offset < size;) // Reads the file one block at a time
+        {
+            size_t want = static_cast<size_t>(std::min<uint64_t>(BLOCK_SIZE, size - offset)); // Bytes for this block
+            size_t got = FileIO::readAt(job.file, offset, buffer.data(), want); // Reads the block
+            if (got != want) // Short read: the file changed underneath
+                return nullptr;
+            addBlock(*entry, CRC32::update(0, buffer.data(), got), got); // Records the block checksum
+            offset += got; // Advances
+        }
+        entry->charge = ENTRY_OVERHEAD + entry->blockCrcs.size() * sizeof(uint32_t); // Only metadata is held
+        return entry;
+    }
+
+    // Appends one block checksum and extends the whole-file CRC with it
+    static void addBlock(Entry &entry, uint32_t blockCrc, uint64_t blockLength)
+    {
+        entry.blockCrcs.push_back(blockCrc); // Stores the block checksum
+        entry.crc = CRC32::combine(entry.crc, blockCrc, blockLength); // Whole-file CRC without a second pass
+    }
+
+    // Installs a finished entry and hands it to every waiter
+    void publish(const Job &job, const std::shared_ptr<Entry> &entry)
+    {
+        FileIdentity after; // Identity after hashing
+        bool stable = entry && FileIdentity::of(job.file, after) && after == job.identity; // File did not change while hashing
+        EntryPtr result = stable ? EntryPtr(entry) : EntryPtr(); // Changed or unreadable files are not served
+        std::vector<Callback> waiters; // Requests to complete
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the index
+            waiters.swap(job.pass->waiters); // Takes the waiters, even if the file changed meanwhile
+            auto it = index.find(job.path); // Finds the slot for this path
+            if (it != index.end() && it->second.pass == job.pass) // Slot still describes this pass
+            {
+                it->second.pass.reset(); // The pass is over
+                if (result) // Caches successful passes
+                {
+                    it->second.entry = result; // Stores the entry
+                    lru.push_front(job.path); // Makes it the most recently used
+                    it->second.lruPos = lru.begin(); // Remembers its position
+                    usedBytes += result->charge; // Charges the budget
+                    evictLocked(); // Keeps the cache within budget
+                }
+                else
+                    index.erase(it); // Lets the next lookup retry
+            }
+        }
+        for (auto &w : waiters) // Completes each waiting request outside the lock
+            w(result);
+    }
+
+    // Removes a hashed or in-flight slot; an in-flight pass still completes its own waiters
+    void dropLocked(std::unordered_map<std::string, Slot>::iterator it)
+    {
+        if (it->second.entry) // Slot holds a cached entry
+        {
+            usedBytes -= it->second.entry->charge; // Releases its budget
+            lru.erase(it->second.lruPos); // Removes it from the LRU list
+        }
+        index.erase(it); // Forgets the slot
+    }
+
+    // Evicts least recently used entries until the budget is respected
+    void evictLocked()
+    {
+        while (usedBytes > budget && lru.size() > 1) // Keeps at least the newest entry
+        {
+            auto it = index.find(lru.back()); // Least recently used path
+            usedBytes -= it->second.entry->charge; // Releases its budget; active downloads keep their own reference
+            lru.pop_back(); // Removes it from the LRU list
+            index.erase(it); // Forgets it
+        }
+    }
+
+    uint64_t budget; // Maximum bytes charged to cached entries
+    bool mapFiles; // True to keep small files mapped
+    uint64_t maxMappedFile; // Largest file that is mapped
+    std::mutex mutex; // Protects everything below
+    std::condition_variable jobReady; // Signals new jobs or shutdown
+    std::deque<Job> jobs; // Pending hashing passes
+    std::vector<std::thread> workers; // Hashing threads
+    bool stopping = false; // True when the cache is being destroyed
+    std::unordered_map<std::string, Slot> index; // Slots by path
+    std::list<std::string> lru; // Hashed paths, most recent first
+    uint64_t usedBytes = 0; // Bytes currently charged
+    uint64_t hits = 0, misses = 0, coalesced = 0; // Counters
+};
+
+#endif // Ends the header guard
@@ -2,25 +2,285 @@
 #define CRC32_H // Defines the header guard macro
 
 #include <cstdint> // Includes standard integer types like uint32_t and uint8_t
+#include <cstddef> // Includes size_t
+#include <cstring> // Includes memcpy for unaligned word loads
 
+#if defined(_M_X64) || defined(__x86_64__) // Only x86-64 builds get the carry-less multiply kernel
+#define CRC32_HAVE_PCLMUL 1 // Marks the PCLMULQDQ kernel as compiled in
+#include <emmintrin.h> // Includes SSE2 intrinsics
+#include <smmintrin.h> // Includes SSE4.1 intrinsics (_mm_extract_epi32)
+#include <wmmintrin.h> // Includes the PCLMULQDQ intrinsic (_mm_clmulepi64_si128)
+#ifdef _MSC_VER // MSVC exposes CPUID through <intrin.h>
+#include <intrin.h> // Includes __cpuid
+#define CRC32_TARGET_PCLMUL // MSVC does not need per-function target attributes
+#else // GCC and Clang (including MinGW) use <cpuid.h> and target attributes
+#include <cpuid.h> // Includes __get_cpuid
+#define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1"))) // Allows the intrinsics without global -m flags
+#endif
+#endif
+
+// CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320), the checksum used on the wire by server and client.
+// All kernels produce bit-identical results; the fastest one supported by the CPU is picked once at runtime.
 class CRC32 // Defines a class to encapsulate CRC32 checksum functionality
 {
 public: // Public access specifier for the class members
-    static uint32_t update(uint32_t crc, const char *data, size_t length) // Static method to compute CRC32 checksum
+    static constexpr uint32_t POLY = 0xEDB88320; // Reflected CRC32 polynomial
+
+    typedef uint32_t (*Kernel)(uint32_t crc, const uint8_t *data, size_t length); // Raw kernel on the inverted CRC state
+
+    // Computes the CRC32 of data, continuing from a previous CRC (0 for a fresh checksum)
+    static uint32_t update(uint32_t crc, const char *data, size_t length)
+    {
+        return ~kernel()(~crc, reinterpret_cast<const uint8_t *>(data), length); // Runs the dispatched kernel on the inverted state
+    }
+
+    // Returns CRC(A || B) given CRC(A), CRC(B) and the length of B, without touching the data
+    static uint32_t combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB)
+    {
+        return multModP(xPow8n(lengthB), crcA) ^ crcB; // Shifts crcA past lengthB zero bytes and folds in crcB
+    }
+
+    // Name of the kernel chosen for this CPU, for logs and benchmarks
+    static const char *engineName()
+    {
+        Kernel k = kernel(); // Looks up the selected kernel
+#ifdef CRC32_HAVE_PCLMUL
+        if (k == &pclmulKernel) // Checks for the carry-less multiply kernel
+            return "pclmul"; // Reports the hardware kernel
+#endif
+        return k == &slicing16Kernel ? "slicing-by-16" : "slicing-by-8"; // Reports the table kernel
+    }
+
+    // Reference implementation, one bit at a time; kept for benchmarks and self-checks
+    static uint32_t bitwiseKernel(uint32_t crc, const uint8_t *data, size_t length)
     {
-        crc = ~crc; // Inverts the input CRC value (bitwise NOT) to initialize the computation
         for (size_t i = 0; i < length; ++i) // Iterates over each byte in the input data
         {
-            crc ^= static_cast<uint8_t>(data[i]); // XORs the current byte with the CRC value
+            crc ^= data[i]; // XORs the current byte with the CRC value
             for (int j = 0; j < 8; ++j) // Processes each bit of the current byte
+                crc = (crc >> 1) ^ (POLY & (0u - (crc & 1))); // Right-shifts and conditionally applies the polynomial
+        }
+        return crc; // Returns the (still inverted) CRC state
+    }
+
+    // Processes 8 bytes per step using 8 lookup tables
+    static uint32_t slicing8Kernel(uint32_t crc, const uint8_t *data, size_t length)
+    {
+        const uint32_t(*t)[256] = tables(); // Fetches the shared lookup tables
+        while (length >= 8) // Consumes whole 8-byte words
+        {
+            uint32_t one = load32(data) ^ crc; // First word, mixed with the running CRC
+            uint32_t two = load32(data + 4); // Second word
+            crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+                  t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24]; // Folds all 8 bytes at once
+            data += 8; // Advances past the processed word
+            length -= 8; // Reduces the remaining length
+        }
+        return tailKernel(crc, data, length); // Finishes the last few bytes one at a time
+    }
+
+    // Processes 16 bytes per step using 16 lookup tables
+    static uint32_t slicing16Kernel(uint32_t crc, const uint8_t *data, size_t length)
+    {
+        const uint32_t(*t)[256] = tables(); // Fetches the shared lookup tables
+        while (length >= 16) // Consumes whole 16-byte blocks
+        {
+            uint32_t a = load32(data) ^ crc; // First word, mixed with the running CRC
+            uint32_t b = load32(data + 4); // Second word
+            uint32_t c = load32(data + 8); // Third word
+            uint32_t d = load32(data + 12); // Fourth word
+            crc = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24] ^
+                  t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^ t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24] ^
+                  t[7][c & 0xFF] ^ t[6][(c >> 8) & 0xFF] ^ t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24] ^
+                  t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^ t[1][(d >> 16) & 0xFF] ^ t[0][d >> 24]; // Folds all 16 bytes at once
+            data += 16; // Advances past the processed block
+            length -= 16; // Reduces the remaining length
+        }
+        return slicing8Kernel(crc, data, length); // Hands the remainder to the 8-byte kernel
+    }
+
+#ifdef CRC32_HAVE_PCLMUL
+    // Folds 64 bytes per step with carry-less multiplication, then Barrett-reduces to 32 bits
+    // (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", bit-reflected constants)
+    static CRC32_TARGET_PCLMUL uint32_t pclmulKernel(uint32_t crc, const uint8_t *data, size_t length)
+    {
+        if (length < 64) // Short inputs are not worth the setup cost
+            return slicing16Kernel(crc, data, length); // Uses the table kernel instead
+
+        const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL); // Fold-by-4 constants (x^(4*128+32), x^(4*128-32))
+        const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL); // Fold-by-1 constants (x^(128+32), x^(128-32))
+        const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL); // 64-to-32 bit fold constant
+        const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL); // Barrett constants (mu, P)
+        const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0); // Keeps the low 32 bits of each 64-bit lane
+
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x00)); // Loads the first 64 bytes
+        __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x10));
+        __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x20));
+        __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc))); // Mixes the running CRC into the first lane
+        data += 64; // Advances past the loaded block
+        length -= 64; // Reduces the remaining length
+
+        while (length >= 64) // Folds four 128-bit lanes in parallel
+        {
+            x1 = fold(x1, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x00))); // Folds lane 1 into the next block
+            x2 = fold(x2, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x10))); // Folds lane 2
+            x3 = fold(x3, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x20))); // Folds lane 3
+            x4 = fold(x4, k1k2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x30))); // Folds lane 4
+            data += 64; // Advances past the folded block
+            length -= 64; // Reduces the remaining length
+        }
+
+        x1 = fold(x1, k3k4, x2); // Collapses the four lanes into one
+        x1 = fold(x1, k3k4, x3);
+        x1 = fold(x1, k3k4, x4);
+
+        while (length >= 16) // Folds any remaining whole 16-byte blocks
+        {
+            x1 = fold(x1, k3k4, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data))); // Folds one block
+            data += 16; // Advances past the block
+            length -= 16; // Reduces the remaining length
+        }
+
+        __m128i x0 = _mm_clmulepi64_si128(x1, k3k4, 0x10); // Folds 128 bits down to 96
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x0);
+        x0 = _mm_srli_si128(x1, 4); // Folds 96 bits down to 64
+        x1 = _mm_and_si128(x1, mask32);
+        x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+        x1 = _mm_xor_si128(x1, x0);
+
+        x0 = _mm_and_si128(x1, mask32); // Barrett reduction to the final 32-bit remainder
+        x0 = _mm_clmulepi64_si128(x0, poly, 0x10);
+        x0 = _mm_and_si128(x0, mask32);
+        x0 = _mm_clmulepi64_si128(x0, poly, 0x00);
+        x1 = _mm_xor_si128(x1, x0);
+        crc = static_cast<uint32_t>(_mm_extract_epi32(x1, 1)); // Extracts the reduced CRC
+
+        return slicing16Kernel(crc, data, length); // Finishes the sub-16-byte tail with tables
+    }
+#endif
+
+private: // Private helpers
+    // Reads a little-endian 32-bit word from a possibly unaligned address
+    static uint32_t load32(const uint8_t *p)
+    {
+        uint32_t v; // Destination word
+        memcpy(&v, p, sizeof(v)); // Unaligned-safe load (compiles to a single mov)
+        return v; // The wire targets (x86, ARM) are little-endian
+    }
+
+    // Byte-at-a-time table step used for tails
+    static uint32_t tailKernel(uint32_t crc, const uint8_t *data, size_t length)
+    {
+        const uint32_t(*t)[256] = tables(); // Fetches the shared lookup tables
+        while (length--) // Processes each remaining byte
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF]; // Standard single-table update
+        return crc; // Returns the updated state
+    }
+
+    // Builds the 16 slicing tables once (thread-safe static initialization)
+    static const uint32_t (*tables())[256]
+    {
+        struct Tables // Holder so the tables can be built in a constructor
+        {
+            uint32_t t[16][256]; // t[k][b] = CRC of byte b followed by k zero bytes
+            Tables()
+            {
+                for (uint32_t i = 0; i < 256; ++i) // Builds the base table
+                {
+                    uint32_t c = i; // Starts from the byte value
+                    for (int j = 0; j < 8; ++j) // Processes each bit
+                        c = (c >> 1) ^ (POLY & (0u - (c & 1))); // Applies the polynomial
+                    t[0][i] = c; // Stores the base entry
+                }
+                for (int k = 1; k < 16; ++k) // Derives each higher-order table from the previous one
+                    for (uint32_t i = 0; i < 256; ++i)
+                        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF]; // Appends one zero byte
+            }
+        };
+        static const Tables instance; // Built on first use
+        return instance.t; // Returns the table array
+    }
+
+#ifdef CRC32_HAVE_PCLMUL
+    // One folding step: multiplies both halves of acc by the constants and XORs in the next block
+    static CRC32_TARGET_PCLMUL __m128i fold(__m128i acc, __m128i k, __m128i next)
+    {
+        __m128i lo = _mm_clmulepi64_si128(acc, k, 0x00); // Low half times the low constant
+        __m128i hi = _mm_clmulepi64_si128(acc, k, 0x11); // High half times the high constant
+        return _mm_xor_si128(_mm_xor_si128(lo, hi), next); // Merges both products with the next block
+    }
+
+    // Checks CPUID for PCLMULQDQ and SSE4.1
+    static bool cpuHasPclmul()
+    {
+#ifdef _MSC_VER
+        int regs[4]; // EAX, EBX, ECX, EDX
+        __cpuid(regs, 1); // Queries the feature flags leaf
+        unsigned int ecx = static_cast<unsigned int>(regs[2]); // Feature bits live in ECX
+#else
+        unsigned int eax, ebx, ecx = 0, edx; // CPUID output registers
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) // Queries the feature flags leaf
+            return false; // CPUID leaf 1 unavailable
+#endif
+        return (ecx & (1u << 1)) && (ecx & (1u << 19)); // Bit 1 = PCLMULQDQ, bit 19 = SSE4.1
+    }
+#endif
+
+    // Chooses the fastest kernel for this CPU
+    static Kernel selectKernel()
+    {
+#ifdef CRC32_HAVE_PCLMUL
+        if (cpuHasPclmul()) // Prefers the hardware kernel when available
+            return &pclmulKernel;
+#endif
+        return sizeof(void *) >= 8 ? &slicing16Kernel : &slicing8Kernel; // 16 tables pay off on 64-bit targets
+    }
+
+    // Returns the kernel selected for this process (resolved once)
+    static Kernel kernel()
+    {
+        static const Kernel selected = selectKernel(); // Thread-safe one-time dispatch
+        return selected; // Returns the cached choice
+    }
+
+    // Multiplies two polynomials modulo the CRC polynomial (reflected bit order)
+    static uint32_t multModP(uint32_t a, uint32_t b)
+    {
+        uint32_t product = 0; // Accumulated product
+        for (uint32_t m = 1u << 31; m != 0; m >>= 1) // Walks a from its x^0 term upwards
+        {
+            if (a & m) // Term present in a
+                product ^= b; // Adds the current multiple of b
+            b = (b >> 1) ^ (POLY & (0u - (b & 1))); // Multiplies b by x modulo P
+        }
+        return product; // Returns a*b mod P
+    }
+
+    // Computes x^(8*n) modulo P by square-and-multiply over the x^(2^k) table
+    static uint32_t xPow8n(uint64_t n)
+    {
+        struct PowerTable // Holder for x^(2^k) mod P, k = 0..31 (the sequence repeats with period 32)
+        {
+            uint32_t p[32]; // Powers of x by repeated squaring
+            PowerTable()
             {
-                if (crc & 1) // Checks if the least significant bit of CRC is 1
-                    crc = (crc >> 1) ^ 0xEDB88320; // Right-shifts CRC and XORs with the CRC32 polynomial
-                else // If the least significant bit is 0
-                    crc >>= 1; // Right-shifts CRC by one bit
+                p[0] = 1u << 30; // x^1 in reflected representation
+                for (int k = 1; k < 32; ++k) // Squares the previous power
+                    p[k] = multModP(p[k - 1], p[k - 1]);
             }
+        };
+        static const PowerTable powers; // Built on first use
+        uint32_t result = 1u << 31; // x^0 in reflected representation
+        int k = 3; // Starts at x^(2^3) because each length unit is 8 bits
+        while (n != 0) // Consumes the bits of n
+        {
+            if (n & 1) // Bit set: multiply in x^(2^k)
+                result = multModP(powers.p[k & 31], result);
+            n >>= 1; // Moves to the next bit
+            ++k; // Next power of two
         }
-        return ~crc; // Returns the inverted CRC value as the final checksum
+        return result; // Returns x^(8n) mod P
     }
 };
 
@@ -0,0 +1,138 @@
+#ifndef DELTA_SYNC_H // Prevents multiple inclusions of this header file
+#define DELTA_SYNC_H // Defines the header guard macro
+
+#include <algorithm> // Includes std::min
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <cstring> // Includes memcpy and memmove
+#include <functional> // Includes std::function for the chunk callback
+#include <vector> // Includes the vector library for the scan buffer
+#include "file_io.h" // Includes positioned file reads
+
+// Content-defined chunking for delta uploads ('Y' / 'Z').
+//
+// Chunk boundaries are picked by a gear rolling hash over the bytes themselves, so an insertion or
+// deletion only changes the chunks around it; the rest of the file still cuts at the same places and
+// matches the server's copy. Each chunk is identified by its length and a 64-bit hash. A false match
+// is caught by the whole-file CRC the server checks before publishing the rebuilt file.
+//
+//   'Y'  c->s                                        ask for the signature of the server's copy
+//        s->c  count(4) { length(4) hash(8) } * count  chunks in file order (count 0 = no copy)
+//   'Z'  c->s  size(8) crc(4) op*                    rebuild a file of size bytes with that CRC
+//              op 'C' index(4)                       copy chunk index of the signature
+//              op 'L' length(4) bytes                literal bytes (at most MAX_LITERAL)
+//              op 'E'                                end of the file
+//        s->c  status(1) crc(4)                      stored and verified (status 1) or not (0)
+//
+// Like the rest of protocol v1, integers are in host byte order.
+namespace DeltaSync
+{
+    static constexpr uint32_t MIN_CHUNK = 2 * 1024; // No boundary before this many bytes
+    static constexpr uint32_t MAX_CHUNK = 64 * 1024; // Forced boundary after this many bytes
+    static constexpr uint64_t BOUNDARY_MASK = (1ull << 13) - 1; // Boundary when the low 13 bits are zero: chunks of a few KiB on average
+    static constexpr uint32_t MAX_LITERAL = 1024 * 1024; // Largest literal op
+    static constexpr size_t SCAN_BLOCK = 1024 * 1024; // File bytes read per step while scanning
+
+    // One chunk of a file
+    struct Chunk
+    {
+        uint64_t offset = 0; // Position in the file
+        uint32_t length = 0; // Bytes in the chunk
+        uint64_t hash = 0; // Strong hash of its bytes
+    };
+
+    inline uint64_t mix64(uint64_t x) // Final avalanche (splitmix64 / murmur3 finalizer)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // 256 pseudo-random values for the gear hash, the same on both sides
+    inline const uint64_t *gearTable()
+    {
+        static const std::vector<uint64_t> table = [] {
+            std::vector<uint64_t> t(256); // One value per byte
+            uint64_t seed = 0x9e3779b97f4a7c15ull; // Fixed seed: the table is part of the protocol
+            for (uint64_t &v : t) // splitmix64 sequence
+                v = mix64(seed += 0x9e3779b97f4a7c15ull);
+            return t;
+        }();
+        return table.data();
+    }
+
+    // 64-bit hash of a chunk, eight bytes at a time
+    inline uint64_t hash64(const char *data, size_t length)
+    {
+        uint64_t h = 0x27d4eb2f165667c5ull ^ (length * 0x9e3779b97f4a7c15ull); // Seeds with the length
+        size_t i = 0; // Bytes hashed
+        for (; i + 8 <= length; i += 8) // Whole words
+        {
+            uint64_t w; // Unaligned load
+            memcpy(&w, data + i, sizeof(w));
+            h = (h ^ mix64(w)) * 0x9e3779b97f4a7c15ull;
+            h = (h << 31) | (h >> 33);
+        }
+        uint64_t tail = 0; // Remaining bytes
+        memcpy(&tail, data + i, length - i);
+        return mix64(h ^ mix64(tail ^ (length - i)));
+    }
+
+    // Length of the chunk starting at data, given length bytes are available (all of the rest of the
+    // file, or at least MAX_CHUNK)
+    inline size_t cut(const char *data, size_t length)
+    {
+        if (length <= MIN_CHUNK) // Tail of the file
+            return length;
+        const uint64_t *gear = gearTable(); // Rolling hash inputs
+        size_t limit = std::min<size_t>(length, MAX_CHUNK); // Forced boundary
+        uint64_t h = 0; // Gear hash: each byte shifts out after 64 more
+        for (size_t i = MIN_CHUNK; i < limit; ++i) // Bytes before MIN_CHUNK cannot end a chunk, so they are skipped
+        {
+            h = (h << 1) + gear[static_cast<uint8_t>(data[i])];
+            if ((h & BOUNDARY_MASK) == 0) // Content-defined boundary
+                return i + 1;
+        }
+        return limit;
+    }
+
+    // Splits size bytes of file into chunks, calling onChunk with each chunk and its bytes in file
+    // order; returns false if the file could not be read
+    inline bool scan(const FileIO::Handle &file, uint64_t size, const std::function<void(const Chunk &, const char *)> &onChunk)
+    {
+        std::vector<char> buffer(SCAN_BLOCK + MAX_CHUNK); // A block plus the unfinished chunk carried over
+        size_t buffered = 0; // Bytes in buffer
+        uint64_t readOffset = 0; // Next file offset to read
+        uint64_t chunkOffset = 0; // File offset of buffer[0]
+        while (readOffset < size || buffered > 0) // Until every byte is chunked
+        {
+            size_t want = static_cast<size_t>(std::min<uint64_t>(buffer.size() - buffered, size - readOffset)); // Fills the buffer
+            if (want > 0)
+            {
+                if (FileIO::readAt(file, readOffset, buffer.data() + buffered, want) != want) // File shrank or failed
+                    return false;
+                buffered += want;
+                readOffset += want;
+            }
+            bool atEnd = readOffset == size; // No more input after this buffer
+            size_t used = 0; // Bytes chunked in this pass
+            while (used < buffered && (atEnd || buffered - used >= MAX_CHUNK)) // A boundary is decidable
+            {
+                Chunk c; // Next chunk
+                c.offset = chunkOffset + used;
+                c.length = static_cast<uint32_t>(cut(buffer.data() + used, buffered - used));
+                c.hash = hash64(buffer.data() + used, c.length);
+                onChunk(c, buffer.data() + used);
+                used += c.length;
+            }
+            memmove(buffer.data(), buffer.data() + used, buffered - used); // Carries the unfinished chunk over
+            buffered -= used;
+            chunkOffset += used;
+        }
+        return true;
+    }
+}
+
+#endif // Ends the header guard
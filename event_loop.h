@@ -0,0 +1,502 @@
+#ifndef EVENT_LOOP_H // Prevents multiple inclusions of this header file
+#define EVENT_LOOP_H // Defines the header guard macro
+
+#include <winsock2.h> // Includes the Winsock 2 library for overlapped socket I/O
+#include <mswsock.h> // Includes TransmitFile for zero-copy file sends
+#include <windows.h> // Includes I/O completion port functions
+#include <atomic> // Includes atomics for cross-thread counters
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <algorithm> // Includes std::min
+#include <cstring> // Includes memmove for compacting the receive buffer
+#include <deque> // Includes deque for the send queue
+#include <functional> // Includes std::function for posted tasks
+#include <memory> // Includes shared_ptr for keeping sent files open
+#include <mutex> // Includes mutex for the cross-thread task queue
+#include <thread> // Includes the thread library for the loop thread
+#include <unordered_map> // Includes unordered_map for the connection registry
+#include <vector> // Includes the vector library for dynamic arrays
+#include "metrics.h" // Includes the socket byte and time counters
+
+#pragma comment(lib, "ws2_32.lib") // Links the Winsock library to the program
+#pragma comment(lib, "mswsock.lib") // Links TransmitFile
+
+class EventLoop; // Forward declaration, defined below
+
+// A non-blocking socket driven by an EventLoop. Subclasses implement the protocol as a state machine:
+// every hook runs on the owning loop thread and must return without blocking on the network.
+class Connection
+{
+public:
+    static constexpr size_t RECV_BUFFER_SIZE = 16 * 1024; // Receive buffer per connection
+    static constexpr size_t SEND_LOW_WATER = 256 * 1024; // Suggested refill threshold for onWritable producers
+    static constexpr DWORD MAX_TRANSMIT_CHUNK = 1u << 30; // Largest range handed to one TransmitFile call
+
+    explicit Connection(SOCKET sock) : sock(sock) {} // Takes ownership of an accepted socket
+    virtual ~Connection() // Closes the socket if still open
+    {
+        if (sock != INVALID_SOCKET) // Checks if the socket is still open
+            closesocket(sock); // Closes the socket
+    }
+
+    SOCKET socket() const { return sock; } // Returns the underlying socket
+    EventLoop *loop() const { return owner; } // Returns the loop this connection runs on
+    uint64_t id() const { return connectionId; } // Returns the loop-unique connection id
+    uint64_t pendingSendBytes() const { return txBytes; } // Bytes queued but not yet acknowledged by send
+    uint64_t sentBytes() const { return txSent; } // Bytes acknowledged by send since the connection started
+    bool isClosing() const { return closing; } // True once the connection is shutting down
+
+protected:
+    virtual void onStart() = 0; // Called once the loop has adopted the socket
+    virtual size_t onData(const char *data, size_t length) = 0; // Called with buffered input; returns bytes consumed
+    virtual void onWritable() {} // Called after each send completes, so producers can top up the queue
+    virtual void onClosed() {} // Called right before the connection is destroyed
+
+    void queueSend(const char *data, size_t length); // Appends a copy of data to the send queue
+    void queueSend(std::vector<char> &&chunk); // Appends a buffer to the send queue without copying
+    void queueView(std::shared_ptr<const void> owner, const char *data, size_t length); // Appends borrowed memory kept alive by owner
+    void queueFile(std::shared_ptr<void> file, uint64_t offset, uint64_t length); // Appends a file range sent by the kernel (zero-copy)
+    void pauseReading(); // Stops delivering input (bytes stay buffered)
+    void resumeReading(); // Resumes delivering input, starting with anything already buffered
+    void closeAfterFlush(); // Closes once all queued output has been sent
+    void close(); // Closes immediately, discarding queued output
+
+private:
+    friend class EventLoop; // The loop drives the private I/O state
+
+    enum OpKind // Kind of overlapped operation
+    {
+        OP_RECV, // Overlapped WSARecv
+        OP_SEND // Overlapped WSASend
+    };
+
+    struct IoOp // One overlapped operation slot
+    {
+        OVERLAPPED overlapped; // Must be first so the OVERLAPPED* maps back to the op
+        OpKind kind; // Which operation this slot is for
+        Connection *conn; // Connection that owns the slot
+        bool pending; // True while the kernel owns the slot
+    };
+
+    struct TxItem // One entry in the send queue
+    {
+        std::vector<char> bytes; // Owned payload (empty for views and file ranges)
+        const char *data = nullptr; // Start of the in-memory payload (owned bytes or a borrowed view)
+        size_t dataLength = 0; // Length of the in-memory payload
+        std::shared_ptr<const void> owner; // Keeps a borrowed view alive until it is sent
+        std::shared_ptr<void> file; // File HANDLE kept open until the range is sent (null for memory)
+        uint64_t fileOffset = 0; // Next file offset to send
+        uint64_t fileLength = 0; // File bytes still to send
+
+        uint64_t remaining(size_t sentFromMemory) const // Unsent size of this entry
+        {
+            return file ? fileLength : dataLength - sentFromMemory; // File ranges track progress themselves
+        }
+    };
+
+    void schedule(); // Asks the loop to service this connection after the current event
+
+    SOCKET sock; // Socket handle
+    EventLoop *owner = nullptr; // Loop this connection belongs to
+    uint64_t connectionId = 0; // Id assigned by the loop
+    IoOp recvOp{}; // Receive slot
+    IoOp sendOp{}; // Send slot
+    std::vector<char> rxBuffer; // Bytes received but not yet consumed
+    size_t rxLength = 0; // Number of valid bytes in rxBuffer
+    bool rxDirty = false; // True when rxBuffer has input onData has not seen yet
+    std::deque<TxItem> txQueue; // Chunks and file ranges waiting to be sent
+    size_t txOffset = 0; // Bytes of txQueue.front().data already sent
+    uint64_t txBytes = 0; // Total unsent bytes across txQueue
+    uint64_t txSent = 0; // Total bytes acknowledged by send
+    bool readPaused = false; // True while the protocol does not want input
+    bool closeWhenFlushed = false; // True after closeAfterFlush()
+    bool closing = false; // True once the connection is shutting down
+    bool scheduled = false; // True while queued for service
+};
+
+// One I/O completion port serviced by one thread. Each connection is pinned to a single loop,
+// so protocol state needs no locking; other threads talk to a loop only through post().
+class EventLoop
+{
+public:
+    EventLoop() : port(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1)) {} // Creates the completion port
+    ~EventLoop() // Stops the thread and releases the port
+    {
+        stop(); // Stops the loop thread if running
+        CloseHandle(port); // Closes the completion port
+    }
+
+    EventLoop(const EventLoop &) = delete; // Loops are not copyable
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    void start() { worker = std::thread(&EventLoop::run, this); } // Starts the loop thread
+
+    void stop() // Asks the loop thread to exit and waits for it
+    {
+        if (!worker.joinable()) // Nothing to stop
+            return;
+        PostQueuedCompletionStatus(port, 0, KEY_STOP, nullptr); // Wakes the loop with a stop request
+        worker.join(); // Waits for the thread to finish
+    }
+
+    // Hands an accepted connection to this loop (callable from any thread)
+    bool adopt(Connection *conn)
+    {
+        if (CreateIoCompletionPort(reinterpret_cast<HANDLE>(conn->sock), port, 0, 0) == nullptr) // Binds the socket to this port
+            return false; // Association failed, caller keeps ownership
+        post([this, conn]() { attach(conn); }); // Finishes setup on the loop thread
+        return true; // The loop now owns the connection
+    }
+
+    // Runs a task on the loop thread (callable from any thread)
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(taskMutex); // Protects the task queue
+            tasks.push_back(std::move(task)); // Queues the task
+        }
+        PostQueuedCompletionStatus(port, 0, KEY_TASK, nullptr); // Wakes the loop thread
+    }
+
+    // Runs a task against a connection if it is still alive when the task runs (callable from any thread)
+    void postToConnection(uint64_t id, std::function<void(Connection *)> task)
+    {
+        post([this, id, task]() { // Defers the lookup to the loop thread
+            auto it = connections.find(id); // Looks the connection up by id
+            if (it != connections.end() && !it->second->closing) // Skips connections that already went away
+                task(it->second); // Runs the task
+        });
+    }
+
+    size_t connectionCount() const { return activeCount.load(std::memory_order_relaxed); } // Live connections on this loop
+
+private:
+    friend class Connection; // Connections schedule themselves for service
+
+    static constexpr ULONG_PTR KEY_TASK = 1; // Completion key for posted tasks
+    static constexpr ULONG_PTR KEY_STOP = 2; // Completion key for stop requests
+    static constexpr DWORD MAX_GATHER = 16; // Chunks combined into one WSASend
+
+    // Main loop: waits for completions and dispatches them
+    void run()
+    {
+        while (true) // Runs until a stop request arrives
+        {
+            DWORD bytes = 0; // Bytes transferred by the completed operation
+            ULONG_PTR key = 0; // Completion key
+            OVERLAPPED *overlapped = nullptr; // Completed operation, if any
+            BOOL ok = GetQueuedCompletionStatus(port, &bytes, &key, &overlapped, INFINITE); // Waits for the next event
+
+            if (overlapped != nullptr) // An overlapped socket operation finished
+                complete(reinterpret_cast<Connection::IoOp *>(overlapped), bytes, ok != FALSE); // Dispatches it
+            else if (key == KEY_TASK) // A task was posted
+                runTasks(); // Runs queued tasks
+            else if (key == KEY_STOP) // A stop was requested
+                break; // Leaves the loop
+
+            serviceScheduled(); // Lets connections touched by this event make progress
+        }
+
+        for (auto &entry : connections) // Tears down whatever is left
+        {
+            entry.second->closing = true; // Marks the connection as closing
+            closesocket(entry.second->sock); // Cancels any outstanding I/O
+            entry.second->sock = INVALID_SOCKET; // The destructor must not close it again
+        }
+        connections.clear(); // Connections with pending ops are leaked deliberately; the process is exiting
+    }
+
+    // Runs every task queued by post()
+    void runTasks()
+    {
+        std::deque<std::function<void()>> batch; // Tasks to run now
+        {
+            std::lock_guard<std::mutex> lock(taskMutex); // Protects the task queue
+            batch.swap(tasks); // Takes all queued tasks at once
+        }
+        for (auto &task : batch) // Runs each task
+            task();
+    }
+
+    // Registers a connection with this loop and starts its protocol
+    void attach(Connection *conn)
+    {
+        conn->owner = this; // Records the owning loop
+        conn->connectionId = ++nextId; // Assigns a loop-unique id
+        conn->recvOp.kind = Connection::OP_RECV; // Initializes the receive slot
+        conn->recvOp.conn = conn;
+        conn->sendOp.kind = Connection::OP_SEND; // Initializes the send slot
+        conn->sendOp.conn = conn;
+        conn->rxBuffer.resize(Connection::RECV_BUFFER_SIZE); // Allocates the receive buffer
+        connections[conn->connectionId] = conn; // Registers the connection
+        activeCount.fetch_add(1, std::memory_order_relaxed); // Counts it as active
+        Metrics::add(Metrics::CONNECTIONS_OPENED); // Counts it for the stats report
+        conn->onStart(); // Lets the protocol send its greeting
+        conn->schedule(); // Starts receiving and flushes the greeting
+    }
+
+    // Handles one finished overlapped operation
+    void complete(Connection::IoOp *op, DWORD bytes, bool ok)
+    {
+        Connection *conn = op->conn; // Connection that issued the operation
+        op->pending = false; // The kernel has released the slot
+
+        if (op->kind == Connection::OP_RECV) // A receive finished
+        {
+            if (!ok || bytes == 0) // Error or orderly disconnect from the peer
+                conn->closing = true; // Starts teardown
+            else
+            {
+                Metrics::add(Metrics::BYTES_IN, bytes); // Counts received bytes
+                conn->rxLength += bytes; // Appends the new bytes
+                conn->rxDirty = true; // Marks them for delivery
+            }
+        }
+        else // A send finished
+        {
+            if (!ok) // The send failed
+                conn->closing = true; // Starts teardown
+            else
+            {
+                Metrics::add(Metrics::BYTES_OUT, bytes); // Counts sent bytes
+                consumeSent(conn, bytes); // Drops acknowledged bytes from the queue
+                if (!conn->closing) // Still alive
+                    conn->onWritable(); // Lets the protocol produce more data
+            }
+        }
+        conn->schedule(); // Services the connection after this event
+    }
+
+    // Removes sent bytes from the front of the send queue
+    void consumeSent(Connection *conn, size_t bytes)
+    {
+        conn->txBytes -= bytes; // Updates the queued byte count
+        conn->txSent += bytes; // Stream offset reached by the peer's side
+        while (bytes > 0) // Walks the fully or partially sent chunks
+        {
+            Connection::TxItem &front = conn->txQueue.front(); // Oldest queued entry
+            uint64_t left = front.remaining(conn->txOffset); // Unsent part of the front entry
+            if (bytes < left) // Front entry was only partially sent
+            {
+                if (front.file) // File ranges advance their own offset
+                {
+                    front.fileOffset += bytes;
+                    front.fileLength -= bytes;
+                }
+                else
+                    conn->txOffset += bytes; // Remembers how far it got
+                return;
+            }
+            bytes -= left; // Front chunk is done
+            conn->txQueue.pop_front(); // Drops it
+            conn->txOffset = 0; // Next chunk starts from its beginning
+        }
+    }
+
+    // Services every connection scheduled during the last event
+    void serviceScheduled()
+    {
+        while (!ready.empty()) // Servicing may schedule more work
+        {
+            Connection *conn = ready.front(); // Takes the next connection
+            ready.pop_front(); // Removes it from the queue
+            conn->scheduled = false; // Allows it to be scheduled again
+            service(conn); // Drives its I/O
+        }
+    }
+
+    // Delivers input, issues I/O and reaps closed connections
+    void service(Connection *conn)
+    {
+        if (!conn->closing && !conn->readPaused && conn->rxDirty) // Unseen input is waiting
+        {
+            conn->rxDirty = false; // The protocol is about to see it
+            size_t used = conn->onData(conn->rxBuffer.data(), conn->rxLength); // Hands the input to the protocol
+            if (used > 0) // Some input was consumed
+            {
+                conn->rxLength -= used; // Shrinks the buffered input
+                memmove(conn->rxBuffer.data(), conn->rxBuffer.data() + used, conn->rxLength); // Compacts the buffer
+            }
+        }
+
+        if (!conn->closing) // Still alive after the protocol ran
+        {
+            postSend(conn); // Flushes queued output
+            if (conn->closeWhenFlushed && conn->txQueue.empty()) // Everything was sent before a graceful close
+                conn->closing = true; // Starts teardown
+        }
+        if (!conn->closing) // Still alive
+            postRecv(conn); // Keeps a receive outstanding
+
+        if (conn->closing) // Tearing down
+        {
+            if (conn->sock != INVALID_SOCKET) // Socket still open
+            {
+                closesocket(conn->sock); // Cancels outstanding operations
+                conn->sock = INVALID_SOCKET; // Marks it closed
+            }
+            if (!conn->recvOp.pending && !conn->sendOp.pending) // The kernel no longer references the connection
+            {
+                connections.erase(conn->connectionId); // Unregisters it
+                activeCount.fetch_sub(1, std::memory_order_relaxed); // Counts it as gone
+                Metrics::add(Metrics::CONNECTIONS_CLOSED); // Counts it for the stats report
+                conn->onClosed(); // Notifies the protocol
+                delete conn; // Frees the connection
+            }
+        }
+    }
+
+    // Keeps one overlapped receive outstanding
+    void postRecv(Connection *conn)
+    {
+        if (conn->recvOp.pending || conn->readPaused) // Already receiving, or input not wanted
+            return;
+        if (conn->rxLength == conn->rxBuffer.size()) // Buffer full of input the protocol cannot parse
+        {
+            conn->closing = true; // Protocol violation, drops the client
+            return;
+        }
+
+        WSABUF buf; // Describes the free part of the buffer
+        buf.buf = conn->rxBuffer.data() + conn->rxLength; // Writes after buffered input
+        buf.len = static_cast<ULONG>(conn->rxBuffer.size() - conn->rxLength); // Uses the remaining space
+        DWORD flags = 0; // No special receive flags
+        Metrics::Timer timer(Metrics::SOCKET_NS); // Time in Winsock
+        memset(&conn->recvOp.overlapped, 0, sizeof(OVERLAPPED)); // Resets the OVERLAPPED for reuse
+        conn->recvOp.pending = true; // The kernel will own the slot
+        if (WSARecv(conn->sock, &buf, 1, nullptr, &flags, &conn->recvOp.overlapped, nullptr) == SOCKET_ERROR &&
+            WSAGetLastError() != WSA_IO_PENDING) // Failed without queuing a completion
+        {
+            conn->recvOp.pending = false; // No completion will arrive
+            conn->closing = true; // Starts teardown
+        }
+    }
+
+    // Sends up to MAX_GATHER queued chunks with one overlapped WSASend, or the front file range with TransmitFile
+    void postSend(Connection *conn)
+    {
+        if (conn->sendOp.pending || conn->txQueue.empty()) // Already sending, or nothing to send
+            return;
+
+        memset(&conn->sendOp.overlapped, 0, sizeof(OVERLAPPED)); // Resets the OVERLAPPED for reuse
+        Metrics::Timer timer(Metrics::SOCKET_NS); // Time in Winsock (TransmitFile may read the file synchronously)
+        Connection::TxItem &front = conn->txQueue.front(); // Oldest queued entry
+        if (front.file) // A file range: the kernel reads the page cache straight into the socket
+        {
+            DWORD length = static_cast<DWORD>(std::min<uint64_t>(front.fileLength, Connection::MAX_TRANSMIT_CHUNK)); // Caps one call
+            conn->sendOp.overlapped.Offset = static_cast<DWORD>(front.fileOffset); // File offset, low half
+            conn->sendOp.overlapped.OffsetHigh = static_cast<DWORD>(front.fileOffset >> 32); // File offset, high half
+            conn->sendOp.pending = true; // The kernel will own the slot
+            if (!TransmitFile(conn->sock, static_cast<HANDLE>(front.file.get()), length, 0, &conn->sendOp.overlapped, nullptr, 0) &&
+                WSAGetLastError() != WSA_IO_PENDING) // Failed without queuing a completion
+            {
+                conn->sendOp.pending = false; // No completion will arrive
+                conn->closing = true; // Starts teardown
+            }
+            return;
+        }
+
+        WSABUF bufs[MAX_GATHER]; // Gather list
+        DWORD count = 0; // Number of entries used
+        for (auto it = conn->txQueue.begin(); it != conn->txQueue.end() && !it->file && count < MAX_GATHER; ++it, ++count) // Gathers chunks up to the next file range
+        {
+            size_t skip = (count == 0) ? conn->txOffset : 0; // Skips bytes already sent from the front chunk
+            bufs[count].buf = const_cast<char *>(it->data) + skip; // Points at the unsent bytes (WSASend does not write)
+            bufs[count].len = static_cast<ULONG>(it->dataLength - skip); // Length of the unsent bytes
+        }
+
+        conn->sendOp.pending = true; // The kernel will own the slot
+        if (WSASend(conn->sock, bufs, count, nullptr, 0, &conn->sendOp.overlapped, nullptr) == SOCKET_ERROR &&
+            WSAGetLastError() != WSA_IO_PENDING) // Failed without queuing a completion
+        {
+            conn->sendOp.pending = false; // No completion will arrive
+            conn->closing = true; // Starts teardown
+        }
+    }
+
+    HANDLE port; // I/O completion port
+    std::thread worker; // Loop thread
+    std::mutex taskMutex; // Protects tasks
+    std::deque<std::function<void()>> tasks; // Tasks posted from other threads
+    std::deque<Connection *> ready; // Connections waiting for service
+    std::unordered_map<uint64_t, Connection *> connections; // Live connections by id
+    uint64_t nextId = 0; // Last assigned connection id
+    std::atomic<size_t> activeCount{0}; // Live connection count, readable from any thread
+};
+
+inline void Connection::schedule() // Queues the connection for service on its loop
+{
+    if (scheduled || owner == nullptr) // Already queued, or not yet adopted
+        return;
+    scheduled = true; // Marks it as queued
+    owner->ready.push_back(this); // Adds it to the loop's service queue
+}
+
+inline void Connection::queueSend(const char *data, size_t length) // Copies data into the send queue
+{
+    queueSend(std::vector<char>(data, data + length)); // Wraps the bytes in a chunk
+}
+
+inline void Connection::queueSend(std::vector<char> &&chunk) // Moves a chunk into the send queue
+{
+    if (closing || chunk.empty()) // Nothing to do
+        return;
+    txBytes += chunk.size(); // Counts the queued bytes
+    txQueue.emplace_back(); // Appends a new entry
+    TxItem &item = txQueue.back(); // The new entry
+    item.bytes = std::move(chunk); // Moves the chunk into it
+    item.data = item.bytes.data(); // Sends from the owned buffer
+    item.dataLength = item.bytes.size();
+    schedule(); // Flushes it after the current event
+}
+
+inline void Connection::queueView(std::shared_ptr<const void> viewOwner, const char *data, size_t length) // Queues memory without copying it
+{
+    if (closing || length == 0) // Nothing to do
+        return;
+    txBytes += length; // Counts the queued bytes
+    txQueue.emplace_back(); // Appends a new entry
+    TxItem &item = txQueue.back(); // The new entry
+    item.owner = std::move(viewOwner); // Keeps the memory alive until sent
+    item.data = data; // Sends straight from the borrowed memory
+    item.dataLength = length;
+    schedule(); // Flushes it after the current event
+}
+
+inline void Connection::queueFile(std::shared_ptr<void> file, uint64_t offset, uint64_t length) // Queues a kernel-sent file range
+{
+    if (closing || length == 0) // Nothing to do
+        return;
+    txBytes += length; // Counts the queued bytes
+    txQueue.emplace_back(); // Appends a new entry
+    txQueue.back().file = std::move(file); // Keeps the file open until the range is sent
+    txQueue.back().fileOffset = offset; // Where the range starts
+    txQueue.back().fileLength = length; // How much of it to send
+    schedule(); // Flushes it after the current event
+}
+
+inline void Connection::pauseReading() // Stops delivering input
+{
+    readPaused = true; // Input stays buffered until resumeReading()
+}
+
+inline void Connection::resumeReading() // Resumes delivering input
+{
+    readPaused = false; // Allows delivery again
+    rxDirty = rxLength > 0; // Redelivers anything buffered while paused
+    schedule(); // Restarts receiving after the current event
+}
+
+inline void Connection::closeAfterFlush() // Closes after the send queue drains
+{
+    closeWhenFlushed = true; // Remembers the request
+    readPaused = true; // Ignores further input
+    schedule(); // Checks the queue after the current event
+}
+
+inline void Connection::close() // Closes without flushing
+{
+    closing = true; // Starts teardown
+    schedule(); // Reaps after the current event
+}
+
+#endif // Ends the header guard
@@ -0,0 +1,105 @@
+#ifndef FILE_IO_H // Prevents multiple inclusions of this header file
+#define FILE_IO_H // Defines the header guard macro
+
+#include <windows.h> // Includes Win32 file functions
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <memory> // Includes shared_ptr for reference-counted handles
+#include <string> // Includes the string library for file names
+
+// Thin helpers over Win32 file handles. Handles are wrapped in shared_ptr<void> so the event loop
+// can keep a file open until the kernel has finished sending from it.
+namespace FileIO
+{
+    typedef std::shared_ptr<void> Handle; // Reference-counted HANDLE, closed with CloseHandle
+
+    // Wraps a raw HANDLE; returns null for INVALID_HANDLE_VALUE
+    inline Handle wrap(HANDLE h)
+    {
+        if (h == INVALID_HANDLE_VALUE) // Open failed
+            return Handle(); // Returns an empty handle
+        return Handle(h, [](void *p) { CloseHandle(static_cast<HANDLE>(p)); }); // Closes when the last reference goes away
+    }
+
+    // Opens an existing file for sequential reading (other readers and writers are allowed)
+    inline Handle openRead(const std::string &path)
+    {
+        return wrap(CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr)); // Opens read-only
+    }
+
+    // Creates (or truncates) a file for writing; flags adds CreateFile flags such as FILE_FLAG_OVERLAPPED
+    inline Handle create(const std::string &path, DWORD flags)
+    {
+        return wrap(CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL | flags, nullptr)); // Opens write-only
+    }
+
+    // Returns the size of an open file, or false on error
+    inline bool sizeOf(const Handle &file, uint64_t &size)
+    {
+        LARGE_INTEGER li; // Receives the size
+        if (!GetFileSizeEx(static_cast<HANDLE>(file.get()), &li)) // Queries the size
+            return false; // Query failed
+        size = static_cast<uint64_t>(li.QuadPart); // Converts to unsigned
+        return true; // Size is valid
+    }
+
+    // Opens (creating if needed) a file for positioned reads and writes; truncate empties it first
+    inline Handle openReadWrite(const std::string &path, bool truncate)
+    {
+        return wrap(CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                                truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)); // Opens read-write
+    }
+
+    // Writes all of data at offset without moving the file pointer
+    inline bool writeAt(const Handle &file, uint64_t offset, const char *data, size_t length)
+    {
+        while (length > 0) // WriteFile may write less than asked
+        {
+            OVERLAPPED ov{}; // Carries the offset for a positioned write on a synchronous handle
+            ov.Offset = static_cast<DWORD>(offset); // Offset, low half
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32); // Offset, high half
+            DWORD put = 0; // Bytes actually written
+            if (!WriteFile(static_cast<HANDLE>(file.get()), data, static_cast<DWORD>(length), &put, &ov) || put == 0) // Writes at the offset
+                return false; // Write failed
+            data += put; // Advances past the written bytes
+            offset += put;
+            length -= put;
+        }
+        return true; // Everything was written
+    }
+
+    // Flushes file data and metadata to stable storage
+    inline bool flush(const Handle &file)
+    {
+        return FlushFileBuffers(static_cast<HANDLE>(file.get())) != FALSE; // Waits for the disk
+    }
+
+    // Cuts an open file down (or extends it) to size bytes
+    inline bool resize(const Handle &file, uint64_t size)
+    {
+        LARGE_INTEGER li; // New end of file
+        li.QuadPart = static_cast<LONGLONG>(size);
+        return SetFilePointerEx(static_cast<HANDLE>(file.get()), li, nullptr, FILE_BEGIN) && SetEndOfFile(static_cast<HANDLE>(file.get())); // Moves the end
+    }
+
+    // Atomically replaces target with source (both on the same volume)
+    inline bool replace(const std::string &source, const std::string &target)
+    {
+        return MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE; // Renames over the target
+    }
+
+    // Reads up to length bytes at offset without moving the file pointer; returns bytes read (0 at EOF or on error)
+    inline size_t readAt(const Handle &file, uint64_t offset, char *buffer, size_t length)
+    {
+        OVERLAPPED ov{}; // Carries the offset for a positioned read on a synchronous handle
+        ov.Offset = static_cast<DWORD>(offset); // Offset, low half
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32); // Offset, high half
+        DWORD got = 0; // Bytes actually read
+        if (!ReadFile(static_cast<HANDLE>(file.get()), buffer, static_cast<DWORD>(length), &got, &ov)) // Reads at the offset
+            return 0; // Error or end of file
+        return got; // Returns bytes read
+    }
+}
+
+#endif // Ends the header guard
@@ -0,0 +1,107 @@
+#ifndef LOCAL_TRANSPORT_H // Prevents multiple inclusions of this header file
+#define LOCAL_TRANSPORT_H // Defines the header guard macro
+
+#include <winsock2.h> // Includes the Winsock 2 library for socket programming
+#include <afunix.h> // Includes AF_UNIX socket addresses
+#include <windows.h> // Includes the temporary directory lookup
+#include <cstring> // Includes strncpy for socket paths
+#include <string> // Includes the string library for socket paths
+
+#ifndef SIO_AF_UNIX_GETPEERPID // Older SDKs lack the peer process query
+#define SIO_AF_UNIX_GETPEERPID _WSAIOR(IOC_VENDOR, 256) // Returns the process ID at the other end of an AF_UNIX socket
+#endif
+
+// Same-host transport: the protocol runs over an AF_UNIX socket instead of loopback TCP.
+//
+// A client on the server's machine connects to a socket file (by default in the temporary
+// directory, named after the port) and speaks the same protocol as over TCP. Because the server
+// knows the client's process, it can also answer 'H' by duplicating the open handle of the
+// selected file into that process; the client then maps the file and copies it from the page cache,
+// so no file data passes through the socket at all. Windows has no SCM_RIGHTS, so the handle is
+// handed over with DuplicateHandle and its value sent as an ordinary control message.
+//
+//   'H'  c->s                                              selected file as a handle in the client's process
+//        s->c  status(1) [handle(8) size(8)]               status 0 = not a same-host connection, or no such file
+//
+// Like the rest of protocol v1, integers are in host byte order. The client owns the handle and
+// closes it once the reply has been sent; if the connection closes before that, the server closes
+// the client's copy itself (DUPLICATE_CLOSE_SOURCE), since the client never learned its value.
+//
+// A handoff sends no file data over any socket, so it is deliberately not throttled by the
+// bandwidth scheduler and not added to the client's byte counts; it shows up as a download and in
+// local_handoffs.
+namespace LocalTransport
+{
+    // Socket file servers on this port listen on unless told otherwise
+    inline std::string defaultPath(int port)
+    {
+        char dir[MAX_PATH + 1] = {0}; // Temporary directory, with a trailing backslash
+        if (GetTempPathA(sizeof(dir), dir) == 0) // No temporary directory: uses the current one
+            dir[0] = 0;
+        return std::string(dir) + "fileserver-" + std::to_string(port) + ".sock";
+    }
+
+    // True if host names this machine, so the socket file may be tried first
+    inline bool isLocalHost(const std::string &host)
+    {
+        return host == "127.0.0.1" || host == "localhost" || host == "::1";
+    }
+
+    // Fills the address of the socket file at path; returns false if the path is too long
+    inline bool addressOf(const std::string &path, sockaddr_un &addr)
+    {
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) // Needs the terminator
+            return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        return true;
+    }
+
+    // Listens on a fresh socket file at path (a stale one from an earlier run is removed)
+    inline SOCKET listenOn(const std::string &path)
+    {
+        sockaddr_un addr; // Socket file address
+        if (!addressOf(path, addr))
+            return INVALID_SOCKET;
+        SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0); // Creates an AF_UNIX socket
+        if (sock == INVALID_SOCKET) // AF_UNIX unsupported (Windows before 10 1803)
+            return INVALID_SOCKET;
+        DeleteFileA(path.c_str()); // bind() fails on an existing file
+        if (bind(sock, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == SOCKET_ERROR || listen(sock, SOMAXCONN) == SOCKET_ERROR)
+        {
+            closesocket(sock); // Releases the socket
+            return INVALID_SOCKET;
+        }
+        return sock;
+    }
+
+    // Connects to the socket file at path; returns INVALID_SOCKET if no server listens there
+    inline SOCKET connectTo(const std::string &path)
+    {
+        sockaddr_un addr; // Socket file address
+        if (!addressOf(path, addr))
+            return INVALID_SOCKET;
+        SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0); // Creates an AF_UNIX socket
+        if (sock == INVALID_SOCKET) // AF_UNIX unsupported
+            return INVALID_SOCKET;
+        if (connect(sock, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == SOCKET_ERROR) // No server, or a stale file
+        {
+            closesocket(sock); // Releases the unconnected socket
+            return INVALID_SOCKET;
+        }
+        return sock;
+    }
+
+    // Process at the other end of an accepted AF_UNIX socket (0 if unknown)
+    inline DWORD peerProcess(SOCKET sock)
+    {
+        ULONG pid = 0; // Peer process ID
+        DWORD bytes = 0; // Bytes returned
+        if (WSAIoctl(sock, SIO_AF_UNIX_GETPEERPID, nullptr, 0, &pid, sizeof(pid), &bytes, nullptr, nullptr) == SOCKET_ERROR)
+            return 0;
+        return static_cast<DWORD>(pid);
+    }
+}
+
+#endif // Ends the header guard
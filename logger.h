@@ -0,0 +1,143 @@
+#ifndef LOGGER_H // Prevents multiple inclusions of this header file
+#define LOGGER_H // Defines the header guard macro
+
+#include <atomic> // Includes atomics for the level and drop counter
+#include <condition_variable> // Includes condition_variable to wake the writer
+#include <iostream> // Includes cout and cerr, written by the writer thread only
+#include <mutex> // Includes mutex for the line queue
+#include <sstream> // Includes ostringstream for the LOG_* macros
+#include <string> // Includes the string library for log lines
+#include <thread> // Includes the writer thread
+#include <vector> // Includes the vector library for the line queue
+
+// Asynchronous, level-filtered console log. Callers format into a private string and append it to a
+// queue (one short lock, no I/O); a writer thread prints the queued lines in order. A line below the
+// level costs one relaxed load: the LOG_* macros do not even format it. If the console cannot keep
+// up, lines beyond MAX_QUEUED are dropped and counted rather than slowing transfers down.
+class Logger
+{
+public:
+    enum class Level
+    {
+        Debug, // Per-request detail
+        Info, // Completed transfers and session events
+        Warn, // Misbehaving clients, rejected data
+        Error // Server-side failures
+    };
+
+    static constexpr size_t MAX_QUEUED = 10000; // Lines waiting before new ones are dropped
+
+    static Logger &instance() // The process-wide log
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    static std::atomic<int> &threshold() // Lowest level printed
+    {
+        static std::atomic<int> level{static_cast<int>(Level::Info)};
+        return level;
+    }
+
+    static void setLevel(Level level) { threshold().store(static_cast<int>(level), std::memory_order_relaxed); }
+
+    static bool enabled(Level level) { return static_cast<int>(level) >= threshold().load(std::memory_order_relaxed); }
+
+    // Parses "debug", "info", "warn" or "error"; returns false for anything else
+    static bool parseLevel(const std::string &name, Level &level)
+    {
+        static const char *names[] = {"debug", "info", "warn", "error"};
+        for (int i = 0; i < 4; ++i)
+            if (name == names[i])
+            {
+                level = static_cast<Level>(i);
+                return true;
+            }
+        return false;
+    }
+
+    // Queues one line (without the trailing newline)
+    void write(Level level, std::string line)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.size() >= MAX_QUEUED) // Console is behind
+            {
+                ++dropped;
+                return;
+            }
+            queue.push_back({level, std::move(line)});
+        }
+        wake.notify_one();
+    }
+
+    ~Logger() // Prints what is still queued
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+
+private:
+    struct Line
+    {
+        Level level; // Severity
+        std::string text; // Formatted message
+    };
+
+    Logger() : writer(&Logger::run, this) {}
+
+    // Writer thread: prints batches of lines until the logger is destroyed
+    void run()
+    {
+        std::vector<Line> batch; // Lines being printed
+        while (true)
+        {
+            size_t lost = 0; // Lines dropped since the last batch
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) // Stopping with nothing left
+                    return;
+                batch.swap(queue); // Takes everything at once
+                lost = dropped;
+                dropped = 0;
+            }
+            for (const Line &line : batch) // Prints outside the lock
+                (line.level >= Level::Warn ? std::cerr : std::cout) << line.text << "\n";
+            if (lost > 0)
+                std::cerr << "[Logger] " << lost << " lines dropped.\n";
+            std::cout.flush();
+            batch.clear();
+        }
+    }
+
+    std::mutex mutex; // Protects queue, dropped and stopping
+    std::condition_variable wake; // Signals new lines
+    std::vector<Line> queue; // Lines waiting to be printed
+    size_t dropped = 0; // Lines dropped since the last batch
+    bool stopping = false; // Set by the destructor
+    std::thread writer; // Prints the lines (declared last: starts after the members above exist)
+};
+
+// Formats a streamed expression and queues it, if the level is enabled
+#define LOG_AT(level, expr)                                       \
+    do                                                            \
+    {                                                             \
+        if (Logger::enabled(level))                               \
+        {                                                         \
+            std::ostringstream logLine_;                          \
+            logLine_ << expr;                                     \
+            Logger::instance().write(level, logLine_.str());      \
+        }                                                         \
+    } while (0)
+
+#define LOG_DEBUG(expr) LOG_AT(Logger::Level::Debug, expr) // Per-request detail
+#define LOG_INFO(expr) LOG_AT(Logger::Level::Info, expr) // Completed transfers and session events
+#define LOG_WARN(expr) LOG_AT(Logger::Level::Warn, expr) // Misbehaving clients
+#define LOG_ERROR(expr) LOG_AT(Logger::Level::Error, expr) // Server-side failures
+
+#endif // Ends the header guard
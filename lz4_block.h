@@ -0,0 +1,187 @@
+#ifndef LZ4_BLOCK_H // Prevents multiple inclusions of this header file
+#define LZ4_BLOCK_H // Defines the header guard macro
+
+#include <cstddef> // Includes size_t
+#include <cstdint> // Includes standard integer types like uint32_t
+#include <cstring> // Includes memcpy and memset
+
+// Minimal single-block codec for the LZ4 block format (the format of LZ4_compress_default and
+// LZ4_decompress_safe), so output interoperates with the reference library. Greedy matching with a
+// 4K-entry hash table: fast and small rather than maximal ratio. Decompression checks every bound
+// and rejects malformed input instead of reading or writing outside the buffers.
+namespace LZ4Block
+{
+    static constexpr int HASH_LOG = 12; // 4096-entry match table
+    static constexpr size_t MIN_MATCH = 4; // Shortest encodable match
+    static constexpr size_t LAST_LITERALS = 5; // The last 5 bytes are always literals
+    static constexpr size_t MF_LIMIT = 12; // The last match starts at least 12 bytes before the end
+    static constexpr size_t MAX_OFFSET = 65535; // Farthest back a match may reach
+
+    // Largest output compress() can produce for length input bytes
+    inline size_t bound(size_t length)
+    {
+        return length + length / 255 + 16;
+    }
+
+    inline uint32_t read32(const uint8_t *p) // Unaligned 32-bit load
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline uint32_t hash(uint32_t sequence) // Multiplicative hash of 4 input bytes
+    {
+        return (sequence * 2654435761u) >> (32 - HASH_LOG);
+    }
+
+    // Writes a length continuation (a run of 255s and a final byte); returns the advanced output pointer or null if it does not fit
+    inline uint8_t *putLength(uint8_t *op, uint8_t *end, size_t length)
+    {
+        while (length >= 255) // Full bytes
+        {
+            if (op >= end)
+                return nullptr;
+            *op++ = 255;
+            length -= 255;
+        }
+        if (op >= end)
+            return nullptr;
+        *op++ = static_cast<uint8_t>(length); // Remainder
+        return op;
+    }
+
+    // Compresses src into dst; returns the compressed size, or 0 if it does not fit in capacity
+    inline size_t compress(const char *src, size_t length, char *dst, size_t capacity)
+    {
+        const uint8_t *in = reinterpret_cast<const uint8_t *>(src); // Input bytes
+        uint8_t *op = reinterpret_cast<uint8_t *>(dst); // Output cursor
+        uint8_t *end = op + capacity; // Output limit
+        size_t anchor = 0; // Start of pending literals
+        uint32_t table[1 << HASH_LOG]; // Last position seen for each hash
+        memset(table, 0, sizeof(table));
+
+        if (length >= MF_LIMIT + 1) // Shorter blocks are stored as literals only
+        {
+            size_t matchStartLimit = length - MF_LIMIT; // Matches must start before this
+            size_t matchEndLimit = length - LAST_LITERALS; // and end before this
+            size_t ip = 1; // Position 0 is only a candidate
+            table[hash(read32(in))] = 0;
+            while (ip < matchStartLimit) // Searches for matches
+            {
+                uint32_t sequence = read32(in + ip); // Next 4 bytes
+                uint32_t h = hash(sequence);
+                size_t ref = table[h]; // Earlier position with the same hash
+                table[h] = static_cast<uint32_t>(ip);
+                if (ref >= ip || ip - ref > MAX_OFFSET || read32(in + ref) != sequence) // No usable match
+                {
+                    ip += 1 + ((ip - anchor) >> 6); // Skips faster through incompressible data
+                    continue;
+                }
+
+                size_t matchLength = MIN_MATCH; // Extends the match forwards
+                while (ip + matchLength < matchEndLimit && in[ref + matchLength] == in[ip + matchLength])
+                    ++matchLength;
+
+                size_t literals = ip - anchor; // Literals before the match
+                if (static_cast<size_t>(end - op) < 1 + literals + literals / 255 + 1 + 2) // Token, literals, offset
+                    return 0;
+                uint8_t *token = op++; // Filled in below
+                *token = static_cast<uint8_t>((literals < 15 ? literals : 15) << 4);
+                if (literals >= 15 && !(op = putLength(op, end, literals - 15)))
+                    return 0;
+                if (static_cast<size_t>(end - op) < literals + 2)
+                    return 0;
+                memcpy(op, in + anchor, literals); // Literal bytes
+                op += literals;
+                size_t offset = ip - ref; // Match distance
+                *op++ = static_cast<uint8_t>(offset); // Little-endian offset
+                *op++ = static_cast<uint8_t>(offset >> 8);
+                size_t extra = matchLength - MIN_MATCH; // Encoded match length
+                *token |= static_cast<uint8_t>(extra < 15 ? extra : 15);
+                if (extra >= 15 && !(op = putLength(op, end, extra - 15)))
+                    return 0;
+
+                ip += matchLength; // Continues after the match
+                anchor = ip;
+                if (ip < matchStartLimit) // Remembers a position inside the match for the next search
+                    table[hash(read32(in + ip - 2))] = static_cast<uint32_t>(ip - 2);
+            }
+        }
+
+        size_t literals = length - anchor; // Final literal run
+        if (static_cast<size_t>(end - op) < 1 + literals + literals / 255 + 1)
+            return 0;
+        *op++ = static_cast<uint8_t>((literals < 15 ? literals : 15) << 4);
+        if (literals >= 15 && !(op = putLength(op, end, literals - 15)))
+            return 0;
+        if (static_cast<size_t>(end - op) < literals)
+            return 0;
+        if (literals > 0) // Empty input has no literals
+            memcpy(op, in + anchor, literals);
+        op += literals;
+        return static_cast<size_t>(op - reinterpret_cast<uint8_t *>(dst)); // Compressed size
+    }
+
+    // Decompresses src into exactly length bytes of dst; returns false on malformed input
+    inline bool decompress(const char *src, size_t srcLength, char *dst, size_t length)
+    {
+        const uint8_t *ip = reinterpret_cast<const uint8_t *>(src); // Input cursor
+        const uint8_t *inEnd = ip + srcLength; // Input limit
+        uint8_t *op = reinterpret_cast<uint8_t *>(dst); // Output cursor
+        uint8_t *outEnd = op + length; // Output limit
+        while (ip < inEnd) // One sequence per iteration
+        {
+            uint8_t token = *ip++; // Literal and match lengths
+            size_t literals = token >> 4; // Literal run length
+            if (literals == 15) // Continued
+            {
+                uint8_t b;
+                do
+                {
+                    if (ip >= inEnd)
+                        return false;
+                    b = *ip++;
+                    literals += b;
+                } while (b == 255);
+            }
+            if (literals > static_cast<size_t>(inEnd - ip) || literals > static_cast<size_t>(outEnd - op)) // Overruns a buffer
+                return false;
+            if (literals > 0) // Copies the literals
+                memcpy(op, ip, literals);
+            ip += literals;
+            op += literals;
+            if (ip == inEnd) // The last sequence has no match
+                break;
+
+            if (inEnd - ip < 2) // Truncated offset
+                return false;
+            size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8); // Match distance
+            ip += 2;
+            if (offset == 0 || offset > static_cast<size_t>(op - reinterpret_cast<uint8_t *>(dst))) // Points before the output
+                return false;
+            size_t matchLength = token & 15; // Match length
+            if (matchLength == 15) // Continued
+            {
+                uint8_t b;
+                do
+                {
+                    if (ip >= inEnd)
+                        return false;
+                    b = *ip++;
+                    matchLength += b;
+                } while (b == 255);
+            }
+            matchLength += MIN_MATCH;
+            if (matchLength > static_cast<size_t>(outEnd - op)) // Overruns the output
+                return false;
+            const uint8_t *ref = op - offset; // Source of the copy (may overlap the destination)
+            for (size_t i = 0; i < matchLength; ++i) // Byte-wise so overlapping runs repeat correctly
+                op[i] = ref[i];
+            op += matchLength;
+        }
+        return op == outEnd; // Must produce exactly the announced length
+    }
+}
+
+#endif // Ends the header guard
@@ -0,0 +1,254 @@
+#ifndef MERKLE_H // Prevents multiple inclusions of this header file
+#define MERKLE_H // Defines the header guard macro
+
+#include <algorithm> // Includes std::min
+#include <atomic> // Includes atomics for the shared chunk counter
+#include <condition_variable> // Includes condition_variable for the end of a hashing pass
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <cstring> // Includes memcpy for interior nodes
+#include <functional> // Includes std::function for helper threads and waiters
+#include <map> // Includes map for the tree cache
+#include <memory> // Includes shared_ptr for passes and cached trees
+#include <mutex> // Includes mutex for the tree cache
+#include <string> // Includes the string library for paths
+#include <thread> // Includes threads for parallel hashing
+#include <vector> // Includes the vector library for leaves and buffers
+#include "content_cache.h" // Includes FileIdentity for revalidating cached trees
+#include "crc32.h" // Includes the shared CRC32 engine
+#include "delta_sync.h" // Includes the 64-bit chunk hash
+#include "file_io.h" // Includes positioned file reads
+#include "metrics.h" // Includes the hashing time counter
+#include "work_pool.h" // Includes the shared workers the server hashes on
+
+// Chunked integrity for large files: a hash tree over fixed-size chunks ('M').
+//
+// A file is split into CHUNK_SIZE chunks (the last one may be shorter). Each leaf is the 64-bit
+// DeltaSync hash of one chunk, each interior node hashes its two children (an odd node is carried up
+// unchanged) and the root identifies the whole file. Chunks are hashed on several threads, so
+// hashing a multi-gigabyte file is limited by the disk rather than one core. The server hashes on its
+// shared WorkPool, and requests for a file that is already being hashed wait for that pass.
+//
+// The client fetches the tree before the data, checks the leaves against the root, and then checks
+// every ranged download ('G') of one chunk against its leaf as it arrives. A damaged chunk is caught
+// at once and only that chunk is fetched again. Kept chunks of an interrupted download are checked
+// the same way, in parallel, instead of by a whole-file CRC at the end.
+//
+//   'M'  c->s                                                     tree of the file selected with 'O'
+//        s->c  status(1) [size(8) chunkSize(4) count(4) root(8) leaf(8)*count]   status 0 = not available
+//
+// Like the rest of protocol v1, integers are in host byte order.
+namespace Merkle
+{
+    static constexpr uint32_t CHUNK_SIZE = 4 * 1024 * 1024; // Bytes per leaf (matches the client's range size)
+    static constexpr uint32_t MAX_LEAVES = 1 << 20; // Largest tree sent (4 TiB at the default chunk size)
+
+    // Hash tree of one file
+    struct Tree
+    {
+        uint64_t size = 0; // File size in bytes
+        uint32_t chunkSize = CHUNK_SIZE; // Bytes per leaf
+        std::vector<uint64_t> leaves; // Hash of each chunk, in file order
+        std::vector<uint32_t> crcs; // CRC32 of each chunk (computed alongside, not sent)
+        uint64_t root = 0; // Hash over the leaves
+    };
+
+    inline uint64_t chunkCount(uint64_t size, uint32_t chunkSize) // Leaves of a file of size bytes
+    {
+        return (size + chunkSize - 1) / chunkSize;
+    }
+
+    inline uint32_t chunkLength(const Tree &tree, size_t index) // Bytes in chunk index
+    {
+        return static_cast<uint32_t>(std::min<uint64_t>(tree.chunkSize, tree.size - static_cast<uint64_t>(index) * tree.chunkSize));
+    }
+
+    inline uint64_t leafHash(const char *data, size_t length) // Leaf of one chunk
+    {
+        return DeltaSync::hash64(data, length);
+    }
+
+    // Root over leaves; interior nodes are tagged so they can never equal the hash of a chunk
+    inline uint64_t rootOf(std::vector<uint64_t> level)
+    {
+        if (level.empty()) // Empty file
+            return leafHash(nullptr, 0);
+        while (level.size() > 1) // One level up per pass
+        {
+            std::vector<uint64_t> up; // Parents
+            for (size_t i = 0; i < level.size(); i += 2)
+            {
+                if (i + 1 == level.size()) // Odd node: carried up
+                {
+                    up.push_back(level[i]);
+                    break;
+                }
+                char node[17] = {1}; // Tag, left child, right child
+                memcpy(node + 1, &level[i], 8);
+                memcpy(node + 9, &level[i + 1], 8);
+                up.push_back(DeltaSync::hash64(node, sizeof(node)));
+            }
+            level.swap(up);
+        }
+        return level[0];
+    }
+
+    // CRC32 of the whole file, combined from the chunk CRCs
+    inline uint32_t fileCrc(const Tree &tree)
+    {
+        uint32_t crc = 0; // Running CRC
+        for (size_t i = 0; i < tree.crcs.size(); ++i)
+            crc = CRC32::combine(crc, tree.crcs[i], chunkLength(tree, i));
+        return crc;
+    }
+
+    typedef std::function<void(std::function<void()>)> Spawn; // Runs a task on another thread
+
+    // State of one hashing pass, shared with its helpers (one may start after the pass is over)
+    struct Pass
+    {
+        std::atomic<size_t> next{0}; // Next chunk to claim
+        std::atomic<size_t> done{0}; // Chunks hashed or skipped
+        std::atomic<bool> failed{false}; // Set by the first failed read
+        std::mutex mutex; // Protects the wait for done
+        std::condition_variable finished; // Signals the last chunk
+    };
+
+    // Hashes the first size bytes of file with up to threads - 1 helpers started through spawn; this
+    // thread works too, so it finishes even if no helper ever runs. Returns false if a read fails.
+    inline bool build(const FileIO::Handle &file, uint64_t size, unsigned threads, const Spawn &spawn, Tree &tree, uint32_t chunkSize = CHUNK_SIZE)
+    {
+        tree.size = size;
+        tree.chunkSize = chunkSize;
+        size_t count = static_cast<size_t>(chunkCount(size, chunkSize)); // Leaves to compute
+        tree.leaves.assign(count, 0);
+        tree.crcs.assign(count, 0);
+        auto pass = std::make_shared<Pass>(); // Outlives this call for late helpers
+        const FileIO::Handle *source = &file; // Only touched while chunks are left
+        Tree *target = &tree;
+        auto work = [pass, source, target, count]() { // Claims chunks until none are left
+            std::vector<char> buffer; // One chunk, allocated on the first claim
+            for (size_t i; (i = pass->next++) < count;)
+            {
+                if (!pass->failed) // After a failure, chunks are only counted
+                {
+                    uint32_t length = chunkLength(*target, i); // Bytes in this chunk
+                    buffer.resize(std::max<size_t>(buffer.size(), length));
+                    if (FileIO::readAt(*source, static_cast<uint64_t>(i) * target->chunkSize, buffer.data(), length) != length) // Short read: the file changed
+                        pass->failed = true;
+                    else
+                    {
+                        target->leaves[i] = leafHash(buffer.data(), length);
+                        target->crcs[i] = CRC32::update(0, buffer.data(), length);
+                    }
+                }
+                if (++pass->done == count) // Last chunk: releases the caller
+                {
+                    std::lock_guard<std::mutex> lock(pass->mutex);
+                    pass->finished.notify_all();
+                }
+            }
+        };
+        for (unsigned t = 1; t < std::min<size_t>(std::max(threads, 1u), count); ++t)
+            spawn(work);
+        work();
+        {
+            std::unique_lock<std::mutex> lock(pass->mutex); // Waits for chunks helpers still hash
+            pass->finished.wait(lock, [&]() { return pass->done == count; });
+        }
+        tree.root = rootOf(tree.leaves);
+        return !pass->failed;
+    }
+
+    // Hashes the first size bytes of file on up to threads threads of its own; returns false if a read fails
+    inline bool build(const FileIO::Handle &file, uint64_t size, unsigned threads, Tree &tree, uint32_t chunkSize = CHUNK_SIZE)
+    {
+        std::vector<std::thread> pool; // Helpers
+        bool ok = build(file, size, threads, [&](std::function<void()> task) { pool.emplace_back(std::move(task)); }, tree, chunkSize);
+        for (auto &t : pool)
+            t.join();
+        return ok;
+    }
+
+    // Trees of recently requested files, rebuilt when the file changes
+    class Cache
+    {
+    public:
+        typedef std::function<void(bool ok, std::shared_ptr<const Tree> tree)> Done; // Receives a tree (null unless ok)
+
+        // Hashes on pool with up to threads of its workers per file
+        Cache(WorkPool &pool, unsigned threads) : pool(pool), threads(std::max<unsigned>(1, std::min<size_t>(threads, pool.size()))) {}
+
+        // Calls done with the tree of the file at path, or false if it cannot be read or has too many
+        // chunks. Hashes on the calling thread (a worker) when the tree is missing or stale; if the same
+        // version is already being hashed, done is called by that pass instead and get returns at once.
+        void get(const std::string &path, Done done)
+        {
+            FileIO::Handle file = FileIO::openRead(path); // Opens the file to read its identity
+            FileIdentity id; // Current version
+            if (!file || !FileIdentity::of(file, id) || chunkCount(id.size, CHUNK_SIZE) > MAX_LEAVES) // Missing, unreadable or too large
+            {
+                done(false, nullptr);
+                return;
+            }
+            bool leader = false; // True if this call's pass serves other waiters
+            std::shared_ptr<const Tree> cached; // Tree of the same version, if kept
+            {
+                std::lock_guard<std::mutex> lock(mutex); // Protects the cache
+                auto it = trees.find(path);
+                if (it != trees.end() && it->second.first == id) // Same version as on disk
+                    cached = it->second.second;
+                auto pending = building.find(path); // Pass already hashing this path
+                if (!cached && pending != building.end() && pending->second.first == id) // Same version: waits for that pass
+                {
+                    pending->second.second.push_back(std::move(done));
+                    return;
+                }
+                if (!cached && pending == building.end()) // Others asking meanwhile wait for this pass
+                {
+                    building[path].first = id;
+                    leader = true;
+                }
+            }
+            if (cached) // Same version as on disk
+            {
+                done(true, cached);
+                return;
+            }
+            auto tree = std::make_shared<Tree>(); // Tree being built
+            bool ok; // False if the file changed while it was read
+            {
+                Metrics::Timer timer(Metrics::HASH_NS); // Hashing work (wall time of the parallel pass)
+                ok = build(file, id.size, threads, [this](std::function<void()> task) { pool.post(std::move(task)); }, *tree);
+            }
+            std::vector<Done> waiters; // Calls that asked for the same version meanwhile
+            {
+                std::lock_guard<std::mutex> lock(mutex); // Protects the cache
+                if (ok)
+                {
+                    if (trees.size() >= MAX_TREES && !trees.count(path)) // Full: forgets one tree
+                        trees.erase(trees.begin());
+                    trees[path] = std::make_pair(id, std::shared_ptr<const Tree>(tree));
+                }
+                if (leader)
+                {
+                    waiters.swap(building[path].second);
+                    building.erase(path);
+                }
+            }
+            done(ok, ok ? tree : nullptr);
+            for (Done &waiter : waiters)
+                waiter(ok, ok ? tree : nullptr);
+        }
+
+    private:
+        static constexpr size_t MAX_TREES = 64; // Trees kept (at most 8 MiB each)
+
+        WorkPool &pool; // Runs the helpers of each pass
+        const unsigned threads; // Hashing threads per build, the caller included
+        std::mutex mutex; // Protects trees and building
+        std::map<std::string, std::pair<FileIdentity, std::shared_ptr<const Tree>>> trees; // By path, with the version they describe
+        std::map<std::string, std::pair<FileIdentity, std::vector<Done>>> building; // Passes in progress, with their waiters
+    };
+}
+
+#endif // Ends the header guard
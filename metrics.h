@@ -0,0 +1,211 @@
+#ifndef METRICS_H // Prevents multiple inclusions of this header file
+#define METRICS_H // Defines the header guard macro
+
+#include <atomic> // Includes atomics for the shard counters
+#include <chrono> // Includes clocks for timers
+#include <cstddef> // Includes size_t
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <sstream> // Includes ostringstream for the JSON report
+#include <string> // Includes the string library for the JSON report
+
+// Process-wide counters and latency histograms.
+//
+// Every thread that records gets its own shard (up to MAX_SHARDS), so the hot path is an uncontended
+// relaxed load and store on memory no other thread writes: no locks, no shared cache lines. Readers
+// sum the shards without stopping the writers, so a report is a consistent-enough snapshot, not an
+// atomic one. Threads beyond MAX_SHARDS share one overflow shard updated with atomic adds. Shards are
+// never released, so the counts of threads that exit are kept.
+//
+// Histograms use four sub-buckets per power of two, so a percentile is within 25% of the true value.
+namespace Metrics
+{
+    enum Counter
+    {
+        BYTES_IN, // Bytes received from clients
+        BYTES_OUT, // Bytes sent to clients (including TransmitFile)
+        CONNECTIONS_OPENED, // Connections accepted
+        CONNECTIONS_CLOSED, // Connections torn down
+        DOWNLOADS, // Downloads completed (v1 files and ranges, v2 streams)
+        UPLOADS, // Uploads stored (v1, delta, v2 streams)
+        CRC_MISMATCHES, // Received data whose CRC disagreed with the client's
+        HASH_NS, // Time spent computing checksums and chunk signatures
+        SOCKET_NS, // Time spent in Winsock calls on the event loops
+        DISK_NS, // Time spent blocked in file reads, writes, flushes and renames
+        MEMORY_WAITS, // Times a connection was refused transfer memory and had to wait
+        BANDWIDTH_WAITS, // Times a connection was refused bandwidth and had to wait
+        LOCAL_HANDOFFS, // Files handed to same-host clients as a handle instead of sent
+        COUNTER_COUNT // Number of counters
+    };
+
+    enum Histogram
+    {
+        DOWNLOAD_US, // Duration of a download, request to last byte queued
+        UPLOAD_US, // Duration of an upload, request to file published
+        DISK_WRITE_US, // Latency of one pipeline buffer write, issue to completion
+        HISTOGRAM_COUNT // Number of histograms
+    };
+
+    static constexpr size_t MAX_SHARDS = 128; // Threads with a private shard
+    static constexpr size_t BUCKETS = 160; // Covers values up to 2^40 (about 12 days in microseconds)
+
+    inline const char *counterName(Counter c)
+    {
+        static const char *names[COUNTER_COUNT] = {"bytes_in", "bytes_out", "connections_opened", "connections_closed", "downloads", "uploads",
+                                                   "crc_mismatches", "hash_ns", "socket_ns", "disk_ns", "memory_waits",
+                                                   "bandwidth_waits", "local_handoffs"};
+        return names[c];
+    }
+
+    inline const char *histogramName(Histogram h)
+    {
+        static const char *names[HISTOGRAM_COUNT] = {"download_us", "upload_us", "disk_write_us"};
+        return names[h];
+    }
+
+    // One thread's counts
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> counters[COUNTER_COUNT]; // Counter values
+        std::atomic<uint64_t> buckets[HISTOGRAM_COUNT][BUCKETS]; // Histogram bucket counts
+        std::atomic<uint64_t> sums[HISTOGRAM_COUNT]; // Histogram value sums, for the mean
+    };
+
+    inline Shard *shards() // MAX_SHARDS private shards followed by the overflow shard (zero-initialized: static storage)
+    {
+        static Shard all[MAX_SHARDS + 1];
+        return all;
+    }
+
+    inline std::atomic<size_t> &shardsClaimed() // Private shards handed out so far (may exceed MAX_SHARDS)
+    {
+        static std::atomic<size_t> claimed{0};
+        return claimed;
+    }
+
+    inline Shard &localShard() // The calling thread's shard, claimed on first use
+    {
+        thread_local Shard *mine = nullptr;
+        if (!mine)
+        {
+            size_t index = shardsClaimed().fetch_add(1, std::memory_order_relaxed);
+            mine = &shards()[index < MAX_SHARDS ? index : MAX_SHARDS];
+        }
+        return *mine;
+    }
+
+    inline void bump(Shard &shard, std::atomic<uint64_t> &value, uint64_t n) // Adds n to a value of shard
+    {
+        if (&shard == &shards()[MAX_SHARDS]) // Overflow shard: several writers
+            value.fetch_add(n, std::memory_order_relaxed);
+        else // Private shard: this thread is the only writer
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // Adds n to a counter
+    inline void add(Counter c, uint64_t n = 1)
+    {
+        Shard &shard = localShard();
+        bump(shard, shard.counters[c], n);
+    }
+
+    inline size_t bucketOf(uint64_t v) // Four buckets per power of two
+    {
+        if (v < 4) // Exact for small values
+            return static_cast<size_t>(v);
+        int msb = 2; // Index of the highest set bit
+        while (msb < 63 && (v >> (msb + 1)) != 0)
+            ++msb;
+        size_t b = static_cast<size_t>(msb - 1) * 4 + static_cast<size_t>((v >> (msb - 2)) & 3); // Power of two, then the next two bits
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+
+    inline uint64_t bucketUpper(size_t b) // Largest value counted in bucket b
+    {
+        if (b < 4)
+            return b;
+        int shift = static_cast<int>(b / 4) - 1; // Width of the bucket is 2^shift
+        return ((4 + (b % 4)) << shift) + (1ull << shift) - 1;
+    }
+
+    // Records one value in a histogram
+    inline void record(Histogram h, uint64_t value)
+    {
+        Shard &shard = localShard();
+        bump(shard, shard.buckets[h][bucketOf(value)], 1);
+        bump(shard, shard.sums[h], value);
+    }
+
+    typedef std::chrono::steady_clock Clock; // Monotonic clock for every duration
+
+    inline uint64_t microsSince(Clock::time_point start) // Elapsed microseconds
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    }
+
+    // Adds the time spent in its scope to a nanosecond counter
+    class Timer
+    {
+    public:
+        explicit Timer(Counter counter) : counter(counter), start(Clock::now()) {}
+        ~Timer() { add(counter, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count())); }
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+    private:
+        Counter counter; // Counter to add to
+        Clock::time_point start; // Start of the scope
+    };
+
+    inline Clock::time_point startTime() // Reference point of uptime_ms (the first call)
+    {
+        static const Clock::time_point started = Clock::now();
+        return started;
+    }
+
+    inline uint64_t counterTotal(Counter c) // Sum over every shard
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i <= MAX_SHARDS; ++i)
+            total += shards()[i].counters[c].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Snapshot of every counter and histogram as one JSON object
+    inline std::string json()
+    {
+        std::ostringstream out; // Report being built
+        out << "{\"uptime_ms\":" << microsSince(startTime()) / 1000;
+        uint64_t opened = counterTotal(CONNECTIONS_OPENED), closed = counterTotal(CONNECTIONS_CLOSED); // For the gauge
+        out << ",\"active_connections\":" << (opened >= closed ? opened - closed : 0) << ",\"counters\":{";
+        for (int c = 0; c < COUNTER_COUNT; ++c) // Every counter
+            out << (c ? "," : "") << '"' << counterName(static_cast<Counter>(c)) << "\":" << counterTotal(static_cast<Counter>(c));
+        out << "},\"histograms\":{";
+        for (int h = 0; h < HISTOGRAM_COUNT; ++h) // Every histogram
+        {
+            uint64_t buckets[BUCKETS] = {}; // Merged bucket counts
+            uint64_t count = 0, sum = 0; // Merged totals
+            for (size_t i = 0; i <= MAX_SHARDS; ++i)
+            {
+                Shard &shard = shards()[i];
+                for (size_t b = 0; b < BUCKETS; ++b)
+                    buckets[b] += shard.buckets[h][b].load(std::memory_order_relaxed);
+                sum += shard.sums[h].load(std::memory_order_relaxed);
+            }
+            for (size_t b = 0; b < BUCKETS; ++b)
+                count += buckets[b];
+            auto percentile = [&](double p) -> uint64_t { // Upper bound of the bucket holding rank p
+                uint64_t rank = static_cast<uint64_t>(p * count), seen = 0;
+                for (size_t b = 0; b < BUCKETS; ++b)
+                    if ((seen += buckets[b]) > rank)
+                        return bucketUpper(b);
+                return 0;
+            };
+            out << (h ? "," : "") << '"' << histogramName(static_cast<Histogram>(h)) << "\":{\"count\":" << count << ",\"mean\":" << (count ? sum / count : 0)
+                << ",\"p50\":" << percentile(0.5) << ",\"p99\":" << percentile(0.99) << ",\"p999\":" << percentile(0.999) << "}";
+        }
+        out << "}}";
+        return out.str();
+    }
+}
+
+#endif // Ends the header guard
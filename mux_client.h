@@ -0,0 +1,360 @@
+#ifndef MUX_CLIENT_H // Prevents multiple inclusions of this header file
+#define MUX_CLIENT_H // Defines the header guard macro
+
+#include <winsock2.h> // Includes the Winsock 2 library for socket programming
+#include <algorithm> // Includes std::min
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <cstring> // Includes memmove
+#include <functional> // Includes std::function for completion callbacks
+#include <map> // Includes map for the open streams
+#include <string> // Includes std::string for file names
+#include <vector> // Includes the vector library for buffers
+#include "compression.h" // Includes the per-frame codecs
+#include "crc32.h" // Includes the shared CRC32 engine
+#include "file_io.h" // Includes positioned file reads and writes
+#include "protocol_v2.h" // Includes the v2 frame format
+
+// Client side of protocol v2: runs any number of downloads and uploads over one blocking socket,
+// interleaving their frames. Downloads are written straight into a file at their offset and uploads
+// are read from one, so a transfer never has to fit in memory.
+class MuxClient
+{
+public:
+    // Outcome of one stream
+    struct Result
+    {
+        bool ok = false; // Data verified end to end
+        uint64_t total = 0; // Download: size of the whole file on the server
+        uint32_t fileCrc = 0; // Download: whole-file CRC announced by the server
+        uint64_t bytes = 0; // Bytes moved
+        uint64_t wireBytes = 0; // DATA payload bytes on the wire (less than bytes when compressed)
+        uint32_t crc = 0; // CRC computed locally
+        uint32_t peerCrc = 0; // CRC reported by the server
+        uint32_t error = 0; // RESET code (0 = none)
+    };
+
+    explicit MuxClient(SOCKET sock) : sock(sock), rx(2 * (ProtocolV2::HEADER_SIZE + ProtocolV2::MAX_DATA)) {} // Uses a connected v2 socket
+
+    // Offers v2 on a connection that just received its UUID; returns the version the server picked (0 = connection failed)
+    static uint32_t negotiate(SOCKET sock)
+    {
+        char request[5] = {'V'}; // Version command
+        ProtocolV2::put32(request + 1, ProtocolV2::VERSION); // Highest version we speak
+        char reply[5]; // 'V' and the chosen version
+        if (!sendBytes(sock, request, sizeof(request)) || !recvBytes(sock, reply, sizeof(reply)) || reply[0] != 'V') // Exchanges versions
+            return 0;
+        return ProtocolV2::get32(reply + 1);
+    }
+
+    // Opens a download of length bytes at offset (0 = to the end) into file at fileOffset; returns the stream ID.
+    // codecs is a Compression mask the server may pick from (0 = uncompressed); name is the server file
+    // (empty = the one the connection selected with 'O').
+    uint32_t download(FileIO::Handle file, uint64_t fileOffset, uint64_t offset, uint64_t length, uint8_t codecs = 0, const std::string &name = std::string())
+    {
+        std::vector<char> open(17, 0); // op(1) offset(8) length(8) [codecs(1) [nameLen(2) name]]
+        open[0] = 'D';
+        ProtocolV2::put64(&open[1], offset);
+        ProtocolV2::put64(&open[9], length);
+        appendOptions(open, codecs, name);
+        return openStream(false, file, fileOffset, 0, open.data(), open.size());
+    }
+
+    // Opens an upload of size bytes read from file at fileOffset; returns the stream ID.
+    // codecs is a Compression mask the server may pick from (0 = uncompressed); name is the server file
+    // to publish as (empty = the one the connection selected with 'O').
+    uint32_t upload(FileIO::Handle file, uint64_t fileOffset, uint64_t size, uint8_t codecs = 0, const std::string &name = std::string())
+    {
+        std::vector<char> open(9, 0); // op(1) size(8) [codecs(1) [nameLen(2) name]]
+        open[0] = 'U';
+        ProtocolV2::put64(&open[1], size);
+        appendOptions(open, codecs, name);
+        return openStream(true, file, fileOffset, size, open.data(), open.size());
+    }
+
+    typedef std::function<void(uint32_t id, const Result &result)> Finished; // Called as each stream ends
+
+    // Drives every open stream to completion; returns false if the connection failed. If finished is
+    // set, it is called as each stream ends and may open more streams, which run() then drives too;
+    // the result is not kept afterwards, so result() is only for runs without it.
+    bool run(Finished finished = Finished())
+    {
+        onFinished = finished; // Used by handleFrame() until this run ends
+        while (!failed && !streams.empty()) // Until every stream has ended
+        {
+            bool sent = pumpUploads(); // Sends what the windows allow
+            if (failed) // Send failed
+                break;
+            fd_set readable; // Socket readability
+            FD_ZERO(&readable);
+            FD_SET(sock, &readable);
+            timeval poll = {0, 0}; // Just checks while uploads still have data to send
+            int ready = select(0, &readable, nullptr, nullptr, sent ? &poll : nullptr); // Otherwise waits for the server
+            if (ready == SOCKET_ERROR || (ready > 0 && !receive())) // Connection failed
+                failed = true;
+        }
+        onFinished = Finished();
+        return !failed;
+    }
+
+    // Returns the outcome of a finished stream
+    const Result &result(uint32_t id) { return results[id]; }
+
+    // Tells the server the client is done
+    bool goAway()
+    {
+        std::vector<char> f = ProtocolV2::frame(ProtocolV2::GOAWAY, 0); // Connection-level frame
+        return sendBytes(sock, f.data(), f.size());
+    }
+
+private:
+    // Local state of one open stream
+    struct Stream
+    {
+        bool upload = false; // Direction
+        FileIO::Handle file; // Local file
+        uint64_t fileOffset = 0; // Position of the stream's first byte in the local file
+        uint64_t length = 0; // Upload: size; download: length from HEADERS
+        uint64_t sent = 0; // Upload: bytes sent
+        uint64_t window = 0; // Upload: bytes we may still send
+        uint32_t unacked = 0; // Download: consumed bytes not yet returned as WINDOW
+        Compression::Codec codec = Compression::NONE; // Codec the server picked
+    };
+
+    // Appends the optional OPEN fields that are needed: codecs if offered or followed by a name, then the name
+    static void appendOptions(std::vector<char> &open, uint8_t codecs, const std::string &name)
+    {
+        if (codecs == 0 && name.empty()) // Fixed fields only (understood by every v2 server)
+            return;
+        open.push_back(static_cast<char>(codecs));
+        if (name.empty())
+            return;
+        size_t at = open.size(); // Where the name field starts
+        open.resize(at + 2 + name.size());
+        ProtocolV2::put16(&open[at], static_cast<uint16_t>(name.size()));
+        memcpy(&open[at + 2], name.data(), name.size());
+    }
+
+    // Sends an OPEN frame and registers the stream
+    uint32_t openStream(bool upload, FileIO::Handle file, uint64_t fileOffset, uint64_t size, const char *open, size_t openLength)
+    {
+        uint32_t id = nextId++; // Fresh stream ID
+        Stream &s = streams[id]; // Registers it
+        s.upload = upload;
+        s.file = file;
+        s.fileOffset = fileOffset;
+        s.length = size;
+        s.window = ProtocolV2::INITIAL_WINDOW; // Credit every new stream starts with
+        results[id] = Result(); // Clears any old result
+        std::vector<char> f = ProtocolV2::frame(ProtocolV2::OPEN, id, open, openLength); // Request
+        if (!sendBytes(sock, f.data(), f.size())) // Connection failed
+            failed = true;
+        return id;
+    }
+
+    // Sends at most one DATA frame per upload stream that has data and credit; returns true if anything was sent
+    bool pumpUploads()
+    {
+        bool sent = false; // True once a frame went out
+        for (auto &entry : streams) // Round-robin, one frame each
+        {
+            Stream &s = entry.second; // Stream to serve
+            if (!s.upload || s.sent == s.length || s.window == 0) // Nothing to send, or waiting for credit
+                continue;
+            uint64_t limit = s.codec == Compression::NONE ? ProtocolV2::MAX_DATA : ProtocolV2::MAX_RAW_CHUNK; // Raw bytes per frame
+            uint32_t length = static_cast<uint32_t>(std::min<uint64_t>({limit, s.window, s.length - s.sent})); // Raw bytes to send
+            tx.resize(ProtocolV2::HEADER_SIZE + length); // Header followed by data
+            size_t got = FileIO::readAt(s.file, s.fileOffset + s.sent, tx.data() + ProtocolV2::HEADER_SIZE, length); // Reads at its position
+            if (got < length) // File shrank underneath us; pads so the frame stays well-formed (the CRCs will disagree)
+                std::fill(tx.begin() + ProtocolV2::HEADER_SIZE + got, tx.end(), 0);
+            ProtocolV2::FrameHeader h; // DATA frame header
+            h.length = length;
+            h.stream = entry.first;
+            h.type = ProtocolV2::DATA;
+            Result &r = results[entry.first]; // Running totals
+            r.crc = CRC32::update(r.crc, tx.data() + ProtocolV2::HEADER_SIZE, length); // Updates CRC with the raw data
+            std::vector<char> *out = &tx; // Frame to send
+            size_t packed = s.codec == Compression::NONE ? 0 : Compression::compress(s.codec, tx.data() + ProtocolV2::HEADER_SIZE, length, packBuffer); // Compressed size (0 = send raw)
+            if (packed > 0 && packed + 4 < length) // Worth it even with the length prefix
+            {
+                packed += 4;
+                h.length = static_cast<uint32_t>(packed);
+                h.flags = ProtocolV2::FLAG_COMPRESSED;
+                packFrame.resize(ProtocolV2::HEADER_SIZE + packed); // Header, rawLength(4), compressed bytes
+                ProtocolV2::put32(packFrame.data() + ProtocolV2::HEADER_SIZE, length);
+                memcpy(packFrame.data() + ProtocolV2::HEADER_SIZE + 4, packBuffer.data(), packed - 4);
+                out = &packFrame;
+            }
+            ProtocolV2::encodeHeader(out->data(), h);
+            if (!sendBytes(sock, out->data(), ProtocolV2::HEADER_SIZE + h.length)) // Connection failed
+            {
+                failed = true;
+                return false;
+            }
+            s.sent += length;
+            s.window -= std::min<uint64_t>(s.window, h.length); // Windows count wire bytes
+            r.bytes = s.sent;
+            r.wireBytes += h.length;
+            sent = true;
+        }
+        return sent;
+    }
+
+    // Receives what is available and handles every complete frame; returns false if the connection failed
+    bool receive()
+    {
+        int got = recv(sock, rx.data() + rxLength, static_cast<int>(rx.size() - rxLength), 0); // Appends to buffered input
+        if (got <= 0) // Checks for errors or disconnection
+            return false;
+        rxLength += static_cast<size_t>(got);
+        size_t used = 0; // Bytes of complete frames handled
+        while (rxLength - used >= ProtocolV2::HEADER_SIZE) // A header is available
+        {
+            ProtocolV2::FrameHeader h = ProtocolV2::decodeHeader(rx.data() + used); // Decodes it
+            if (h.length > ProtocolV2::MAX_DATA) // Cannot be a valid frame
+                return false;
+            if (rxLength - used < ProtocolV2::HEADER_SIZE + h.length) // Payload incomplete
+                break;
+            if (!handleFrame(h, rx.data() + used + ProtocolV2::HEADER_SIZE)) // Reply could not be sent
+                return false;
+            used += ProtocolV2::HEADER_SIZE + h.length;
+        }
+        rxLength -= used; // Keeps the incomplete frame
+        memmove(rx.data(), rx.data() + used, rxLength); // Compacts the buffer
+        return true;
+    }
+
+    // Applies one frame from the server; returns false if a reply could not be sent
+    bool handleFrame(const ProtocolV2::FrameHeader &h, const char *payload)
+    {
+        auto it = streams.find(h.stream); // Stream the frame refers to
+        if (it == streams.end()) // Unknown or already finished
+            return true;
+        Stream &s = it->second; // The stream
+        Result &r = results[h.stream]; // Its outcome
+        switch (h.type) // Dispatches on the frame type
+        {
+        case ProtocolV2::HEADERS: // Stream accepted
+            if (s.upload && h.length >= 1) // codec(1)
+                s.codec = static_cast<Compression::Codec>(payload[0]);
+            else if (!s.upload && h.length >= 20) // total(8) fileCrc(4) length(8) [codec(1)]
+            {
+                r.total = ProtocolV2::get64(payload);
+                r.fileCrc = ProtocolV2::get32(payload + 8);
+                s.length = ProtocolV2::get64(payload + 12);
+                if (h.length >= 21)
+                    s.codec = static_cast<Compression::Codec>(payload[20]);
+            }
+            break;
+        case ProtocolV2::DATA: // Download bytes
+        {
+            if (s.upload) // Servers never send data on uploads
+                break;
+            const char *data = payload; // Raw bytes of the frame
+            size_t length = h.length;
+            if (h.flags & ProtocolV2::FLAG_COMPRESSED) // rawLength(4) compressed
+            {
+                length = h.length >= 4 ? ProtocolV2::get32(payload) : 0;
+                if (h.length < 4 || length > ProtocolV2::MAX_RAW_CHUNK) // Malformed; treated as a broken connection
+                    return false;
+                unpackBuffer.resize(length);
+                if (!Compression::decompress(s.codec, payload + 4, h.length - 4, unpackBuffer.data(), length))
+                    return false;
+                data = unpackBuffer.data();
+            }
+            FileIO::writeAt(s.file, s.fileOffset + r.bytes, data, length); // Writes at its position
+            r.crc = CRC32::update(r.crc, data, length); // Updates CRC with received data
+            r.bytes += length;
+            r.wireBytes += h.length;
+            s.unacked += h.length; // Credit is returned in wire bytes
+            if (s.unacked >= ProtocolV2::INITIAL_WINDOW / 4) // Returns credit in batches
+            {
+                std::vector<char> f = ProtocolV2::frame32(ProtocolV2::WINDOW, h.stream, s.unacked);
+                s.unacked = 0;
+                if (!sendBytes(sock, f.data(), f.size()))
+                    return false;
+            }
+            break;
+        }
+        case ProtocolV2::WINDOW: // Upload credit
+            if (h.length >= 4)
+                s.window += ProtocolV2::get32(payload);
+            break;
+        case ProtocolV2::END: // Stream finished
+            if (s.upload && h.length >= 5) // status(1) crc(4)
+            {
+                r.peerCrc = ProtocolV2::get32(payload + 1);
+                r.ok = payload[0] == 1 && r.peerCrc == r.crc && r.bytes == s.length;
+            }
+            else if (!s.upload && h.length >= 4) // crc(4)
+            {
+                r.peerCrc = ProtocolV2::get32(payload);
+                r.ok = r.peerCrc == r.crc && r.bytes == s.length;
+            }
+            streams.erase(it);
+            ended(h.stream);
+            break;
+        case ProtocolV2::RESET: // Server aborted the stream
+            r.error = h.length >= 4 ? ProtocolV2::get32(payload) : ProtocolV2::ERR_PROTOCOL;
+            streams.erase(it);
+            ended(h.stream);
+            break;
+        default: // Ignores frames this client does not use
+            break;
+        }
+        return true;
+    }
+
+    // Hands the result of an ended stream to the caller of run(), if it asked for them
+    void ended(uint32_t id)
+    {
+        if (!onFinished) // Kept for result()
+            return;
+        auto it = results.find(id); // Outcome of the stream
+        Result r = it->second; // Copied: the callback may open streams, which adds results
+        results.erase(it); // Batches of any size keep memory flat
+        onFinished(id, r);
+    }
+
+    // Sends all bytes (blocking)
+    static bool sendBytes(SOCKET sock, const char *data, size_t length)
+    {
+        while (length > 0) // Until everything is sent
+        {
+            int r = send(sock, data, static_cast<int>(std::min<size_t>(length, 1 << 30)), 0); // Sends remaining data
+            if (r <= 0) // Checks for errors or disconnection
+                return false;
+            data += r;
+            length -= static_cast<size_t>(r);
+        }
+        return true;
+    }
+
+    // Receives exactly length bytes (blocking)
+    static bool recvBytes(SOCKET sock, char *data, size_t length)
+    {
+        while (length > 0) // Until everything is received
+        {
+            int r = recv(sock, data, static_cast<int>(length), 0); // Receives remaining data
+            if (r <= 0) // Checks for errors or disconnection
+                return false;
+            data += r;
+            length -= static_cast<size_t>(r);
+        }
+        return true;
+    }
+
+    SOCKET sock; // Connected socket (not owned)
+    std::vector<char> rx; // Buffered input
+    size_t rxLength = 0; // Bytes in rx
+    std::vector<char> tx; // Outgoing DATA frame
+    std::vector<char> packBuffer; // Compressor output
+    std::vector<char> packFrame; // Outgoing compressed DATA frame
+    std::vector<char> unpackBuffer; // Decompressed incoming DATA
+    std::map<uint32_t, Stream> streams; // Open streams by ID
+    std::map<uint32_t, Result> results; // Outcome of every stream opened so far
+    uint32_t nextId = 1; // Next stream ID
+    bool failed = false; // True once the connection failed
+    Finished onFinished; // Completion callback of the current run()
+};
+
+#endif // Ends the header guard
@@ -0,0 +1,162 @@
+#ifndef PROTOCOL_V2_H // Prevents multiple inclusions of this header file
+#define PROTOCOL_V2_H // Defines the header guard macro
+
+#include <cstddef> // Includes size_t
+#include <cstdint> // Includes standard integer types like uint32_t
+#include <cstring> // Includes memcpy
+#include <vector> // Includes the vector library for frame buffers
+
+// Version 2 of the wire protocol, shared by server and client.
+//
+// A connection starts in v1. A v2 client sends the command 'V' followed by the highest version it
+// speaks (uint32, little-endian); the server answers 'V' and the version it picked. From version 2 on,
+// both sides exchange frames:
+//
+//   length(4) stream(4) type(1) flags(1) reserved(2) payload(length)      all integers little-endian
+//
+// Streams are opened by the client with a client-chosen non-zero ID and carry one transfer each, so
+// several downloads and uploads can interleave on one connection. Each direction of a stream has its
+// own window: a sender may have at most that many DATA bytes unacknowledged and the receiver returns
+// credit with WINDOW frames as it consumes data. Windows count payload bytes as sent on the wire.
+//
+//   OPEN    c->s  op(1)='D' offset(8) length(8) [codecs(1) [nameLen(2) name]]   download a range (length 0 = to the end)
+//                 op(1)='U' size(8) [codecs(1) [nameLen(2) name]]               upload a file of that size
+//   HEADERS s->c  total(8) fileCrc(4) length(8) codec(1)      download accepted
+//           s->c  codec(1)                           upload accepted (only sent if codecs were offered)
+//   DATA    both  bytes                              at most MAX_DATA per frame
+//                 rawLength(4) compressed            with FLAG_COMPRESSED, in the stream's codec
+//   END     s->c  crc(4)                             download finished, CRC of the range
+//           s->c  status(1) crc(4)                   upload stored (status 1) or not (0)
+//   WINDOW  both  increment(4)                       more credit for the peer
+//   RESET   both  code(4)                            stream aborted
+//   GOAWAY  c->s  (stream 0, no payload)             client is done; server closes after flushing
+//
+// codecs is a bit mask of Compression::Codec values the client can handle; the server picks one per
+// stream. Compression is per DATA frame, and a frame that would not shrink is sent without the flag.
+// CRCs always cover the uncompressed bytes. name is a catalog name ("dir/file"); without one, the
+// stream works on the file the connection selected with 'O' before switching to v2.
+namespace ProtocolV2
+{
+    static constexpr uint32_t VERSION = 2; // Highest version this build speaks
+    static constexpr size_t HEADER_SIZE = 12; // Bytes in a frame header
+    static constexpr uint32_t MAX_DATA = 256 * 1024; // Largest DATA payload
+    static constexpr uint32_t MAX_CONTROL = 2048; // Largest payload of any other frame (fits an OPEN with the longest name)
+    static constexpr uint32_t INITIAL_WINDOW = 4 * 1024 * 1024; // Credit of a new stream in each direction
+    static constexpr size_t MAX_STREAMS = 64; // Streams one connection may have open
+    static constexpr uint32_t MAX_RAW_CHUNK = 128 * 1024; // Uncompressed bytes in one compressed DATA frame
+    static constexpr uint8_t FLAG_COMPRESSED = 1; // DATA flag: payload is rawLength(4) + compressed bytes
+
+    enum FrameType : uint8_t
+    {
+        OPEN = 1, // Opens a stream
+        HEADERS = 2, // Download metadata
+        DATA = 3, // Stream payload
+        END = 4, // Stream completed
+        WINDOW = 5, // Flow-control credit
+        RESET = 6, // Stream aborted
+        GOAWAY = 7 // Connection shutdown
+    };
+
+    enum ErrorCode : uint32_t
+    {
+        ERR_PROTOCOL = 1, // Malformed or unexpected frame
+        ERR_NOT_FOUND = 2, // File not available
+        ERR_REFUSED = 3, // Too many streams, or stream ID in use
+        ERR_IO = 4, // Server-side I/O failure
+        ERR_CANCELLED = 5 // Cancelled by the peer
+    };
+
+    struct FrameHeader
+    {
+        uint32_t length = 0; // Payload bytes
+        uint32_t stream = 0; // Stream ID (0 = connection)
+        uint8_t type = 0; // FrameType
+        uint8_t flags = 0; // Per-type flags
+    };
+
+    // Little-endian field encoding, independent of the host byte order
+    inline void put32(char *out, uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i) // Least significant byte first
+            out[i] = static_cast<char>(v >> (8 * i));
+    }
+
+    inline void put16(char *out, uint16_t v)
+    {
+        out[0] = static_cast<char>(v); // Least significant byte first
+        out[1] = static_cast<char>(v >> 8);
+    }
+
+    inline void put64(char *out, uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i) // Least significant byte first
+            out[i] = static_cast<char>(v >> (8 * i));
+    }
+
+    inline uint16_t get16(const char *in)
+    {
+        return static_cast<uint16_t>(static_cast<uint8_t>(in[0]) | (static_cast<uint8_t>(in[1]) << 8)); // Least significant byte first
+    }
+
+    inline uint32_t get32(const char *in)
+    {
+        uint32_t v = 0; // Decoded value
+        for (int i = 3; i >= 0; --i) // Most significant byte last on the wire
+            v = (v << 8) | static_cast<uint8_t>(in[i]);
+        return v;
+    }
+
+    inline uint64_t get64(const char *in)
+    {
+        uint64_t v = 0; // Decoded value
+        for (int i = 7; i >= 0; --i) // Most significant byte last on the wire
+            v = (v << 8) | static_cast<uint8_t>(in[i]);
+        return v;
+    }
+
+    // Encodes a frame header into HEADER_SIZE bytes
+    inline void encodeHeader(char *out, const FrameHeader &h)
+    {
+        put32(out, h.length);
+        put32(out + 4, h.stream);
+        out[8] = static_cast<char>(h.type);
+        out[9] = static_cast<char>(h.flags);
+        out[10] = out[11] = 0; // Reserved
+    }
+
+    // Decodes a frame header from HEADER_SIZE bytes
+    inline FrameHeader decodeHeader(const char *in)
+    {
+        FrameHeader h; // Decoded header
+        h.length = get32(in);
+        h.stream = get32(in + 4);
+        h.type = static_cast<uint8_t>(in[8]);
+        h.flags = static_cast<uint8_t>(in[9]);
+        return h;
+    }
+
+    // Builds a complete frame (header and payload) ready to send
+    inline std::vector<char> frame(uint8_t type, uint32_t stream, const char *payload = nullptr, size_t length = 0, uint8_t flags = 0)
+    {
+        std::vector<char> out(HEADER_SIZE + length); // Header followed by payload
+        FrameHeader h; // Header fields
+        h.length = static_cast<uint32_t>(length);
+        h.stream = stream;
+        h.type = type;
+        h.flags = flags;
+        encodeHeader(out.data(), h);
+        if (length > 0) // Copies the payload
+            memcpy(out.data() + HEADER_SIZE, payload, length);
+        return out;
+    }
+
+    // Builds a frame whose payload is a single little-endian uint32 (WINDOW, RESET)
+    inline std::vector<char> frame32(uint8_t type, uint32_t stream, uint32_t value)
+    {
+        char payload[4]; // Encoded value
+        put32(payload, value);
+        return frame(type, stream, payload, sizeof(payload));
+    }
+}
+
+#endif // Ends the header guard
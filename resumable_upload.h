@@ -0,0 +1,315 @@
+#ifndef RESUMABLE_UPLOAD_H // Prevents multiple inclusions of this header file
+#define RESUMABLE_UPLOAD_H // Defines the header guard macro
+
+#include <windows.h> // Includes CreateDirectoryA and DeleteFileA
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <algorithm> // Includes std::max
+#include <cstring> // Includes memcpy for journal records
+#include <iterator> // Includes std::prev and std::next
+#include <map> // Includes map for the verified ranges
+#include <memory> // Includes shared_ptr for shared partial uploads
+#include <mutex> // Includes mutex for concurrent writers
+#include <string> // Includes the string library for paths
+#include <unordered_map> // Includes unordered_map for the registry
+#include <vector> // Includes the vector library for dynamic arrays
+#include "crc32.h" // Includes CRC32::combine for the whole-file checksum
+#include "file_io.h" // Includes positioned writes and atomic replace
+
+// A partially received upload owned by one session UUID. Data lives in "<dir>/<uuid>.part"; every
+// range whose CRC checked out is appended to "<dir>/<uuid>.journal" after the data is flushed, so
+// progress survives both dropped connections and server restarts.
+//
+// A range is claimed before any of its bytes are written. A claim is refused if it overlaps a
+// verified range or one still in flight on another connection, so the bytes of a damaged or stray
+// resend only ever land where nothing has been verified yet.
+class PartialUpload
+{
+public:
+    PartialUpload(const std::string &dir, const std::string &uuid)
+        : partPath(dir + "\\" + uuid + ".part"), journalPath(dir + "\\" + uuid + ".journal") {} // Derives the file names
+
+    // Starts or resumes an upload of totalSize bytes; returns the verified prefix to resume from
+    uint64_t begin(uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Serializes with writers
+        if (!loaded) // First use in this process
+            loadJournal(); // Picks up progress from an earlier connection or server run
+        if (!part || size != totalSize || finished) // No usable progress for this size
+            reset(size); // Starts over
+        return prefixLocked(); // Bytes the client may skip
+    }
+
+    // Reserves [offset, offset + length) for one incoming range; false means none of it may be written
+    bool claim(uint64_t offset, uint64_t length)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the ranges
+        if (finished || !part || length == 0 || offset + length > totalSize || offset + length < offset) // Stale session, empty or out-of-bounds range
+            return false;
+        if (overlaps(ranges, offset, length) || overlaps(claims, offset, length)) // Verified bytes, or another connection's range
+            return false;
+        claims[offset] = length;
+        return true;
+    }
+
+    // Ends a claim that will not be committed (connection lost mid-range)
+    void release(uint64_t offset)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the claims
+        claims.erase(offset);
+    }
+
+    // True if exactly [offset, offset + length) was verified already, with its CRC (a resend after a lost reply)
+    bool verified(uint64_t offset, uint64_t length, uint32_t &crc)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the ranges
+        auto it = ranges.find(offset);
+        if (it == ranges.end() || it->second.length != length)
+            return false;
+        crc = it->second.crc;
+        return true;
+    }
+
+    // Writes raw bytes of a claimed range; they only count once commit() verifies the range
+    bool write(uint64_t offset, const char *data, size_t length)
+    {
+        FileIO::Handle file; // Handle snapshot (writes run without the lock)
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the handle
+            if (finished || offset + length > totalSize) // Stale session or out-of-bounds range
+                return false;
+            file = part; // Positioned writes on a shared handle are safe concurrently
+        }
+        return file && FileIO::writeAt(file, offset, data, length); // Writes at the offset
+    }
+
+    // Ends the claim at offset and records the range as verified if its CRC matches; returns false if it was rejected
+    bool commit(uint64_t offset, uint64_t length, uint32_t crc, uint32_t expectedCrc)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Serializes journal appends
+        if (claims.erase(offset) == 0 || finished || !part || crc != expectedCrc) // Unclaimed, damaged or stale range
+            return false; // Client resends just this range
+
+        if (!FileIO::flush(part)) // Data must be durable before the journal says so
+            return false;
+        char record[RECORD_SIZE]; // Journal record: offset, length, crc
+        memcpy(record, &offset, 8);
+        memcpy(record + 8, &length, 8);
+        memcpy(record + 16, &crc, 4);
+        if (!FileIO::writeAt(journal, journalSize, record, sizeof(record)) || !FileIO::flush(journal)) // Appends durably
+            return false;
+        journalSize += sizeof(record); // Next append position
+        ranges[offset] = Range{length, crc}; // Marks the range as verified
+        return true;
+    }
+
+    // Length of the contiguous verified prefix
+    uint64_t verifiedPrefix()
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the ranges
+        return prefixLocked();
+    }
+
+    // Publishes the upload to target once every byte is verified; returns false if incomplete
+    bool finalize(const std::string &target, uint32_t &fileCrc)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Stops writers while publishing
+        if (finished || !part || prefixLocked() != totalSize) // Not fully verified yet
+            return false;
+        fileCrc = 0; // CRC of the empty prefix
+        for (auto &r : ranges) // Ranges are contiguous and sorted, so their CRCs combine in order
+            fileCrc = CRC32::combine(fileCrc, r.second.crc, r.second.length);
+        part.reset(); // Closes the data file before renaming it
+        journal.reset(); // Closes the journal
+        if (!FileIO::replace(partPath, target)) // Atomically publishes the file
+        {
+            part = FileIO::openReadWrite(partPath, false); // Keeps the upload resumable
+            journal = FileIO::openReadWrite(journalPath, false);
+            return false;
+        }
+        DeleteFileA(journalPath.c_str()); // Progress is no longer needed
+        finished = true; // Rejects late writers
+        return true;
+    }
+
+private:
+    struct Range // One verified range
+    {
+        uint64_t length; // Range length
+        uint32_t crc; // Range CRC32
+    };
+
+    static constexpr uint32_t MAGIC = 0x4A504354; // "TCPJ": identifies a journal file
+    static constexpr size_t HEADER_SIZE = 12; // Magic + total size
+    static constexpr size_t RECORD_SIZE = 20; // Offset + length + crc
+
+    // Loads progress recorded by an earlier connection or server run
+    void loadJournal()
+    {
+        loaded = true; // Only tried once
+        FileIO::Handle j = FileIO::openRead(journalPath); // Opens an existing journal
+        uint64_t size = 0; // Journal size
+        char header[HEADER_SIZE]; // Journal header
+        if (!j || !FileIO::sizeOf(j, size) || FileIO::readAt(j, 0, header, sizeof(header)) != sizeof(header)) // No usable journal
+            return;
+        uint32_t magic; // Stored magic
+        memcpy(&magic, header, 4);
+        if (magic != MAGIC) // Not a journal
+            return;
+        memcpy(&totalSize, header + 4, 8); // Announced upload size
+        std::vector<char> records(static_cast<size_t>(size - HEADER_SIZE)); // All records
+        size_t got = records.empty() ? 0 : FileIO::readAt(j, HEADER_SIZE, records.data(), records.size()); // Reads them
+        size_t complete = got - got % RECORD_SIZE; // A torn final record is ignored
+        for (size_t at = 0; at < complete; at += RECORD_SIZE) // Replays each record
+        {
+            uint64_t offset, length; // Range bounds
+            uint32_t crc; // Range CRC
+            memcpy(&offset, records.data() + at, 8);
+            memcpy(&length, records.data() + at + 8, 8);
+            memcpy(&crc, records.data() + at + 16, 4);
+            ranges[offset] = Range{length, crc}; // Restores the verified range
+        }
+        j.reset(); // Closes the read-only handle
+        part = FileIO::openReadWrite(partPath, false); // Reopens the data file
+        journal = FileIO::openReadWrite(journalPath, false); // Reopens the journal for appends
+        journalSize = HEADER_SIZE + complete; // Appends overwrite any torn record
+        if (!part || !journal) // Files vanished
+            part.reset();
+    }
+
+    // Discards any progress and starts a fresh upload of size bytes
+    void reset(uint64_t size)
+    {
+        ranges.clear(); // Forgets verified ranges
+        claims.clear(); // Late writers of the old upload are refused at commit
+        finished = false; // A new upload begins
+        totalSize = size; // Records the announced size
+        part = FileIO::openReadWrite(partPath, true); // Truncates the data file
+        journal = FileIO::openReadWrite(journalPath, true); // Truncates the journal
+        char header[HEADER_SIZE]; // New journal header
+        memcpy(header, &MAGIC, 4);
+        memcpy(header + 4, &totalSize, 8);
+        journalSize = HEADER_SIZE; // Records start after the header
+        if (!part || !journal || !FileIO::writeAt(journal, 0, header, sizeof(header)) || !FileIO::flush(journal)) // Creates the journal
+            part.reset(); // Marks the upload unusable
+    }
+
+    // True if [offset, offset + length) intersects a range of map, keyed by offset (caller holds the lock)
+    template <typename Map>
+    static bool overlaps(const Map &map, uint64_t offset, uint64_t length)
+    {
+        auto next = map.lower_bound(offset); // First range starting at or after offset
+        if (next != map.end() && next->first < offset + length) // Starts inside
+            return true;
+        return next != map.begin() && std::prev(next)->first + extent(std::prev(next)->second) > offset; // Previous range reaches in
+    }
+
+    static uint64_t extent(const Range &r) { return r.length; } // Length of a verified range
+    static uint64_t extent(uint64_t length) { return length; } // Length of a claimed range
+
+    // Contiguous verified bytes from offset 0 (caller holds the lock)
+    uint64_t prefixLocked() const
+    {
+        uint64_t prefix = 0; // End of the contiguous prefix
+        for (auto it = ranges.find(0); it != ranges.end() && it->first == prefix; ++it) // Walks adjacent ranges
+            prefix += it->second.length;
+        return prefix;
+    }
+
+    std::string partPath; // Data file
+    std::string journalPath; // Progress journal
+    std::mutex mutex; // Protects everything below
+    bool loaded = false; // True once the journal was read
+    bool finished = false; // True once published
+    uint64_t totalSize = 0; // Announced size of the upload
+    FileIO::Handle part; // Open data file
+    FileIO::Handle journal; // Open journal
+    uint64_t journalSize = 0; // Next journal append offset
+    std::map<uint64_t, Range> ranges; // Verified ranges by offset
+    std::map<uint64_t, uint64_t> claims; // Lengths of ranges being received, by offset
+};
+
+// Process-wide map from session UUID to its partial upload. The registry does not own the uploads: an
+// upload's files stay open only while a session (or a flush it started) uses it, so abandoned UUIDs
+// cost nothing once their sessions end, and the next 'P' for one reloads it from its journal.
+class UploadRegistry
+{
+public:
+    explicit UploadRegistry(const std::string &dir) : dir(dir)
+    {
+        CreateDirectoryA(dir.c_str(), nullptr); // Creates the spool directory (fails harmlessly if it exists)
+    }
+
+    // Returns the partial upload of a session, reopening it if no session uses it at the moment
+    std::shared_ptr<PartialUpload> get(const std::string &uuid)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the map
+        if (uploads.size() >= sweepAt) // Forgets uploads nobody uses any more (amortized over the inserts)
+        {
+            for (auto it = uploads.begin(); it != uploads.end();)
+                it = it->second.expired() ? uploads.erase(it) : std::next(it);
+            sweepAt = std::max<size_t>(MIN_SWEEP, uploads.size() * 2);
+        }
+        std::weak_ptr<PartialUpload> &slot = uploads[uuid]; // Finds or creates the slot
+        std::shared_ptr<PartialUpload> upload = slot.lock(); // Still in use by another session or a flush
+        if (!upload) // First use since the last session let go: loads from the journal on begin()
+        {
+            upload = std::make_shared<PartialUpload>(dir, uuid);
+            slot = upload;
+        }
+        return upload;
+    }
+
+    // Marks uuid as in use by one more live session. A plain resume needs it to be free; join (an extra
+    // stream of a striped upload) needs a live session to hold it already. Returns false if refused.
+    bool hold(const std::string &uuid, bool join)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the holders
+        auto it = holders.find(uuid);
+        if ((it != holders.end()) != join) // Taken (resume) or not live (join)
+            return false;
+        ++holders[uuid];
+        return true;
+    }
+
+    // Ends one session's hold on uuid
+    void release(const std::string &uuid)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the holders
+        auto it = holders.find(uuid);
+        if (it != holders.end() && --it->second == 0) // Last holder gone
+            holders.erase(it);
+    }
+
+    // Forgets a published upload
+    void remove(const std::string &uuid)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the map
+        uploads.erase(uuid);
+    }
+
+    // True if uuid has the canonical 8-4-4-4-12 hex layout (it becomes part of a file name)
+    static bool validUUID(const std::string &uuid)
+    {
+        if (uuid.size() != 36) // Wrong length
+            return false;
+        for (size_t i = 0; i < uuid.size(); ++i) // Checks each character
+        {
+            char c = uuid[i];
+            bool dash = (i == 8 || i == 13 || i == 18 || i == 23); // Dash positions
+            if (dash ? c != '-' : !((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) // Wrong character
+                return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t MIN_SWEEP = 64; // Entries before the first sweep
+
+    std::string dir; // Spool directory
+    std::mutex mutex; // Protects uploads, holders and sweepAt
+    std::unordered_map<std::string, std::weak_ptr<PartialUpload>> uploads; // Partial uploads in use, by UUID
+    size_t sweepAt = MIN_SWEEP; // Map size that triggers the next sweep of unused entries
+    std::unordered_map<std::string, unsigned> holders; // Live sessions using each UUID
+};
+
+#endif // Ends the header guard
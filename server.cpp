@@ -1,31 +1,79 @@
 #include <iostream> // Includes the standard input-output stream library for console I/O
-#include <fstream> // Includes the file stream library for file operations
-#include <thread> // Includes the thread library for handling multiple clients
+#include <thread> // Includes the thread library for sizing the event loop pool
 #include <vector> // Includes the vector library for dynamic arrays
 #include <winsock2.h> // Includes the Winsock 2 library for socket programming
 #include <ws2tcpip.h> // Includes additional Winsock functions for IP address handling
 #include <cstdint> // Includes standard integer types like uint32_t and uint64_t
 #include <random> // Includes the random library for UUID generation
 #include <string> // Includes the string library for std::string operations
+#include <algorithm> // Includes the algorithm library for functions like std::min
+#include <cstring> // Includes memcpy for decoding fixed-size fields
+#include <memory> // Includes unique_ptr for owning the event loops
+#include "crc32.h" // Includes the shared CRC32 engine
+#include "event_loop.h" // Includes the IOCP event loop and Connection base class
+#include "file_io.h" // Includes positioned file reads and shared file handles
+#include "content_cache.h" // Includes the shared checksum and mapping cache
+#include "resumable_upload.h" // Includes durable per-session partial uploads
+#include "upload_pipeline.h" // Includes the staged receive/checksum/disk upload path
+#include "protocol_v2.h" // Includes the v2 frame format
+#include "compression.h" // Includes the per-frame transfer codecs
+#include "delta_sync.h" // Includes content-defined chunking for delta uploads
+#include "logger.h" // Includes the asynchronous console log
+#include "metrics.h" // Includes the process-wide counters and histograms
+#include "buffer_pool.h" // Includes the shared transfer memory budget
+#include "catalog.h" // Includes the index of served files
+#include "bandwidth.h" // Includes the fair send scheduler
+#include "merkle.h" // Includes chunk hash trees of large files
+#include "local_transport.h" // Includes the same-host AF_UNIX transport
+#include "work_pool.h" // Includes the shared worker threads
+#include <unordered_map> // Includes hash maps for the configured client weights
+#include <map> // Includes map for the v2 streams
+#include <deque> // Includes deque for handles handed to same-host clients
 
 #pragma comment(lib, "ws2_32.lib") // Links the Winsock library to the program
 using namespace std; // Uses the standard namespace to avoid prefixing std::
 
 #define PORT 54000 // Defines the port number for the server
-#define BUFFER_SIZE 4096 // Defines the buffer size for data transfer
+#define ZERO_COPY_SEGMENT (4ull * 1024 * 1024) // File range or mapped view queued per send step
+#define DELTA_COPY_BATCH (1u << 20) // Copied delta bytes read from the stored file per worker task
 
-// Computes the CRC32 checksum for data integrity verification
-uint32_t crc32(const char *data, size_t length, uint32_t prev = 0)
+// Runtime options, set from the command line in main()
+struct ServerConfig
 {
-    uint32_t crc = ~prev; // Inverts the previous CRC value (or 0 if none)
-    for (size_t i = 0; i < length; ++i) // Iterates over each byte of the data
-    {
-        crc ^= static_cast<uint8_t>(data[i]); // XORs the current byte with the CRC
-        for (int j = 0; j < 8; ++j) // Processes each bit of the byte
-            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1)); // Updates CRC using the polynomial
-    }
-    return ~crc; // Returns the inverted CRC value
-}
+    bool zeroCopy = true; // Sends downloads with TransmitFile instead of copying through user space
+    uint64_t cacheBytes = 1ull << 30; // Byte budget of the content cache
+    bool cacheMapping = true; // Keeps small served files mapped in memory
+    unsigned int hashThreads = 2; // Threads that compute checksums of cold files
+    unsigned int workerThreads = max(2u, thread::hardware_concurrency()); // Threads for blocking session work (flushes, whole-file reads)
+    unsigned int merkleThreads = max(1u, thread::hardware_concurrency()); // Workers that hash the chunks of one file for its tree (at most workerThreads)
+    string root = "."; // Directory whose files are served and uploaded to
+    bool watchRoot = true; // Keeps the catalog current with change notifications
+    string spoolDir; // Directory for resumable upload data and journals (default: .partial under the root)
+    Durability durability = Durability::OnClose; // How far uploads are flushed before they replace the target
+    bool overlappedWrites = true; // Queues asynchronous disk writes instead of writing synchronously
+    size_t uploadBufferSize = 1 << 20; // Size of one pooled upload buffer
+    size_t uploadBuffers = 32; // Pooled upload buffers shared by all sessions
+    bool compression = true; // Accepts compression on v2 streams whose client offers it
+    Logger::Level logLevel = Logger::Level::Info; // Lowest level printed on the console
+    size_t chunkSize = 256 * 1024; // Size of one pooled chunk for copied downloads and compressed frames
+    size_t memoryBudget = 256 << 20; // Transfer memory shared by all connections
+    size_t connectionMemory = 8 << 20; // Transfer memory one connection may hold
+    uint64_t bandwidth = 0; // Bytes per second sent to all clients together (0 = unlimited)
+    uint64_t clientBandwidth = 0; // Bytes per second sent to one client (0 = unlimited)
+    unordered_map<string, uint32_t> weights; // Bandwidth shares by session UUID (default 1)
+    bool localTransport = true; // Also accepts same-host clients on an AF_UNIX socket
+    string localPath; // Socket file for same-host clients (default: in the temporary directory, named after the port)
+};
+
+ServerConfig config; // Active server configuration
+unique_ptr<ContentCache> contentCache; // Checksums and views of served files, shared by all loops
+unique_ptr<UploadRegistry> uploadRegistry; // Resumable uploads by session UUID, shared by all loops
+unique_ptr<UploadPipeline> uploadPipeline; // Checksum and disk writer stages for uploads, shared by all loops
+unique_ptr<BufferPool> bufferPool; // Send chunks and the memory budget, shared by all loops
+unique_ptr<Catalog> catalog; // Files under the served root, shared by all loops
+unique_ptr<WorkPool> workPool; // Threads for blocking session work, shared by all loops
+unique_ptr<Bandwidth> bandwidth; // Send scheduler and rate limits, shared by all loops
+unique_ptr<Merkle::Cache> merkleTrees; // Chunk hash trees of requested files, shared by all loops
 
 // Generates a random UUID version 4
 string generate_uuid_v4()
@@ -53,155 +101,1824 @@ string generate_uuid_v4()
     return string(buf); // Returns the UUID as a string
 }
 
-// Sends all data in the buffer, handling partial sends
-bool sendAll(SOCKET sock, const char *data, int totalLen)
+// Per-client protocol state machine; replaces the blocking thread-per-client handler.
+// Runs entirely on its event loop thread, so every step must return without waiting on the network.
+class ClientSession : public Connection
 {
-    int sent = 0; // Tracks the number of bytes sent
-    while (sent < totalLen) // Continues until all bytes are sent
+public:
+    // Wraps an accepted socket; local sessions came in over the AF_UNIX socket from process peerPid
+    explicit ClientSession(SOCKET clientSocket, bool local = false, DWORD peerPid = 0)
+        : Connection(clientSocket), local(local), peerPid(peerPid)
     {
-        int r = send(sock, data + sent, totalLen - sent, 0); // Sends remaining data
-        if (r == SOCKET_ERROR || r == 0) // Checks for errors or disconnection
-            return false; // Returns false if send fails
-        sent += r; // Updates the number of bytes sent
     }
-    return true; // Returns true if all data is sent successfully
-}
 
-// Receives exactly the specified number of bytes
-bool recvExact(SOCKET sock, char *buffer, int bytesToRecv)
-{
-    int received = 0; // Tracks the number of bytes received
-    while (received < bytesToRecv) // Continues until all bytes are received
+protected:
+    // Assigns a UUID and sends it to the client
+    void onStart() override
     {
-        int r = recv(sock, buffer + received, bytesToRecv - received, 0); // Receives remaining data
-        if (r <= 0) // Checks for errors or disconnection
-            return false; // Returns false if receive fails
-        received += r; // Updates the number of bytes received
+        clientUUID = generate_uuid_v4(); // Generates a unique UUID for the client
+        uploadRegistry->hold(clientUUID, false); // Nobody else may resume it while this session lives
+        memory = make_shared<BufferPool::Account>(memoryWake()); // Charged for this session's transfer buffers
+        flow = bandwidth->join(clientUUID, bandwidthWake()); // Sends are paced by the scheduler
+
+        uint32_t uuidLen = static_cast<uint32_t>(clientUUID.size()); // Gets the length of the UUID
+        queueSend(reinterpret_cast<const char *>(&uuidLen), sizeof(uuidLen)); // Sends UUID length to client
+        queueSend(clientUUID.c_str(), clientUUID.size()); // Sends UUID to client
+
+        LOG_DEBUG("[Server] Assigned UUID to client: " << clientUUID << (local ? " (same host)" : "")); // Prints assigned UUID
     }
-    return true; // Returns true if all data is received successfully
-}
 
-// Handles file download requests from a client
-void handleDownload(SOCKET clientSocket, const string &clientUUID)
-{
-    cout << "[Server][" << clientUUID << "] Download request received.\n"; // Prints download request message
+    // Parses as many commands and payload bytes as the buffered input allows
+    size_t onData(const char *data, size_t length) override
+    {
+        size_t used = 0; // Bytes consumed so far
+        while (used < length && !isClosing()) // Continues while input remains
+        {
+            const char *in = data + used; // Unconsumed input
+            size_t avail = length - used; // Its length
+            size_t step = 0; // Bytes consumed by this step (0 = waiting for more input)
+            switch (state) // Dispatches on the protocol state
+            {
+            case AWAIT_COMMAND: // Expecting a one-byte command
+                step = 1; // Takes the command byte
+                handleCommand(in[0]); // Starts the matching state machine
+                break;
+            case UPLOAD_SIZE: // Expecting the 8-byte upload size
+                step = parseUploadSize(in, avail);
+                break;
+            case UPLOAD_DATA: // Receiving upload payload
+                step = receiveUpload(in, avail); // Stores as much payload as is buffered
+                break;
+            case RESUME_ID: // Expecting a session UUID to take over
+                step = parseResumeId(in, avail);
+                break;
+            case RANGE_REQUEST: // Expecting offset and length of a ranged download
+                step = parseRangeRequest(in, avail);
+                break;
+            case PARTIAL_BEGIN: // Expecting the size of a resumable upload
+                step = parsePartialBegin(in, avail);
+                break;
+            case WRITE_HEADER: // Expecting offset and length of an upload range
+                step = parseWriteHeader(in, avail);
+                break;
+            case WRITE_DATA: // Receiving upload range payload
+                step = receiveWrite(in, avail);
+                break;
+            case WRITE_CRC: // Expecting the CRC of an upload range
+                step = parseWriteCrc(in, avail);
+                break;
+            case DELTA_HEADER: // Expecting size and CRC of a delta upload
+                step = parseDeltaHeader(in, avail);
+                break;
+            case DELTA_OP: // Expecting a copy, literal or end op
+                step = parseDeltaOp(in, avail);
+                break;
+            case DELTA_LITERAL: // Receiving literal bytes
+                step = receiveDeltaLiteral(in, avail);
+                break;
+            case VERSION_REQUEST: // Expecting the client's protocol version
+                step = parseVersion(in, avail);
+                break;
+            case OPEN_NAME: // Expecting the name of the file to work on
+                step = parseOpenName(in, avail);
+                break;
+            case LIST_REQUEST: // Expecting prefix, cursor and page size of a listing
+                step = parseListRequest(in, avail);
+                break;
+            case FRAME_HEADER: // v2: expecting a frame header
+                step = parseFrameHeader(in, avail);
+                break;
+            case FRAME_CONTROL: // v2: expecting a control frame payload
+                step = parseControlFrame(in, avail);
+                break;
+            case FRAME_DATA: // v2: receiving DATA payload
+                step = receiveFrameData(in, avail);
+                break;
+            default: // Downloading: further commands wait until the file has been sent
+                break;
+            }
+            if (step == 0) // Nothing could be consumed
+                break; // Waits for more input (or for the download to finish)
+            used += step; // Advances past the consumed bytes
+        }
+        return used; // Reports how much input was consumed
+    }
 
-    ifstream file("testfile.txt", ios::binary); // Opens the file to send in binary mode
-    if (!file) // Checks if the file was opened successfully
+    // Refills the send queue while a download is in progress
+    void onWritable() override
     {
-        cerr << "[Server][" << clientUUID << "] Cannot open file.\n"; // Prints error message if file not found
-        uint64_t zero = 0; // Sets file size to zero to indicate failure
-        sendAll(clientSocket, reinterpret_cast<const char *>(&zero), sizeof(zero)); // Sends zero file size
-        return; // Exits the function
+        if (listingFill) // A long reply is still being queued
+            pumpListing(); // Queues the next pieces
+        else if (state == DOWNLOADING) // Only downloads produce output incrementally
+            pumpDownload(); // Queues the next chunks
+        else if (!streams.empty()) // v2 streams share the socket
+            pumpStreams(); // Queues the next frames
     }
 
-    file.seekg(0, ios::end); // Moves file pointer to the end to get file size
-    uint64_t fileSize = static_cast<uint64_t>(file.tellg()); // Gets the file size
-    file.seekg(0, ios::beg); // Moves file pointer back to the beginning
+    // Logs the end of the session
+    void onClosed() override
+    {
+        if (upload && (state == UPLOAD_DATA || state == DELTA_OP || state == DELTA_LITERAL || state == DELTA_COPY)) // Upload cut off mid-stream
+            upload->abort(); // Discards the temp file, keeping the old target
+        if (writeOk && (state == WRITE_DATA || state == WRITE_CRC)) // Ranged upload cut off mid-range
+            partial->release(writeOffset); // Another connection may send the range
+        while (!streams.empty()) // v2 uploads cut off mid-stream
+            dropStream(streams.begin()); // Also returns their held-back bytes to the budget
+        bandwidth->leave(flow); // Unused credit goes to other sessions
+        uploadRegistry->release(clientUUID); // The UUID may be resumed again
+        revokeHandoffs(); // Handles whose reply never went out would leak in the client
+        if (!quitRequested) // The peer went away without sending 'Q'
+            LOG_INFO("[Server][" << clientUUID << "] Client disconnected."); // Prints disconnection message
+        LOG_DEBUG("[Server][" << clientUUID << "] Connection closed."); // Prints connection closed message
+    }
 
-    vector<char> fileBuffer(static_cast<size_t>(fileSize)); // Creates a buffer to hold the entire file
-    file.read(fileBuffer.data(), fileSize); // Reads the file into the buffer
-    uint32_t crc = crc32(fileBuffer.data(), (size_t)fileSize, 0); // Computes CRC for the file
-    file.clear(); // Clears any error flags
-    file.seekg(0, ios::beg); // Moves file pointer back to the beginning
+private:
+    enum State // Protocol states
+    {
+        AWAIT_COMMAND, // Waiting for a command byte
+        UPLOAD_SIZE, // Waiting for the upload size
+        UPLOAD_DATA, // Receiving upload payload
+        UPLOAD_COMMIT, // Waiting for the disk writer to publish the upload
+        RESUME_ID, // Waiting for a session UUID ('I' or 'J')
+        RANGE_REQUEST, // Waiting for a range ('G')
+        PARTIAL_BEGIN, // Waiting for a resumable upload size ('P')
+        WRITE_HEADER, // Waiting for an upload range header ('W')
+        WRITE_DATA, // Receiving upload range payload
+        WRITE_CRC, // Waiting for the upload range CRC
+        WRITE_COMMIT, // Waiting for a worker to flush and journal the range
+        DOWNLOAD_LOOKUP, // Waiting for the content cache
+        DOWNLOADING, // Sending a file
+        SIGNATURE, // Chunking the stored upload for a delta signature ('Y')
+        MERKLE, // Hashing the selected file for its chunk tree ('M')
+        HANDOFF, // Waiting for the content cache before handing the file over ('H')
+        DELTA_HEADER, // Waiting for size and CRC of a delta upload ('Z')
+        DELTA_OP, // Waiting for the next delta op
+        DELTA_LITERAL, // Receiving literal bytes of a delta upload
+        DELTA_COPY, // Waiting for a worker to read copied chunks from the stored file
+        DELTA_COMMIT, // Waiting for the disk writer to verify and publish the rebuilt file
+        VERSION_REQUEST, // Waiting for the client's protocol version ('V')
+        OPEN_NAME, // Waiting for a file name ('O')
+        LIST_REQUEST, // Waiting for a listing request ('L')
+        FRAME_HEADER, // v2: waiting for a frame header
+        FRAME_CONTROL, // v2: waiting for a control frame payload
+        FRAME_DATA // v2: receiving DATA payload
+    };
 
-    sendAll(clientSocket, reinterpret_cast<const char *>(&fileSize), sizeof(fileSize)); // Sends file size to client
 
-    char buffer[BUFFER_SIZE]; // Buffer for sending file data
-    while (file) // Continues until the entire file is read
+    // One v2 stream: a download or upload multiplexed with others on this connection
+    struct Stream
     {
-        file.read(buffer, sizeof(buffer)); // Reads data into buffer
-        streamsize bytesRead = file.gcount(); // Gets the number of bytes read
-        if (bytesRead > 0) // Checks if data was read
-            sendAll(clientSocket, buffer, static_cast<int>(bytesRead)); // Sends data to client
+        uint32_t id = 0; // Client-chosen stream ID
+        char op = 0; // 'D' or 'U'
+        string name; // Catalog name of the file
+        uint64_t window = 0; // Download: bytes we may still send; upload: bytes the client may still send
+        ContentCache::EntryPtr entry; // Download: file being sent
+        bool ready = false; // Download: headers sent, data may flow
+        bool small = false; // Download: short enough to go ahead of bulk transfers
+        uint64_t offset = 0; // Download: next file offset to send
+        uint64_t remaining = 0; // Download: bytes not yet queued
+        uint32_t crc = 0; // Download: CRC of the range
+        shared_ptr<UploadPipeline::Upload> upload; // Upload: pipeline entry
+        uint64_t size = 0; // Upload: announced size
+        uint64_t received = 0; // Upload: bytes received
+        vector<char> pending; // Upload: bytes the pipeline could not take yet
+        uint32_t credit = 0; // Upload: consumed bytes not yet returned as WINDOW
+        uint32_t pendingWire = 0; // Upload: wire bytes of the frames held back in pending (credited once it drains)
+        bool committing = false; // Upload: complete, waiting for the writer
+        Compression::Codec codec = Compression::NONE; // Codec negotiated for this stream's DATA frames
+        uint64_t wireBytes = 0; // DATA payload bytes on the wire, for the log
+        Metrics::Clock::time_point started = Metrics::Clock::now(); // When OPEN arrived
+    };
+
+    // Copies a fixed-size field out of the input if it is complete
+    template <typename T>
+    static bool take(const char *in, size_t avail, T &out)
+    {
+        if (avail < sizeof(T)) // Field not fully received yet
+            return false;
+        memcpy(&out, in, sizeof(T)); // Decodes the field (host byte order, as in the rest of the protocol)
+        return true;
     }
 
-    sendAll(clientSocket, reinterpret_cast<const char *>(&crc), sizeof(crc)); // Sends CRC to client
-    cout << "[Server][" << clientUUID << "] File sent. CRC: " << crc << "\n"; // Prints completion message
-}
+    // Dispatches a command byte
+    void handleCommand(char cmd)
+    {
+        if (cmd == 'D') // If client requests download
+            handleDownload(); // Starts the download state machine
+        else if (cmd == 'U') // If client requests upload
+            handleUpload(); // Starts the upload state machine
+        else if (cmd == 'G') // If client requests a byte range of the file
+            state = RANGE_REQUEST; // Waits for offset and length
+        else if (cmd == 'I' || cmd == 'J') // If client wants to continue an earlier session, or join a live one as an extra stream
+        {
+            resumeJoin = cmd == 'J'; // Joining needs the session to be live, resuming needs it free
+            state = RESUME_ID; // Waits for the UUID
+        }
+        else if (cmd == 'P') // If client starts or resumes a ranged upload
+            state = PARTIAL_BEGIN; // Waits for the total size
+        else if (cmd == 'W') // If client sends one upload range
+            state = WRITE_HEADER; // Waits for offset and length
+        else if (cmd == 'F') // If client asks to publish its ranged upload
+            handleFinalize(); // Checks coverage and publishes
+        else if (cmd == 'Y') // If client wants the chunk signature of the stored upload
+            handleSignature(); // Chunks it on a worker thread
+        else if (cmd == 'Z') // If client sends a delta against that signature
+            state = DELTA_HEADER; // Waits for size and CRC
+        else if (cmd == 'S') // If client asks for the server's metrics
+            handleStats(); // Replies with a JSON snapshot
+        else if (cmd == 'V') // If client offers a newer protocol version
+            state = VERSION_REQUEST; // Waits for the version number
+        else if (cmd == 'O') // If client picks the file later commands work on
+            state = OPEN_NAME; // Waits for the name
+        else if (cmd == 'L') // If client lists the served files
+            state = LIST_REQUEST; // Waits for prefix and cursor
+        else if (cmd == 'M') // If client wants the chunk hash tree of the selected file
+            handleMerkle(); // Hashes it on a worker thread
+        else if (cmd == 'H') // If a same-host client wants the selected file as a handle
+            handleHandoff(); // Duplicates it into the client's process
+        else if (cmd == 'Q') // If client requests quit
+        {
+            LOG_INFO("[Server][" << clientUUID << "] Client requested QUIT."); // Prints quit message
+            quitRequested = true; // Remembers that the client asked to leave
+            closeAfterFlush(); // Closes once pending output is sent
+        }
+        else
+            LOG_WARN("[Server][" << clientUUID << "] Unknown command: " << cmd); // Prints error for invalid command
+    }
 
-// Handles file upload requests from a client
-void handleUpload(SOCKET clientSocket, const string &clientUUID)
-{
-    cout << "[Server][" << clientUUID << "] Upload request received.\n"; // Prints upload request message
+    // 'I': uuidLen(4) uuid -> status(1). Lets a reconnecting client reclaim its session UUID; refused while
+    // a live session holds it. 'J' has the same fields and joins a live session as one more stream of
+    // its striped upload (the claims of PartialUpload keep the streams' ranges apart).
+    size_t parseResumeId(const char *in, size_t avail)
+    {
+        uint32_t len = 0; // Length of the claimed UUID
+        if (!take(in, avail, len)) // Length not fully received yet
+            return 0;
+        if (len > 64) // Far longer than any UUID
+        {
+            LOG_WARN("[Server][" << clientUUID << "] Invalid session resume."); // Prints error message
+            close(); // The stream cannot be resynchronized
+            return 0;
+        }
+        if (avail < sizeof(len) + len) // UUID not fully received yet
+            return 0;
+        string claimed(in + sizeof(len), len); // The UUID the client had before
+        char status = claimed == clientUUID || (UploadRegistry::validUUID(claimed) && uploadRegistry->hold(claimed, resumeJoin)) ? 1 : 0; // Only well-formed UUIDs name spool files
+        if (!status) // Malformed, or in use by another session
+            LOG_WARN("[Server][" << clientUUID << "] Refused to " << (resumeJoin ? "join" : "resume") << " session " << claimed << "."); // Prints refusal message
+        else if (claimed != clientUUID) // Accepted
+        {
+            uploadRegistry->release(clientUUID); // Gives up the identity it had
+            LOG_INFO("[Server][" << clientUUID << "] Resumed session " << claimed << "."); // Prints resume message
+            clientUUID = claimed; // Continues under the old identity
+            bandwidth->moveTo(flow, claimed); // Shares the old identity's rate and weight
+        }
+        queueSend(&status, 1); // Reports whether the UUID was taken over
+        state = AWAIT_COMMAND; // Ready for the next command
+        return sizeof(len) + len; // Consumes length and UUID
+    }
+
+    // Decodes a name field nameLen(2) name at in; returns its size, 0 if incomplete (closes on oversized names)
+    size_t takeName(const char *in, size_t avail, string &name)
+    {
+        uint16_t len = 0; // Length of the name
+        if (!take(in, avail, len)) // Length not fully received yet
+            return 0;
+        if (len > Catalog::MAX_NAME) // Longer than any name the catalog accepts
+        {
+            LOG_WARN("[Server][" << clientUUID << "] Oversized file name."); // Prints error message
+            close(); // The stream cannot be resynchronized
+            return 0;
+        }
+        if (avail < sizeof(len) + len) // Name not fully received yet
+            return 0;
+        name.assign(in + sizeof(len), len); // The name
+        return sizeof(len) + len; // Size of the field
+    }
+
+    // 'O': nameLen(2) name -> status(1): 0 = invalid name, 1 = served, 2 = not served yet (an upload creates it).
+    // Selects the file later downloads, uploads, signatures and deltas of this session work on.
+    size_t parseOpenName(const char *in, size_t avail)
+    {
+        string name; // Requested name
+        size_t used = takeName(in, avail, name); // Name field
+        if (used == 0) // Incomplete (or the connection was closed)
+            return 0;
+        Catalog::Info info; // Unused; only existence is reported
+        char status = !Catalog::validName(name) ? 0 : catalog->find(name, info) ? 1 : 2; // Outcome
+        if (status) // Valid: later commands use it
+        {
+            downloadName = name;
+            uploadName = name;
+            LOG_DEBUG("[Server][" << clientUUID << "] Opened " << name << "."); // Prints open message
+        }
+        else
+            LOG_WARN("[Server][" << clientUUID << "] Invalid file name."); // Prints error message
+        queueSend(&status, 1); // Reports the outcome
+        state = AWAIT_COMMAND; // Ready for the next command
+        return used; // Consumes the name
+    }
+
+    // 'L': prefixLen(2) prefix afterLen(2) after max(4) -> count(4) more(1) {nameLen(2) name size(8) mtime(8) crc(4) crcKnown(1)}*count.
+    // Lists served files in name order; the client passes the last name it got as after to fetch the next page.
+    size_t parseListRequest(const char *in, size_t avail)
+    {
+        string prefix, after; // Name filter and cursor
+        size_t used = takeName(in, avail, prefix); // Prefix field
+        if (used == 0) // Incomplete (or the connection was closed)
+            return 0;
+        size_t afterUsed = takeName(in + used, avail - used, after); // Cursor field
+        if (afterUsed == 0)
+            return 0;
+        used += afterUsed;
+        uint32_t max = 0; // Page size asked for
+        if (!take(in + used, avail - used, max)) // Page size not fully received yet
+            return 0;
+        used += sizeof(max);
+
+        bool more = false; // Listing cut short
+        vector<Catalog::Listing> page = catalog->list(prefix, after, max, more); // Entries in name order
+        vector<char> reply(5); // count(4) more(1), then the entries
+        uint32_t count = static_cast<uint32_t>(page.size());
+        memcpy(reply.data(), &count, 4);
+        reply[4] = more ? 1 : 0;
+        for (const Catalog::Listing &entry : page) // One record per file
+        {
+            uint16_t len = static_cast<uint16_t>(entry.first.size()); // Names are at most MAX_NAME long
+            size_t at = reply.size(); // Where the record starts
+            reply.resize(at + 2 + len + 21);
+            memcpy(&reply[at], &len, 2);
+            memcpy(&reply[at + 2], entry.first.data(), len);
+            memcpy(&reply[at + 2 + len], &entry.second.size, 8);
+            memcpy(&reply[at + 10 + len], &entry.second.mtime, 8);
+            memcpy(&reply[at + 18 + len], &entry.second.crc, 4);
+            reply[at + 22 + len] = entry.second.crcKnown ? 1 : 0;
+        }
+        queueSend(move(reply)); // Sends the page
+        LOG_DEBUG("[Server][" << clientUUID << "] Listed " << count << " files" << (more ? " (more follow)." : ".")); // Prints listing message
+        state = AWAIT_COMMAND; // Ready for the next command
+        return used; // Consumes the request
+    }
+
+    // 'G': offset(8) length(8) -> totalSize(8) fileCrc(4) rangeLength(8) data rangeCrc(4). Length 0 means "to the end".
+    size_t parseRangeRequest(const char *in, size_t avail)
+    {
+        uint64_t range[2]; // Offset and length
+        if (!take(in, avail, range)) // Request not fully received yet
+            return 0;
+        LOG_DEBUG("[Server][" << clientUUID << "] Range request received: offset " << range[0] << ", length " << range[1] << "."); // Prints range request message
+        rangeMode = true; // Answers with the ranged header and trailer
+        rangeOffset = range[0]; // Requested offset
+        rangeLength = range[1]; // Requested length
+        lookupDownload(); // Fetches size and checksums from the cache
+        return sizeof(range); // Consumes the request
+    }
 
-    ofstream file("uploaded_from_client.txt", ios::binary); // Opens output file in binary mode
-    if (!file) // Checks if the file was opened successfully
+    // 'P': totalSize(8) -> verifiedOffset(8). Starts or resumes the ranged upload of this session UUID.
+    size_t parsePartialBegin(const char *in, size_t avail)
     {
-        cerr << "[Server][" << clientUUID << "] Cannot open file for upload.\n"; // Prints error message
-        return; // Exits the function
+        uint64_t totalSize = 0; // Size of the file the client will upload
+        if (!take(in, avail, totalSize)) // Size not fully received yet
+            return 0;
+        partial = uploadRegistry->get(clientUUID); // Finds progress of this session, possibly from disk
+        uint64_t verified = partial->begin(totalSize); // Keeps progress if the size still matches
+        queueSend(reinterpret_cast<const char *>(&verified), sizeof(verified)); // Tells the client where to continue
+        LOG_DEBUG("[Server][" << clientUUID << "] Resumable upload of " << totalSize << " bytes, verified up to " << verified << "."); // Prints progress
+        state = AWAIT_COMMAND; // Ready for range writes
+        return sizeof(totalSize); // Consumes the size
     }
 
-    uint64_t fileSize = 0; // Stores the size of the file to be uploaded
-    if (!recvExact(clientSocket, reinterpret_cast<char *>(&fileSize), sizeof(fileSize))) // Receives file size
+    // 'W': offset(8) length(4) data crc(4) -> status(1) verifiedOffset(8)
+    size_t parseWriteHeader(const char *in, size_t avail)
     {
-        cerr << "[Server][" << clientUUID << "] Failed to receive file size.\n"; // Prints error message
-        return; // Exits the function
+        struct
+        {
+            uint64_t offset; // Range offset
+            uint32_t length; // Range length
+        } header; // Fields as they appear on the wire
+        if (avail < 12) // Header not fully received yet
+            return 0;
+        memcpy(&header.offset, in, 8); // Decodes the offset
+        memcpy(&header.length, in + 8, 4); // Decodes the length
+        writeOffset = header.offset; // Where the range goes
+        writeLength = header.length; // How long it is
+        writeReceived = 0; // Nothing received yet
+        writeCRC = 0; // Running CRC of the range
+        writeOk = partial && partial->claim(writeOffset, writeLength); // Only after 'P', and never over verified bytes or another connection's range
+        writeDuplicate = !writeOk && partial && partial->verified(writeOffset, writeLength, writeDuplicateCRC); // Resend of a range whose reply was lost
+        state = writeLength > 0 ? WRITE_DATA : WRITE_CRC; // Moves on to the payload
+        return 12; // Consumes the header
     }
 
-    char buffer[BUFFER_SIZE]; // Buffer for receiving file data
-    uint32_t crc = 0; // Initializes CRC for integrity check
-    uint64_t totalReceived = 0; // Tracks total bytes received
+    // Writes upload range bytes straight to the partial file; returns how many were used
+    size_t receiveWrite(const char *in, size_t avail)
+    {
+        size_t take = static_cast<size_t>(min<uint64_t>(avail, writeLength - writeReceived)); // Never reads past this range
+        if (writeOk && !partial->write(writeOffset + writeReceived, in, take)) // Positioned write into the partial file (payload of rejected ranges is drained)
+        {
+            partial->release(writeOffset); // Gives the range up; the client resends it
+            writeOk = false;
+        }
+        writeCRC = CRC32::update(writeCRC, in, take); // Updates CRC with received data
+        writeReceived += take; // Counts the bytes
+        if (writeReceived == writeLength) // Range payload complete
+            state = WRITE_CRC; // Waits for its checksum
+        return take; // Reports consumed bytes
+    }
 
-    while (totalReceived < fileSize) // Continues until all file bytes are received
+    // Verifies an upload range; intact ones are flushed and journaled on a worker, off the loop thread
+    size_t parseWriteCrc(const char *in, size_t avail)
     {
-        int bytesToRead = (int)min<uint64_t>(sizeof(buffer), fileSize - totalReceived); // Calculates bytes to read
-        int r = recv(clientSocket, buffer, bytesToRead, 0); // Receives data into buffer
-        if (r <= 0) // Checks for errors or disconnection
+        uint32_t expected = 0; // CRC computed by the client
+        if (!take(in, avail, expected)) // CRC not fully received yet
+            return 0;
+        if (writeCRC != expected) // Damaged in transit
+            Metrics::add(Metrics::CRC_MISMATCHES);
+        if (!writeOk) // Refused or duplicate range: nothing to journal
         {
-            cerr << "[Server][" << clientUUID << "] Connection lost during upload.\n"; // Prints error message
-            return; // Exits the function
+            bool same = writeDuplicate && writeCRC == expected && expected == writeDuplicateCRC; // Already verified: accepted again only if the resent bytes are the same
+            writeDuplicate = false;
+            writeCommitted(same, partial ? partial->verifiedPrefix() : 0);
+            return sizeof(expected); // Consumes the CRC
         }
-        file.write(buffer, r); // Writes received data to file
-        crc = crc32(buffer, r, crc); // Updates CRC with received data
-        totalReceived += r; // Updates total bytes received
+        writeOk = false; // The claim now belongs to the commit
+        state = WRITE_COMMIT; // Later commands wait for the verdict
+        pauseReading(); // Holds them back
+        shared_ptr<PartialUpload> target = partial; // Upload the range belongs to
+        uint64_t offset = writeOffset; // Range bounds and checksums
+        uint32_t length = writeLength, crc = writeCRC;
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        workPool->post([ownerLoop, connId, target, offset, length, crc, expected]() { // Two flushes: too slow for the loop thread
+            bool ok = target->commit(offset, length, crc, expected); // Journals intact ranges only (ends the claim either way)
+            uint64_t verified = target->verifiedPrefix(); // Contiguous verified bytes
+            ownerLoop->postToConnection(connId, [ok, verified](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->writeCommitted(ok, verified); // Sends the verdict
+            });
+        });
+        return sizeof(expected); // Consumes the CRC
     }
 
-    sendAll(clientSocket, reinterpret_cast<const char *>(&crc), sizeof(crc)); // Sends CRC to client
-    cout << "[Server][" << clientUUID << "] Upload complete. CRC: " << crc << "\n"; // Prints completion message
-}
+    // Reports the verdict on an upload range and overall progress: status(1) verifiedOffset(8)
+    void writeCommitted(bool ok, uint64_t verified)
+    {
+        char status = ok ? 1 : 0; // Outcome
+        if (!ok) // Damaged or rejected range
+            LOG_WARN("[Server][" << clientUUID << "] Range at " << writeOffset << " rejected, client will resend it."); // Prints error message
+        queueSend(&status, 1); // Reports the outcome
+        queueSend(reinterpret_cast<const char *>(&verified), sizeof(verified)); // Reports overall progress
+        state = AWAIT_COMMAND; // Ready for the next range
+        resumeReading(); // Processes commands that arrived meanwhile
+    }
 
-// Handles a single client connection
-void handleClient(SOCKET clientSocket)
-{
-    string clientUUID = generate_uuid_v4(); // Generates a unique UUID for the client
+    // 'F' -> status(1) fileCrc(4). Publishes a fully verified ranged upload.
+    void handleFinalize()
+    {
+        uint32_t crc = 0; // Whole-file CRC, combined from the range CRCs
+        char status = (partial && catalog->makeParents(uploadName) && partial->finalize(catalog->pathOf(uploadName), crc)) ? 1 : 0; // Publishes atomically
+        if (status) // Published
+        {
+            catalog->published(uploadName, crc); // Listed with its CRC right away
+            uploadRegistry->remove(clientUUID); // Progress is no longer needed
+            partial.reset(); // Ends the ranged upload
+            LOG_INFO("[Server][" << clientUUID << "] Resumable upload complete. CRC: " << crc); // Prints completion message
+        }
+        else
+            LOG_WARN("[Server][" << clientUUID << "] Upload not complete, cannot publish."); // Prints error message
+        queueSend(&status, 1); // Reports the outcome
+        queueSend(reinterpret_cast<const char *>(&crc), sizeof(crc)); // Reports the checksum
+    }
+
+    // 'S' -> length(4) json. Snapshot of the process-wide metrics.
+    void handleStats()
+    {
+        string report = Metrics::json(); // Sums every thread's shard
+        report.insert(report.size() - 1, ",\"bandwidth\":" + bandwidth->json()); // Adds each client's share
+        uint32_t length = static_cast<uint32_t>(report.size()); // Length prefix
+        queueSend(reinterpret_cast<const char *>(&length), sizeof(length)); // Sends the length
+        queueSend(report.data(), report.size()); // Sends the report
+    }
+
+    // 'Y' -> count(4) {length(4) hash(8)}*count. Chunks the stored upload off the loop thread.
+    void handleSignature()
+    {
+        state = SIGNATURE; // Later commands wait for the reply
+        pauseReading(); // Holds them back
+        FileIO::Handle base = FileIO::openRead(catalog->pathOf(uploadName)); // Copy the client will diff against (kept open, so a later replace cannot change it)
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        workPool->post([ownerLoop, connId, base]() { // Reads the whole file: too slow for the loop thread
+            auto chunks = make_shared<vector<DeltaSync::Chunk>>(); // Signature of the copy
+            uint64_t size = 0; // Its size
+            Metrics::Timer timer(Metrics::HASH_NS); // Chunking is hashing work
+            if (!base || !FileIO::sizeOf(base, size) || !DeltaSync::scan(base, size, [&](const DeltaSync::Chunk &c, const char *) { chunks->push_back(c); }))
+                chunks->clear(); // No usable copy: everything will be sent as literals
+            ownerLoop->postToConnection(connId, [base, chunks](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->signatureReady(base, chunks); // Sends the reply
+            });
+        });
+    }
 
-    uint32_t uuidLen = static_cast<uint32_t>(clientUUID.size()); // Gets the length of the UUID
-    sendAll(clientSocket, reinterpret_cast<const char *>(&uuidLen), sizeof(uuidLen)); // Sends UUID length to client
-    sendAll(clientSocket, clientUUID.c_str(), (int)clientUUID.size()); // Sends UUID to client
+    // Sends the signature and remembers it for the 'Z' that follows
+    void signatureReady(FileIO::Handle base, shared_ptr<vector<DeltaSync::Chunk>> chunks)
+    {
+        deltaBase = chunks->empty() ? nullptr : base; // Source of copy ops
+        deltaChunks = move(*chunks);
+        uint32_t count = static_cast<uint32_t>(deltaChunks.size()); // Chunks in the signature
+        auto fill = [this, count](char *out, size_t offset, size_t length) { // count(4) {length(4) hash(8)}*count, encoded entry by entry
+            while (length > 0)
+            {
+                char entry[12]; // Field or entry the offset falls in
+                size_t start = 0, size = 4; // Its position and size in the reply
+                if (offset < 4) // Count
+                    memcpy(entry, &count, 4);
+                else // One entry per chunk, in file order
+                {
+                    size_t i = (offset - 4) / 12; // Chunk index
+                    memcpy(entry, &deltaChunks[i].length, 4);
+                    memcpy(entry + 4, &deltaChunks[i].hash, 8);
+                    start = 4 + i * 12;
+                    size = 12;
+                }
+                size_t n = min(length, start + size - offset); // Bytes of it that fit
+                memcpy(out, entry + (offset - start), n);
+                out += n;
+                offset += n;
+                length -= n;
+            }
+        };
+        startListing(4 + static_cast<size_t>(count) * 12, fill, [this, count]() { // Sends the signature
+            LOG_INFO("[Server][" << clientUUID << "] Sent delta signature of " << count << " chunks."); // Prints signature message
+            state = AWAIT_COMMAND; // Ready for the delta
+            resumeReading(); // Processes commands that arrived meanwhile
+        });
+    }
 
-    cout << "[Server] Assigned UUID to client: " << clientUUID << "\n"; // Prints assigned UUID
+    // Queues a reply of size bytes written by fill through pooled chunks as the socket drains, so a long
+    // one ('Y' signature, 'M' tree) stays within this session's memory budget; done runs once it is all queued
+    void startListing(size_t size, function<void(char *, size_t, size_t)> fill, function<void()> done)
+    {
+        listingSize = size;
+        listingQueued = 0;
+        listingFill = move(fill);
+        listingDone = move(done);
+        pumpListing();
+    }
 
-    while (true) // Main loop for handling client commands
+    // Queues the next pieces of the current long reply
+    void pumpListing()
     {
-        char cmd = 0; // Stores the client command
-        int r = recv(clientSocket, &cmd, 1, 0); // Receives the command
-        if (r <= 0) // Checks for errors or disconnection
+        uint64_t window = max<uint64_t>(SEND_LOW_WATER, 2 * bufferPool->chunkSize()); // Bytes to keep queued
+        while (listingQueued < listingSize && pendingSendBytes() < window) // Keeps the socket busy without copying the whole reply
         {
-            cout << "[Server][" << clientUUID << "] Client disconnected.\n"; // Prints disconnection message
-            break; // Exits the loop
+            BufferPool::ChunkPtr chunk = bufferPool->acquire(memory); // Memory for the next piece
+            if (!chunk) // Budget spent: memorySpace() continues
+                return;
+            size_t length = min(chunk->size(), listingSize - listingQueued); // Bytes in this piece
+            listingFill(chunk->data(), listingQueued, length);
+            queueView(chunk, chunk->data(), length); // The chunk returns to the pool once sent
+            listingQueued += length;
         }
+        if (listingQueued < listingSize) // Continued by onWritable()
+            return;
+        listingFill = nullptr; // Done producing
+        function<void()> done = move(listingDone); // May start the next command
+        listingDone = nullptr;
+        done();
+    }
 
-        if (cmd == 'D') // If client requests download
-            handleDownload(clientSocket, clientUUID); // Calls download handler
-        else if (cmd == 'U') // If client requests upload
-            handleUpload(clientSocket, clientUUID); // Calls upload handler
-        else if (cmd == 'Q') // If client requests quit
+    // 'M' -> status(1) [size(8) chunkSize(4) count(4) root(8) leaf(8)*count]. Hashes the file off the loop thread.
+    void handleMerkle()
+    {
+        state = MERKLE; // Later commands wait for the reply
+        pauseReading(); // Holds them back
+        Catalog::Info info; // Catalog entry of the selected file
+        string path = catalog->find(downloadName, info) ? catalog->pathOf(downloadName) : string(); // Only served files are hashed
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        workPool->post([ownerLoop, connId, path]() { // Reads the whole file on first use: too slow for the loop thread
+            auto reply = [ownerLoop, connId](bool ok, shared_ptr<const Merkle::Tree> tree) { // Called once the tree is known
+                ownerLoop->postToConnection(connId, [ok, tree](Connection *conn) { // Hops back to this session's loop
+                    static_cast<ClientSession *>(conn)->merkleReady(ok, tree); // Sends the reply
+                });
+            };
+            if (path.empty()) // Not a served file
+                reply(false, nullptr);
+            else // Cached unless the file changed; a pass already hashing it answers for it
+                merkleTrees->get(path, reply);
+        });
+    }
+
+    // Sends the tree (or status 0 if the file is missing, unreadable or too large)
+    void merkleReady(bool ok, shared_ptr<const Merkle::Tree> tree)
+    {
+        if (!ok)
+        {
+            char status = 0; // Not available
+            queueSend(&status, 1);
+            LOG_WARN("[Server][" << clientUUID << "] No hash tree for " << downloadName << "."); // Prints failure message
+            state = AWAIT_COMMAND; // Ready for the next command
+            resumeReading(); // Processes commands that arrived meanwhile
+            return;
+        }
+        uint32_t count = static_cast<uint32_t>(tree->leaves.size()); // Leaves sent
+        vector<char> head(25); // status(1) size(8) chunkSize(4) count(4) root(8), then the leaves
+        head[0] = 1;
+        memcpy(head.data() + 1, &tree->size, 8);
+        memcpy(head.data() + 9, &tree->chunkSize, 4);
+        memcpy(head.data() + 13, &count, 4);
+        memcpy(head.data() + 17, &tree->root, 8);
+        auto fill = [tree, head](char *out, size_t offset, size_t length) { // Leaves are copied straight from the cached tree
+            if (offset < head.size()) // Header
+            {
+                size_t n = min(length, head.size() - offset); // Header bytes in this piece
+                memcpy(out, head.data() + offset, n);
+                out += n;
+                offset += n;
+                length -= n;
+            }
+            if (length > 0)
+                memcpy(out, reinterpret_cast<const char *>(tree->leaves.data()) + (offset - head.size()), length);
+        };
+        startListing(head.size() + static_cast<size_t>(count) * 8, fill, [this, count]() { // Sends the tree
+            LOG_INFO("[Server][" << clientUUID << "] Sent hash tree of " << downloadName << " (" << count << " chunks)."); // Prints tree message
+            state = AWAIT_COMMAND; // Ready for the ranges
+            resumeReading(); // Processes commands that arrived meanwhile
+        });
+    }
+
+    // 'Z': size(8) crc(4). Starts rebuilding the file through the upload pipeline.
+    size_t parseDeltaHeader(const char *in, size_t avail)
+    {
+        if (avail < 12) // Header not fully received yet
+            return 0;
+        memcpy(&uploadSize, in, 8); // Size of the rebuilt file
+        memcpy(&deltaCrc, in + 8, 4); // CRC the client computed over its file
+        transferStart = Metrics::Clock::now(); // Duration ends when the file is published
+        uploadReceived = 0; // Bytes rebuilt so far
+        deltaOk = true; // No bad op yet
+        deltaCopied = 0;
+        deltaBatch.clear(); // No copies pending
+        deltaBatchBytes = 0;
+        upload = beginUpload(clientUUID); // Written to a temp file, renamed only if the CRC matches
+        if (!upload->ok()) // Temp file could not be created
+            LOG_ERROR("[Server][" << clientUUID << "] Cannot open file for upload."); // Prints error message (ops are still drained)
+        upload->expect(deltaCrc); // A wrong copy (or a hash collision) leaves the old file in place
+        state = DELTA_OP; // Ops follow
+        return 12; // Consumes the header
+    }
+
+    // Decodes and applies one op: 'C' index(4), 'L' length(4) or 'E'
+    size_t parseDeltaOp(const char *in, size_t avail)
+    {
+        if (!deltaHeld.empty()) // Copied bytes still wait for pipeline buffers
+            return 0;
+        if (in[0] == 'E') // End of the file
+        {
+            finishDelta();
+            return 1;
+        }
+        if (in[0] != 'C' && in[0] != 'L') // Unknown op: the stream cannot be resynchronized
         {
-            cout << "[Server][" << clientUUID << "] Client requested QUIT.\n"; // Prints quit message
-            break; // Exits the loop
+            LOG_WARN("[Server][" << clientUUID << "] Invalid delta op."); // Prints error message
+            upload->abort(); // Discards the temp file
+            close();
+            return 0;
         }
+        uint32_t value = 0; // Chunk index or literal length
+        if (!take(in + 1, avail - 1, value)) // Argument not fully received yet
+            return 0;
+        if (in[0] == 'L') // Literal bytes follow
+        {
+            deltaLiteral = value;
+            if (value > DeltaSync::MAX_LITERAL || uploadReceived + value > uploadSize) // Too long: drained but not stored
+                deltaOk = false;
+            state = value > 0 ? DELTA_LITERAL : DELTA_OP;
+            return 5;
+        }
+        if (value >= deltaChunks.size() || uploadReceived + deltaBatchBytes + deltaChunks[value].length > uploadSize) // Not in the signature, or past the end
+            deltaOk = false;
+        if (deltaOk) // Copies the chunk from the stored file, batched with the copy ops right behind it
+        {
+            deltaBatch.push_back(deltaChunks[value]);
+            deltaBatchBytes += deltaChunks[value].length;
+        }
+        if (!deltaBatch.empty() && (deltaBatchBytes >= DELTA_COPY_BATCH || avail < 10 || in[5] != 'C')) // No further copy op at hand
+            readCopies();
+        return 5; // Consumes the op
+    }
+
+    // Reads the batched copy chunks from the stored file on a worker, then continues in copiesRead()
+    void readCopies()
+    {
+        state = DELTA_COPY; // Later ops wait for the bytes
+        pauseReading(); // Holds them back
+        FileIO::Handle base = deltaBase; // Stored file the signature describes
+        auto chunks = make_shared<vector<DeltaSync::Chunk>>(move(deltaBatch)); // Chunks to read, in op order
+        deltaBatch.clear();
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        workPool->post([ownerLoop, connId, base, chunks]() { // Disk reads: too slow for the loop thread
+            auto data = make_shared<vector<char>>(); // Copied bytes, in op order
+            bool ok = true; // False if the stored file could not be read
+            Metrics::Timer timer(Metrics::DISK_NS); // Blocking reads
+            for (size_t i = 0; i < chunks->size() && ok;) // Adjacent chunks are read with one call
+            {
+                uint64_t offset = (*chunks)[i].offset; // Start of the run
+                size_t length = 0; // Bytes in the run
+                for (; i < chunks->size() && (*chunks)[i].offset == offset + length; ++i)
+                    length += (*chunks)[i].length;
+                size_t at = data->size(); // Where the run goes
+                data->resize(at + length);
+                ok = FileIO::readAt(base, offset, data->data() + at, length) == length;
+            }
+            ownerLoop->postToConnection(connId, [ok, data](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->copiesRead(ok, data); // Feeds the pipeline
+            });
+        });
+    }
+
+    // Passes copied bytes to the pipeline and goes on with the next op
+    void copiesRead(bool ok, shared_ptr<vector<char>> data)
+    {
+        deltaBatchBytes = 0;
+        state = DELTA_OP; // Ready for the next op
+        if (!ok) // Stored file unreadable
+            deltaOk = false;
         else
-            cerr << "[Server][" << clientUUID << "] Unknown command: " << cmd << "\n"; // Prints error for invalid command
+        {
+            uploadReceived += data->size();
+            deltaCopied += data->size();
+            deltaHeld = move(*data);
+            pushHeld(); // Into the pipeline, or held until a buffer frees up
+        }
+        if (deltaHeld.empty()) // Nothing waits for a buffer
+            resumeReading(); // Processes ops that arrived meanwhile
     }
 
-    closesocket(clientSocket); // Closes the client socket
-    cout << "[Server][" << clientUUID << "] Connection closed.\n"; // Prints connection closed message
-}
+    // Passes literal bytes of a delta to the pipeline; returns how many were used
+    size_t receiveDeltaLiteral(const char *in, size_t avail)
+    {
+        size_t take = min<size_t>(avail, deltaLiteral); // Never reads past this op
+        size_t used = deltaOk ? upload->push(in, take) : take; // Rejected literals are drained
+        if (used < take) // This upload's buffers are all in flight
+            pauseReading(); // Lets TCP flow control slow the sender until the disk catches up
+        if (deltaOk)
+            uploadReceived += used;
+        deltaLiteral -= static_cast<uint32_t>(used);
+        if (deltaLiteral == 0) // Literal complete
+            state = DELTA_OP;
+        return used; // Reports consumed bytes
+    }
+
+    // Pushes copied bytes into the pipeline; pauses input while some are left over
+    void pushHeld()
+    {
+        size_t used = upload->push(deltaHeld.data(), deltaHeld.size()); // Takes what the buffers allow
+        deltaHeld.erase(deltaHeld.begin(), deltaHeld.begin() + used);
+        if (!deltaHeld.empty()) // Waits for uploadSpace()
+            pauseReading();
+    }
+
+    // Publishes the rebuilt file if it is complete; the pipeline checks the CRC before the rename
+    void finishDelta()
+    {
+        state = DELTA_COMMIT; // Waits for the writer
+        pauseReading(); // Holds back later commands until the reply is sent
+        if (!deltaOk || uploadReceived != uploadSize) // Bad op or wrong length
+        {
+            upload->abort(); // Discards the temp file
+            deltaCommitted(false, 0);
+            return;
+        }
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        upload->finish([ownerLoop, connId](bool ok, uint32_t crc) { // Runs on the disk writer thread
+            ownerLoop->postToConnection(connId, [ok, crc](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->deltaCommitted(ok, crc); // Sends the reply
+            });
+        });
+    }
+
+    // Reports the outcome of a delta upload: status(1) crc(4)
+    void deltaCommitted(bool ok, uint32_t crc)
+    {
+        if (ok) // Verified and renamed over the target
+        {
+            catalog->published(uploadName, crc); // Listed with its CRC right away
+            LOG_INFO("[Server][" << clientUUID << "] Delta upload complete: " << deltaCopied << " of " << uploadSize << " bytes reused. CRC: " << crc); // Prints completion message
+            Metrics::add(Metrics::UPLOADS);
+            Metrics::record(Metrics::UPLOAD_US, Metrics::microsSince(transferStart));
+        }
+        else // Target left unchanged
+            LOG_WARN("[Server][" << clientUUID << "] Delta upload rejected."); // Prints error message
+        char status = ok ? 1 : 0; // Stored and verified
+        queueSend(&status, 1); // Reports the outcome
+        queueSend(reinterpret_cast<const char *>(&crc), sizeof(crc)); // Reports the checksum of what was rebuilt
+        upload.reset(); // Done with the pipeline
+        deltaBase.reset(); // A new delta needs a new signature
+        deltaChunks.clear();
+        state = AWAIT_COMMAND; // Ready for the next command
+        resumeReading(); // Processes commands that arrived meanwhile
+    }
+
+    // 'V': version(4, little-endian) -> 'V' version(4). Switches the connection to v2 frames.
+    size_t parseVersion(const char *in, size_t avail)
+    {
+        if (avail < 4) // Version not fully received yet
+            return 0;
+        uint32_t version = min(ProtocolV2::get32(in), ProtocolV2::VERSION); // Highest version both sides speak
+        char reply[5] = {'V'}; // Echoes the command
+        ProtocolV2::put32(reply + 1, version); // Chosen version
+        queueSend(reply, sizeof(reply)); // Answers before any frame
+        if (version >= 2) // Framed from now on
+        {
+            LOG_INFO("[Server][" << clientUUID << "] Switched to protocol v" << version << "."); // Prints upgrade message
+            state = FRAME_HEADER;
+        }
+        else
+            state = AWAIT_COMMAND; // Stays on v1
+        return 4; // Consumes the version
+    }
+
+    // Decodes a frame header; DATA payloads are then streamed, other payloads are read whole
+    size_t parseFrameHeader(const char *in, size_t avail)
+    {
+        if (avail < ProtocolV2::HEADER_SIZE) // Header not fully received yet
+            return 0;
+        frame = ProtocolV2::decodeHeader(in); // Decodes it
+        if (frame.length > (frame.type == ProtocolV2::DATA ? ProtocolV2::MAX_DATA : ProtocolV2::MAX_CONTROL)) // Oversized frame
+        {
+            protocolError("oversized frame");
+            return 0;
+        }
+        frameLeft = frame.length; // Payload still to come
+        if (frame.type == ProtocolV2::DATA) // Payload goes straight to its stream
+            state = frameLeft > 0 ? FRAME_DATA : FRAME_HEADER;
+        else if (frameLeft > 0) // Control payload is read in one piece
+            state = FRAME_CONTROL;
+        else // Empty control frame
+            handleFrame(nullptr);
+        return ProtocolV2::HEADER_SIZE; // Consumes the header
+    }
+
+    // Handles a control frame once its payload is complete
+    size_t parseControlFrame(const char *in, size_t avail)
+    {
+        if (avail < frame.length) // Payload not fully received yet
+            return 0;
+        state = FRAME_HEADER; // Next frame follows
+        handleFrame(in); // Acts on it
+        return frame.length; // Consumes the payload
+    }
+
+    // Passes DATA payload bytes to their upload stream; compressed frames are collected and expanded whole
+    size_t receiveFrameData(const char *in, size_t avail)
+    {
+        if (!bufferPool->admit(memory, ProtocolV2::MAX_DATA)) // No room to hold back another frame's worth of data
+        {
+            pauseReading(); // Resumed by resumeFrames() once the pipeline or the socket returns memory
+            framesPaused = true;
+            return 0;
+        }
+        size_t take = static_cast<size_t>(min<uint64_t>(avail, frameLeft)); // Never reads past this frame
+        frameLeft -= static_cast<uint32_t>(take); // Counts the bytes
+        if (frameLeft == 0) // Frame complete
+            state = FRAME_HEADER;
+        auto it = streams.find(frame.stream); // Stream the data belongs to
+        bool live = it != streams.end() && it->second.op == 'U'; // Data for a stream reset meanwhile is dropped
+        if (!(frame.flags & ProtocolV2::FLAG_COMPRESSED)) // Plain data is passed on as it arrives
+        {
+            if (live)
+                streamData(it->second, in, take, take);
+            chargeHeld(); // Counts whatever the pipeline could not take
+            return take; // Reports consumed bytes
+        }
+
+        frameBuffer.insert(frameBuffer.end(), in, in + take); // Compressed data is only usable as a whole frame
+        if (frameLeft > 0) // More to come
+            return take;
+        if (live) // Expands the frame into its stream
+        {
+            Stream &s = it->second; // The upload
+            uint32_t rawLength = frameBuffer.size() >= 4 ? ProtocolV2::get32(frameBuffer.data()) : 0; // Uncompressed size
+            bool valid = frameBuffer.size() >= 4 && rawLength != 0 && rawLength <= ProtocolV2::MAX_RAW_CHUNK; // Checked before anything is allocated for it
+            if (valid)
+            {
+                rawBuffer.resize(rawLength);
+                valid = Compression::decompress(s.codec, frameBuffer.data() + 4, frameBuffer.size() - 4, rawBuffer.data(), rawLength);
+            }
+            if (!valid) // Malformed, or no codec negotiated
+            {
+                LOG_WARN("[Server][" << clientUUID << "] Stream " << s.id << ": corrupt compressed frame."); // Prints error message
+                queueSend(ProtocolV2::frame32(ProtocolV2::RESET, s.id, ProtocolV2::ERR_PROTOCOL)); // Aborts the stream
+                dropStream(it);
+            }
+            else
+                streamData(s, rawBuffer.data(), rawLength, frame.length);
+        }
+        frameBuffer.clear(); // Ready for the next frame
+        chargeHeld(); // Counts whatever the pipeline could not take
+        return take; // Reports consumed bytes
+    }
+
+    // Uncompressed upload bytes held back across all streams
+    size_t pendingBytes() const
+    {
+        size_t total = 0; // Running sum
+        for (const auto &entry : streams)
+            total += entry.second.pending.size();
+        return total;
+    }
+
+    // Brings the memory charged for held-back upload bytes up to date
+    void chargeHeld()
+    {
+        size_t held = pendingBytes(); // Bytes held now
+        if (held > heldCharged) // Grew
+            bufferPool->charge(memory, held - heldCharged);
+        else // Shrank (wakes connections waiting for memory)
+            bufferPool->uncharge(memory, heldCharged - held);
+        heldCharged = held;
+    }
+
+    // Resumes v2 input paused for lack of memory, if there is room again
+    void resumeFrames()
+    {
+        if (framesPaused && bufferPool->admit(memory, ProtocolV2::MAX_DATA)) // Another frame fits
+        {
+            framesPaused = false;
+            resumeReading();
+        }
+    }
+
+    // Acts on a complete control frame
+    void handleFrame(const char *payload)
+    {
+        auto it = streams.find(frame.stream); // Stream the frame refers to
+        switch (frame.type) // Dispatches on the frame type
+        {
+        case ProtocolV2::OPEN: // New stream
+            openStream(payload);
+            break;
+        case ProtocolV2::WINDOW: // Credit for a download
+            if (it != streams.end() && frame.length >= 4 && it->second.op == 'D') // Known download
+            {
+                it->second.window += ProtocolV2::get32(payload); // Client consumed data
+                pumpStreams(); // Sends more
+            }
+            break;
+        case ProtocolV2::RESET: // Client cancelled a stream
+            if (it != streams.end()) // Still open
+                dropStream(it);
+            break;
+        case ProtocolV2::GOAWAY: // Client is done
+            LOG_INFO("[Server][" << clientUUID << "] Client requested QUIT."); // Prints quit message
+            quitRequested = true; // Remembers that the client asked to leave
+            closeAfterFlush(); // Closes once pending output is sent
+            break;
+        default: // Frames only the server sends, or unknown types
+            protocolError("unexpected frame");
+            break;
+        }
+    }
+
+    // Opens a download or upload stream
+    void openStream(const char *payload)
+    {
+        uint32_t sid = frame.stream; // Client-chosen ID
+        char op = frame.length > 0 ? payload[0] : 0; // Requested operation
+        if (sid == 0 || streams.count(sid) || streams.size() >= ProtocolV2::MAX_STREAMS) // ID in use or too many streams
+        {
+            queueSend(ProtocolV2::frame32(ProtocolV2::RESET, sid, ProtocolV2::ERR_REFUSED)); // Refuses the stream
+            return;
+        }
+        if ((op == 'D' && frame.length < 17) || (op == 'U' && frame.length < 9) || (op != 'D' && op != 'U')) // Malformed request
+        {
+            queueSend(ProtocolV2::frame32(ProtocolV2::RESET, sid, ProtocolV2::ERR_PROTOCOL)); // Rejects the stream
+            return;
+        }
+
+        size_t codecsAt = op == 'U' ? 9 : 17; // Optional codecs byte after the fixed fields
+        string name = op == 'U' ? uploadName : downloadName; // File named by 'O', unless OPEN names one
+        if (frame.length > codecsAt + 1) // Optional name after the codecs byte
+        {
+            uint16_t len = frame.length >= codecsAt + 3 ? ProtocolV2::get16(payload + codecsAt + 1) : 0; // Name length
+            if (frame.length == codecsAt + 3 + len) // Field complete
+                name.assign(payload + codecsAt + 3, len);
+            if (frame.length != codecsAt + 3 + len || !Catalog::validName(name)) // Truncated or not a servable name
+            {
+                queueSend(ProtocolV2::frame32(ProtocolV2::RESET, sid, ProtocolV2::ERR_PROTOCOL)); // Rejects the stream
+                return;
+            }
+        }
+
+        Stream &s = streams[sid]; // Registers the stream
+        s.id = sid;
+        s.op = op;
+        s.name = name;
+        if (config.compression && frame.length > codecsAt) // Client can decompress
+            s.codec = Compression::choose(static_cast<uint8_t>(payload[codecsAt]));
+        if (op == 'U') // Upload: goes through the pipeline like a v1 upload
+        {
+            s.size = ProtocolV2::get64(payload + 1); // Announced size
+            s.window = ProtocolV2::INITIAL_WINDOW; // Client may send this much before credit returns
+            s.upload = beginUpload(clientUUID + "-" + to_string(sid), name); // Own temp file per stream
+            if (!s.upload->ok()) // Temp file could not be created
+                LOG_ERROR("[Server][" << clientUUID << "] Cannot open file for upload."); // Prints error message (payload is still drained)
+            if (frame.length > codecsAt) // Client offered codecs and waits to learn which one to use
+            {
+                char headers[1] = {static_cast<char>(s.codec)}; // codec(1)
+                queueSend(ProtocolV2::frame(ProtocolV2::HEADERS, sid, headers, sizeof(headers)));
+            }
+            LOG_DEBUG("[Server][" << clientUUID << "] Stream " << sid << ": upload of " << s.size << " bytes as " << name << "."); // Prints upload request message
+            if (s.size == 0) // Empty upload
+                finishStream(s);
+            return;
+        }
+
+        s.offset = ProtocolV2::get64(payload + 1); // Requested offset
+        s.remaining = ProtocolV2::get64(payload + 9); // Requested length (0 = to the end)
+        s.window = ProtocolV2::INITIAL_WINDOW; // Server may send this much before credit returns
+        LOG_DEBUG("[Server][" << clientUUID << "] Stream " << sid << ": download of " << name << " at " << s.offset << "."); // Prints download request message
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        ContentCache::EntryPtr entry = lookupFile(name, [ownerLoop, connId, sid](ContentCache::EntryPtr ready) { // Cold file: hashed on a cache worker
+            ownerLoop->postToConnection(connId, [sid, ready](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->streamLookedUp(sid, ready); // Continues the stream
+            });
+        });
+        if (entry) // Cache hit
+            streamLookedUp(sid, entry);
+    }
+
+    // Starts a download stream once its file is in the cache
+    void streamLookedUp(uint32_t sid, ContentCache::EntryPtr entry)
+    {
+        auto it = streams.find(sid); // Stream may have been reset meanwhile
+        if (it == streams.end())
+            return;
+        Stream &s = it->second; // The download
+        uint64_t fileSize = entry ? entry->identity.size : 0; // Size of the cached version
+        uint64_t offset = min(s.offset, fileSize); // First byte to send
+        uint64_t length = fileSize - offset; // Bytes to the end of the file
+        if (s.remaining != 0) // A bounded range was asked for
+            length = min(length, s.remaining);
+        if (!entry || !ContentCache::rangeCrc(*entry, offset, length, s.crc)) // Missing, unreadable or changed
+        {
+            queueSend(ProtocolV2::frame32(ProtocolV2::RESET, sid, ProtocolV2::ERR_NOT_FOUND)); // Reports it
+            streams.erase(it);
+            return;
+        }
+        char headers[21]; // total(8) fileCrc(4) length(8) codec(1)
+        ProtocolV2::put64(headers, fileSize);
+        ProtocolV2::put32(headers + 8, entry->crc);
+        ProtocolV2::put64(headers + 12, length);
+        headers[20] = static_cast<char>(s.codec);
+        queueSend(ProtocolV2::frame(ProtocolV2::HEADERS, sid, headers, sizeof(headers))); // Announces the download
+        s.entry = entry; // Keeps the file alive while sending
+        s.offset = offset;
+        s.remaining = length;
+        s.ready = true; // Can send data now
+        s.small = length <= Bandwidth::SMALL_TRANSFER;
+        pumpStreams(); // Starts sending
+    }
+
+    // Sends DATA frames round-robin across download streams while the socket and the windows allow
+    void pumpStreams()
+    {
+        while (pendingSendBytes() < SEND_LOW_WATER && !isClosing()) // Keeps a bounded amount queued
+        {
+            auto it = streams.upper_bound(lastServed); // Continues after the stream served last
+            auto sendable = [](const Stream &s) { return s.op == 'D' && s.ready && (s.remaining == 0 || s.window > 0); }; // Has data and credit
+            while (it != streams.end() && !sendable(it->second)) // Searches to the end
+                ++it;
+            if (it == streams.end()) // Wraps around
+            {
+                it = streams.begin();
+                while (it != streams.end() && it->first <= lastServed && !sendable(it->second))
+                    ++it;
+                if (it == streams.end() || !sendable(it->second)) // Nothing can be sent
+                    return;
+            }
+
+            Stream &s = it->second; // Stream to serve
+            lastServed = s.id; // Next round starts after it
+            BufferPool::ChunkPtr chunk; // Memory for a frame that is copied rather than sent from the file
+            if (s.remaining > 0 && (s.codec != Compression::NONE || copies(s.entry)) && !(chunk = bufferPool->acquire(memory))) // Budget spent: memorySpace() continues
+                return;
+            uint64_t want = min<uint64_t>({s.codec != Compression::NONE ? ProtocolV2::MAX_RAW_CHUNK : ProtocolV2::MAX_DATA, s.window, s.remaining}); // Raw bytes this frame could carry
+            if (chunk) // No more than the chunk holds, so the grant is not charged for bytes left behind
+                want = min<uint64_t>(want, s.codec != Compression::NONE ? chunk->size() - ProtocolV2::HEADER_SIZE - 4 : chunk->size());
+            uint64_t allowed = 0; // Raw bytes the scheduler lets this frame carry
+            if (s.remaining > 0 && !(allowed = bandwidth->grant(flow, want, s.small))) // Over the cap: bandwidthWake() continues
+                return;
+            if (s.codec != Compression::NONE && s.remaining > 0) // Compressed chunk by chunk as the socket drains
+            {
+                if (!queueCompressed(s, chunk, allowed)) // File shrank underneath us
+                {
+                    LOG_ERROR("[Server][" << clientUUID << "] File truncated during send."); // Prints error message
+                    close(); // The stream cannot be completed
+                    return;
+                }
+            }
+            uint32_t length = s.codec != Compression::NONE ? 0 : static_cast<uint32_t>(min<uint64_t>({ProtocolV2::MAX_DATA, s.window, s.remaining, allowed})); // Frame payload
+            if (chunk && length > chunk->size()) // Copied frames fit one chunk
+                length = static_cast<uint32_t>(chunk->size());
+            if (length > 0) // Data left
+            {
+                char header[ProtocolV2::HEADER_SIZE]; // DATA frame header
+                ProtocolV2::FrameHeader h;
+                h.length = length;
+                h.stream = s.id;
+                h.type = ProtocolV2::DATA;
+                ProtocolV2::encodeHeader(header, h);
+                queueSend(header, sizeof(header)); // Header, then the bytes straight from the file
+                if (!queueFileData(s.entry, s.offset, length, chunk)) // File shrank underneath us
+                {
+                    LOG_ERROR("[Server][" << clientUUID << "] File truncated during send."); // Prints error message
+                    close(); // The frame cannot be completed
+                    return;
+                }
+                s.offset += length;
+                s.remaining -= length;
+                s.window -= length;
+                s.wireBytes += length;
+            }
+            if (s.remaining == 0) // Whole range queued
+            {
+                char crc[4]; // Range CRC from the cache
+                ProtocolV2::put32(crc, s.crc);
+                queueSend(ProtocolV2::frame(ProtocolV2::END, s.id, crc, sizeof(crc))); // Ends the stream
+                LOG_INFO("[Server][" << clientUUID << "] Stream " << s.id << " sent. CRC: " << s.crc
+                                     << (s.codec != Compression::NONE ? ", " + to_string(s.wireBytes) + " bytes on the wire" : string())); // Prints completion message (and what compression saved)
+                Metrics::add(Metrics::DOWNLOADS);
+                Metrics::record(Metrics::DOWNLOAD_US, Metrics::microsSince(s.started));
+                streams.erase(it);
+            }
+        }
+    }
+
+    // Builds one DATA frame of at most MAX_RAW_CHUNK (and allowed) file bytes in chunk, compressed unless
+    // that does not make it smaller, and queues it
+    bool queueCompressed(Stream &s, const BufferPool::ChunkPtr &chunk, uint64_t allowed)
+    {
+        char *payload = chunk->data() + ProtocolV2::HEADER_SIZE; // Frame payload inside the chunk
+        uint32_t length = static_cast<uint32_t>(min<uint64_t>({ProtocolV2::MAX_RAW_CHUNK, s.window, s.remaining, allowed,
+                                                                chunk->size() - ProtocolV2::HEADER_SIZE - 4})); // Raw bytes; the frame is never larger
+        const char *raw = nullptr; // The chunk's bytes
+        if (s.entry->view) // Mapped: compresses straight from the page cache
+            raw = s.entry->view + s.offset;
+        else // Reads the bytes where a compressed payload would start
+        {
+            Metrics::Timer timer(Metrics::DISK_NS); // Blocking read on the loop thread
+            if (FileIO::readAt(s.entry->file, s.offset, payload + 4, length) != length) // File was truncated
+                return false;
+            raw = payload + 4;
+        }
+        size_t packed = Compression::compress(s.codec, raw, length, packBuffer); // 0 = does not shrink
+        ProtocolV2::FrameHeader h; // DATA frame header
+        h.stream = s.id;
+        h.type = ProtocolV2::DATA;
+        if (packed > 0 && packed + 4 < length) // Smaller even with the length prefix
+        {
+            h.length = static_cast<uint32_t>(4 + packed);
+            h.flags = ProtocolV2::FLAG_COMPRESSED;
+            ProtocolV2::put32(payload, length); // rawLength(4), then the compressed bytes
+            memcpy(payload + 4, packBuffer.data(), packed);
+        }
+        else // Incompressible chunk: sent as it is
+        {
+            h.length = length;
+            memmove(payload, raw, length); // May overlap the bytes just read
+        }
+        ProtocolV2::encodeHeader(chunk->data(), h);
+        queueView(chunk, chunk->data(), ProtocolV2::HEADER_SIZE + h.length); // Chunk returns to the pool once sent
+        s.offset += length;
+        s.remaining -= length;
+        s.window -= h.length; // Windows count wire bytes
+        s.wireBytes += h.length;
+        return true;
+    }
+
+    // Accepts upload bytes (length after decompression, wire as sent) within the stream's window
+    void streamData(Stream &s, const char *data, size_t length, size_t wire)
+    {
+        if (wire > s.window || s.received + length > s.size || s.committing) // Client ignored flow control or the announced size
+        {
+            queueSend(ProtocolV2::frame32(ProtocolV2::RESET, s.id, ProtocolV2::ERR_PROTOCOL)); // Aborts the stream
+            dropStream(streams.find(s.id));
+            return;
+        }
+        s.window -= wire; // Uses up credit
+        s.received += length;
+        s.wireBytes += wire;
+        size_t used = s.pending.empty() ? s.upload->push(data, length) : 0; // Keeps order behind earlier held-back bytes
+        s.pending.insert(s.pending.end(), data + used, data + length); // Holds back what the pipeline cannot take yet
+        if (s.pending.empty()) // Consumed at once
+            s.credit += static_cast<uint32_t>(wire);
+        else // Credited once the held-back bytes drain, which bounds them by the window
+            s.pendingWire += static_cast<uint32_t>(wire);
+        settleUpload(s);
+    }
+
+    // Returns credit for consumed upload bytes and finishes uploads that are complete
+    void settleUpload(Stream &s)
+    {
+        if (s.credit >= ProtocolV2::INITIAL_WINDOW / 4) // Enough consumed to be worth a WINDOW frame
+        {
+            queueSend(ProtocolV2::frame32(ProtocolV2::WINDOW, s.id, s.credit)); // Client may send more
+            s.window += s.credit;
+            s.credit = 0;
+        }
+        if (s.received == s.size && s.pending.empty() && !s.committing) // Every byte is in the pipeline
+            finishStream(s);
+    }
+
+    // Publishes a complete upload stream; END is sent once the file is renamed into place
+    void finishStream(Stream &s)
+    {
+        s.committing = true; // No more data is accepted
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        uint32_t sid = s.id; // Stream to answer on
+        s.upload->finish([ownerLoop, connId, sid](bool ok, uint32_t crc) { // Runs on the disk writer thread
+            ownerLoop->postToConnection(connId, [sid, ok, crc](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->streamCommitted(sid, ok, crc); // Sends the reply
+            });
+        });
+    }
+
+    // Reports the outcome of an upload stream
+    void streamCommitted(uint32_t sid, bool ok, uint32_t crc)
+    {
+        char end[5]; // status(1) crc(4)
+        end[0] = ok ? 1 : 0;
+        ProtocolV2::put32(end + 1, crc);
+        queueSend(ProtocolV2::frame(ProtocolV2::END, sid, end, sizeof(end))); // Ends the stream
+        auto it = streams.find(sid); // Stream being answered
+        if (ok && it != streams.end()) // Renamed over the target (the watcher indexes it if the stream is gone)
+            catalog->published(it->second.name, crc); // Listed with its CRC right away
+        if (ok) // Renamed over the target
+        {
+            LOG_INFO("[Server][" << clientUUID << "] Stream " << sid << " upload complete. CRC: " << crc
+                                 << (it != streams.end() && it->second.codec != Compression::NONE ? ", " + to_string(it->second.wireBytes) + " bytes on the wire" : string())); // Prints completion message (and what compression saved)
+            Metrics::add(Metrics::UPLOADS);
+            if (it != streams.end()) // Still known (always, unless the connection is being torn down)
+                Metrics::record(Metrics::UPLOAD_US, Metrics::microsSince(it->second.started));
+        }
+        else
+            LOG_ERROR("[Server][" << clientUUID << "] Stream " << sid << " upload could not be stored."); // Prints error message
+        streams.erase(sid);
+    }
+
+    // Removes a stream, abandoning its upload if one is still receiving
+    void dropStream(map<uint32_t, Stream>::iterator it)
+    {
+        if (it == streams.end()) // Already gone
+            return;
+        if (it->second.upload && !it->second.committing) // Upload still receiving
+            it->second.upload->abort(); // Deletes the temp file
+        streams.erase(it);
+        chargeHeld(); // Its held-back bytes are gone
+    }
+
+    // Logs a framing violation and drops the connection (the byte stream cannot be resynchronized)
+    void protocolError(const char *what)
+    {
+        LOG_WARN("[Server][" << clientUUID << "] Protocol error: " << what << "."); // Prints error message
+        close();
+    }
+
+    // Wake-up for transfers refused by the memory budget
+    std::function<void()> memoryWake()
+    {
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        return [ownerLoop, connId]() {
+            ownerLoop->postToConnection(connId, [](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->memorySpace(); // Continues sending and receiving
+            });
+        };
+    }
+
+    // Called when transfer memory is returned after this session was refused some
+    void memorySpace()
+    {
+        onWritable(); // Downloads continue queueing
+        resumeFrames(); // Uploads continue receiving
+    }
+
+    // Gets a served file from the content cache like ContentCache::lookup(), and records its CRC in the
+    // catalog; names the catalog does not serve are reported as missing without touching the disk
+    ContentCache::EntryPtr lookupFile(const string &name, ContentCache::Callback done)
+    {
+        Catalog::Info info; // Unused; only existence matters
+        if (!catalog->find(name, info)) // Not served
+        {
+            done(ContentCache::EntryPtr()); // Reports it like an unreadable file
+            return ContentCache::EntryPtr();
+        }
+        auto learn = [name](const ContentCache::EntryPtr &entry) { // Lists the CRC from now on
+            if (entry)
+                catalog->learnCrc(name, entry->identity.size, entry->identity.mtime, entry->crc);
+        };
+        ContentCache::EntryPtr entry = contentCache->lookup(catalog->pathOf(name), [learn, done](ContentCache::EntryPtr ready) { // Cold file: hashed on a cache worker
+            learn(ready);
+            done(ready);
+        });
+        learn(entry);
+        return entry;
+    }
+
+    // Starts an upload of name (the one selected with 'O' by default) in its own staging file tag
+    shared_ptr<UploadPipeline::Upload> beginUpload(const string &tag, const string &name = string())
+    {
+        const string &target = name.empty() ? uploadName : name; // Catalog name to publish as
+        catalog->makeParents(target); // Subdirectories are created on demand (a failure shows up at the rename)
+        return uploadPipeline->begin(catalog->pathOf(target), catalog->stagingPath(tag), uploadWake());
+    }
+
+    // Wake-up for downloads refused by the bandwidth scheduler
+    std::function<void()> bandwidthWake()
+    {
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        return [ownerLoop, connId]() {
+            ownerLoop->postToConnection(connId, [](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->onWritable(); // Continues sending
+            });
+        };
+    }
+
+    // Wake-up for uploads that ran out of pooled buffers
+    std::function<void()> uploadWake()
+    {
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        return [ownerLoop, connId]() {
+            ownerLoop->postToConnection(connId, [](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->uploadSpace(); // Continues receiving
+            });
+        };
+    }
+
+    // Handles file download requests from a client
+    void handleDownload()
+    {
+        LOG_DEBUG("[Server][" << clientUUID << "] Download request received."); // Prints download request message
+        rangeMode = false; // Whole-file answer
+        lookupDownload(); // Fetches size and checksum from the cache
+    }
+
+    // Gets the served file from the content cache, then continues in startDownload()
+    void lookupDownload()
+    {
+        transferStart = Metrics::Clock::now(); // Duration includes the cache lookup
+        state = DOWNLOAD_LOOKUP; // Waits for the cache to produce size and checksum
+        pauseReading(); // Holds back later commands until this download completes
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        ContentCache::EntryPtr entry = lookupFile(downloadName, [ownerLoop, connId](ContentCache::EntryPtr ready) { // Cold or changed file: hashed once on a cache worker
+            ownerLoop->postToConnection(connId, [ready](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->startDownload(ready); // Continues the download
+            });
+        });
+        if (entry) // Cache hit: checksum known without reading the file
+            startDownload(entry); // Starts sending right away
+    }
+
+    // 'H' -> status(1) [handle(8) size(8)]. Gives a same-host client the selected file instead of sending it.
+    void handleHandoff()
+    {
+        if (peerPid == 0) // TCP client, or the peer process is unknown: the client falls back to 'D'
+        {
+            char status = 0; // Refused
+            queueSend(&status, 1);
+            return;
+        }
+        state = HANDOFF; // Later commands wait for the reply
+        pauseReading(); // Holds them back
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        ContentCache::EntryPtr entry = lookupFile(downloadName, [ownerLoop, connId](ContentCache::EntryPtr ready) { // Cold file: opened on a cache worker
+            ownerLoop->postToConnection(connId, [ready](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->handoffReady(ready); // Sends the reply
+            });
+        });
+        if (entry) // Cache hit
+            handoffReady(entry);
+    }
+
+    // Duplicates the cached file's handle into the client's process and sends its value
+    void handoffReady(ContentCache::EntryPtr entry)
+    {
+        HANDLE remote = nullptr; // Handle value in the client's process
+        while (!handoffs.empty() && handoffs.front().first <= sentBytes()) // Replies sent: the client owns those handles
+            handoffs.pop_front();
+        if (entry && !isClosing()) // File exists and the reply can still be sent
+        {
+            HANDLE process = OpenProcess(PROCESS_DUP_HANDLE, FALSE, peerPid); // Target of the duplicate
+            if (process && !DuplicateHandle(GetCurrentProcess(), static_cast<HANDLE>(entry->file.get()), process, &remote, GENERIC_READ, FALSE, 0)) // Read access only
+                remote = nullptr;
+            if (process)
+                CloseHandle(process);
+        }
+        vector<char> reply(remote ? 17 : 1); // status(1) handle(8) size(8)
+        reply[0] = remote ? 1 : 0;
+        if (remote)
+        {
+            uint64_t value = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(remote)); // Handle value, widened
+            memcpy(reply.data() + 1, &value, 8);
+            memcpy(reply.data() + 9, &entry->identity.size, 8);
+            Metrics::add(Metrics::LOCAL_HANDOFFS);
+            Metrics::add(Metrics::DOWNLOADS);
+            LOG_INFO("[Server][" << clientUUID << "] Handed " << downloadName << " (" << entry->identity.size << " bytes) to process " << peerPid << "."); // Prints handoff message
+        }
+        else
+            LOG_WARN("[Server][" << clientUUID << "] Could not hand " << downloadName << " to process " << peerPid << "."); // Prints failure message
+        queueSend(move(reply)); // Sends the handle
+        if (remote) // Revoked in onClosed unless the reply is sent by then
+            handoffs.emplace_back(sentBytes() + pendingSendBytes(), remote);
+        state = AWAIT_COMMAND; // Ready for the next command
+        resumeReading(); // Processes commands that arrived meanwhile
+    }
+
+    // Closes the client's copies of handles whose reply was never sent, so the client cannot leak them
+    void revokeHandoffs()
+    {
+        while (!handoffs.empty() && handoffs.front().first <= sentBytes()) // Replies sent: the client owns those handles
+            handoffs.pop_front();
+        if (handoffs.empty())
+            return;
+        HANDLE process = OpenProcess(PROCESS_DUP_HANDLE, FALSE, peerPid); // Owner of the duplicates (gone if the client exited)
+        for (const auto &handoff : handoffs) // Closes each in the client's process
+            if (process)
+                DuplicateHandle(process, handoff.second, nullptr, nullptr, 0, FALSE, DUPLICATE_CLOSE_SOURCE);
+        if (process)
+        {
+            CloseHandle(process);
+            LOG_DEBUG("[Server][" << clientUUID << "] Revoked " << handoffs.size() << " unsent file handles."); // Prints revocation message
+        }
+        handoffs.clear();
+    }
+
+    // Sends the header and starts streaming a cached file (or the requested range of it)
+    void startDownload(ContentCache::EntryPtr entry)
+    {
+        uint64_t fileSize = entry ? entry->identity.size : 0; // Size of the cached version (0 = unavailable)
+        uint64_t offset = rangeMode ? min(rangeOffset, fileSize) : 0; // First byte to send
+        uint64_t length = fileSize - offset; // Bytes to the end of the file
+        if (rangeMode && rangeLength != 0) // A bounded range was asked for
+            length = min(length, rangeLength);
+
+        uint32_t trailerCRC = 0; // CRC sent after the data
+        if (entry && rangeMode && !ContentCache::rangeCrc(*entry, offset, length, trailerCRC)) // Combines block CRCs, reading at most the edges
+            entry.reset(); // The file changed underneath; reports it as unavailable
+        else if (entry && !rangeMode) // Whole file
+            trailerCRC = entry->crc;
+
+        if (!entry) // File missing or unreadable
+        {
+            LOG_ERROR("[Server][" << clientUUID << "] Cannot open file."); // Prints error message if file not found
+            uint64_t zero = 0; // Sets file size to zero to indicate failure
+            queueSend(reinterpret_cast<const char *>(&zero), sizeof(zero)); // Sends zero file size
+            if (rangeMode) // The ranged answer still has all its fields
+            {
+                uint32_t noCrc = 0; // Placeholder CRCs
+                queueSend(reinterpret_cast<const char *>(&noCrc), sizeof(noCrc)); // File CRC
+                queueSend(reinterpret_cast<const char *>(&zero), sizeof(zero)); // Range length
+                queueSend(reinterpret_cast<const char *>(&noCrc), sizeof(noCrc)); // Range CRC
+            }
+            state = AWAIT_COMMAND; // Ready for the next command
+            resumeReading(); // Processes commands that arrived meanwhile
+            return;
+        }
+
+        queueSend(reinterpret_cast<const char *>(&fileSize), sizeof(fileSize)); // Sends file size to client
+        if (rangeMode) // Ranged header: whole-file CRC up front, then the range length
+        {
+            queueSend(reinterpret_cast<const char *>(&entry->crc), sizeof(entry->crc)); // Whole-file CRC
+            queueSend(reinterpret_cast<const char *>(&length), sizeof(length)); // Range length
+        }
+        download = entry; // Keeps the entry (and its handle/mapping) alive while sending
+        downloadOffset = offset; // Starts at the requested offset
+        downloadRemaining = length; // Bytes still to send
+        downloadCRC = trailerCRC; // Trailer for this answer
+        downloadSmall = length <= Bandwidth::SMALL_TRANSFER; // Short answers go ahead of bulk transfers
+        state = DOWNLOADING; // Enters the sending state
+        pumpDownload(); // Queues the first chunks
+    }
+
+    // Queues the next part of the download, keeping a bounded amount in flight
+    void pumpDownload()
+    {
+        bool copy = copies(download); // Segments go through pooled chunks
+        uint64_t window = copy ? max<uint64_t>(SEND_LOW_WATER, 2 * bufferPool->chunkSize()) : 2 * ZERO_COPY_SEGMENT; // Bytes to keep queued
+        while (downloadRemaining > 0 && pendingSendBytes() < window) // Keeps the socket busy without buffering the whole file
+        {
+            uint64_t length = min<uint64_t>(copy ? bufferPool->chunkSize() : ZERO_COPY_SEGMENT, downloadRemaining); // Size of the next segment
+            BufferPool::ChunkPtr chunk; // Memory for a copied segment
+            if (copy && !(chunk = bufferPool->acquire(memory))) // Budget spent: memorySpace() continues
+                return;
+            if (!(length = bandwidth->grant(flow, length, downloadSmall))) // Over the cap: bandwidthWake() continues
+                return;
+            if (!queueFileData(download, downloadOffset, length, chunk)) // File shrank underneath us
+            {
+                LOG_ERROR("[Server][" << clientUUID << "] File truncated during send."); // Prints error message
+                close(); // The client cannot resynchronize, so drops the connection
+                return;
+            }
+            downloadOffset += length; // Advances the file offset
+            downloadRemaining -= length; // Counts the queued bytes
+        }
+
+        if (downloadRemaining == 0) // Whole file has been queued
+        {
+            queueSend(reinterpret_cast<const char *>(&downloadCRC), sizeof(downloadCRC)); // Sends CRC to client (from the cache, never recomputed)
+            LOG_INFO("[Server][" << clientUUID << "] " << (rangeMode ? "Range" : "File") << " sent. CRC: " << downloadCRC); // Prints completion message
+            Metrics::add(Metrics::DOWNLOADS);
+            Metrics::record(Metrics::DOWNLOAD_US, Metrics::microsSince(transferStart));
+            download.reset(); // Drops our reference; queued ranges keep what they need alive
+            state = AWAIT_COMMAND; // Ready for the next command
+            resumeReading(); // Processes commands that arrived meanwhile
+        }
+    }
+
+    // True if downloads go out with TransmitFile, which needs a TCP socket
+    bool transmitFile() const
+    {
+        return config.zeroCopy && !local;
+    }
+
+    // True if sending entry copies its bytes through user-space memory
+    bool copies(const ContentCache::EntryPtr &entry) const
+    {
+        return !transmitFile() && !entry->view; // Neither TransmitFile nor a mapping
+    }
+
+    // Queues length bytes of a cached file: via TransmitFile, from the mapping, or copied into chunk
+    // (from the pool, when copies(entry); at most chunk->size() bytes) as a last resort
+    bool queueFileData(const ContentCache::EntryPtr &entry, uint64_t offset, uint64_t length, const BufferPool::ChunkPtr &chunk)
+    {
+        if (transmitFile()) // Kernel sends the range from the page cache
+            queueFile(entry->file, offset, length);
+        else if (entry->view) // Sends straight from the cached mapping
+            queueView(entry, entry->view + offset, static_cast<size_t>(length));
+        else // Unmapped file without TransmitFile
+        {
+            Metrics::Timer timer(Metrics::DISK_NS); // Blocking read on the loop thread
+            if (FileIO::readAt(entry->file, offset, chunk->data(), static_cast<size_t>(length)) != length) // Reads data into the chunk
+                return false; // File was truncated
+            queueView(chunk, chunk->data(), static_cast<size_t>(length)); // Chunk returns to the pool once sent
+        }
+        return true; // Data queued
+    }
+
+    // Handles file upload requests from a client
+    void handleUpload()
+    {
+        LOG_DEBUG("[Server][" << clientUUID << "] Upload request received."); // Prints upload request message
+        transferStart = Metrics::Clock::now(); // Duration ends when the file is published
+        uploadSize = 0; // Stores the size of the file to be uploaded
+        uploadReceived = 0; // Tracks total bytes received
+        state = UPLOAD_SIZE; // Waits for the size field
+    }
+
+    // Decodes the upload size; returns bytes consumed
+    size_t parseUploadSize(const char *in, size_t avail)
+    {
+        if (!take(in, avail, uploadSize)) // Size not fully received yet
+            return 0;
+        upload = beginUpload(clientUUID); // Written to a temp file, renamed when complete
+        if (!upload->ok()) // Temp file could not be created
+            LOG_ERROR("[Server][" << clientUUID << "] Cannot open file for upload."); // Prints error message (payload is still drained)
+        state = UPLOAD_DATA; // Moves on to the payload
+        if (uploadSize == 0) // Empty upload
+            finishUpload(); // Completes immediately
+        return sizeof(uploadSize); // Consumes the size field
+    }
+
+    // Consumes upload payload bytes; returns how many were used
+    size_t receiveUpload(const char *data, size_t length)
+    {
+        size_t take = static_cast<size_t>(min<uint64_t>(length, uploadSize - uploadReceived)); // Never reads past this upload
+        size_t used = upload->push(data, take); // Copies into pooled buffers; checksum and disk stages take it from there
+        if (used < take) // This upload's buffers are all in flight
+            pauseReading(); // Lets TCP flow control slow the sender until the disk catches up
+        uploadReceived += used; // Updates total bytes received
+        if (uploadReceived == uploadSize) // All file bytes are received
+            finishUpload(); // Waits for the pipeline to publish the file
+        return used; // Reports consumed bytes
+    }
+
+    // Called when a pooled buffer frees up after receiveUpload() ran out
+    void uploadSpace()
+    {
+        if (state == UPLOAD_DATA || state == DELTA_LITERAL) // Still receiving (the wake-up may be stale)
+            resumeReading(); // Delivers the input held back meanwhile
+        else if (state == DELTA_OP && !deltaHeld.empty()) // Copied bytes waiting for a buffer
+        {
+            pushHeld();
+            if (deltaHeld.empty()) // All in the pipeline
+                resumeReading(); // Continues with the next op
+        }
+        for (auto it = streams.begin(); it != streams.end();) // v2 uploads holding back bytes
+        {
+            Stream &s = (it++)->second; // Stream to drain
+            if (s.op != 'U' || s.pending.empty()) // Nothing held back
+                continue;
+            size_t used = s.upload->push(s.pending.data(), s.pending.size()); // Offers the held-back bytes again
+            s.pending.erase(s.pending.begin(), s.pending.begin() + used);
+            if (s.pending.empty()) // Drained: the frames it came from earn credit
+            {
+                s.credit += s.pendingWire;
+                s.pendingWire = 0;
+            }
+            settleUpload(s);
+        }
+        chargeHeld(); // Drained bytes return to the budget
+        resumeFrames(); // Uploads no longer outrun the disk
+    }
+
+    // Hands the end of the upload to the pipeline; the CRC is sent once the file is published
+    void finishUpload()
+    {
+        state = UPLOAD_COMMIT; // Waits for the writer
+        pauseReading(); // Holds back later commands until the reply is sent
+        EventLoop *ownerLoop = loop(); // Loop to resume on
+        uint64_t connId = id(); // Connection to resume
+        upload->finish([ownerLoop, connId](bool ok, uint32_t crc) { // Runs on the disk writer thread
+            ownerLoop->postToConnection(connId, [ok, crc](Connection *conn) { // Hops back to this session's loop
+                static_cast<ClientSession *>(conn)->uploadCommitted(ok, crc); // Sends the reply
+            });
+        });
+    }
+
+    // Reports the CRC of a published (or failed) upload
+    void uploadCommitted(bool ok, uint32_t crc)
+    {
+        if (ok) // Renamed over the target
+        {
+            catalog->published(uploadName, crc); // Listed with its CRC right away
+            LOG_INFO("[Server][" << clientUUID << "] Upload complete. CRC: " << crc); // Prints completion message
+            Metrics::add(Metrics::UPLOADS);
+            Metrics::record(Metrics::UPLOAD_US, Metrics::microsSince(transferStart));
+        }
+        else // Target left unchanged
+            LOG_ERROR("[Server][" << clientUUID << "] Upload could not be stored."); // Prints error message
+        queueSend(reinterpret_cast<const char *>(&crc), sizeof(crc)); // Sends CRC to client
+        upload.reset(); // Done with the pipeline
+        state = AWAIT_COMMAND; // Ready for the next command
+        resumeReading(); // Processes commands that arrived meanwhile
+    }
+
+    string clientUUID; // Unique identifier assigned to this client
+    string downloadName = "testfile.txt"; // Catalog name downloads serve (set with 'O')
+    string uploadName = "uploaded_from_client.txt"; // Catalog name uploads publish as (set with 'O')
+    State state = AWAIT_COMMAND; // Current protocol state
+    const bool local; // True if the client connected over the same-host AF_UNIX socket
+    const DWORD peerPid; // Client process of a local session (0 if unknown), target of 'H'
+    deque<pair<uint64_t, HANDLE>> handoffs; // Handles duplicated into the client, by the stream offset their reply ends at
+    bool resumeJoin = false; // True for 'J', false for 'I'
+    bool quitRequested = false; // True once the client sent 'Q'
+
+    ContentCache::EntryPtr download; // Cached file being sent
+    uint64_t downloadOffset = 0; // Next file offset to queue
+    uint64_t downloadRemaining = 0; // Bytes of the download not yet queued
+    uint32_t downloadCRC = 0; // CRC sent after the data (whole file or range)
+    bool downloadSmall = false; // True if the scheduler may let the download go ahead of bulk transfers
+    bool rangeMode = false; // True for 'G', false for 'D'
+    uint64_t rangeOffset = 0; // Requested range offset
+    uint64_t rangeLength = 0; // Requested range length (0 = to the end)
+
+    shared_ptr<UploadPipeline::Upload> upload; // Upload passing through the pipeline
+    uint64_t uploadSize = 0; // Announced upload size
+    uint64_t uploadReceived = 0; // Upload bytes received so far
+    Metrics::Clock::time_point transferStart; // Start of the current v1 download or upload, for the duration histograms
+
+    ProtocolV2::FrameHeader frame; // v2: header of the frame being received
+    uint32_t frameLeft = 0; // v2: payload bytes of that frame still to come
+    map<uint32_t, Stream> streams; // v2: open streams by ID
+    vector<char> frameBuffer; // v2: compressed DATA frame being collected
+    vector<char> rawBuffer; // v2: compressed upload frame after expansion
+    vector<char> packBuffer; // v2: compressor output
+    bool framesPaused = false; // v2: input paused because the memory budget is spent
+    BufferPool::AccountPtr memory; // Transfer memory charged to this session
+    Bandwidth::FlowPtr flow; // This connection's share of the send bandwidth
+    size_t heldCharged = 0; // v2: held-back upload bytes charged to memory
+    uint32_t lastServed = 0; // v2: stream that sent the last DATA frame (round-robin cursor)
+
+    FileIO::Handle deltaBase; // Stored upload the last signature describes
+    vector<DeltaSync::Chunk> deltaChunks; // That signature
+    function<void(char *, size_t, size_t)> listingFill; // Writes a range of the long reply being queued (null if none)
+    function<void()> listingDone; // Runs once that reply is fully queued
+    size_t listingSize = 0; // Bytes in that reply
+    size_t listingQueued = 0; // Bytes of it queued so far
+    uint32_t deltaCrc = 0; // CRC the rebuilt file must have
+    uint32_t deltaLiteral = 0; // Literal bytes of the current op still to come
+    vector<char> deltaHeld; // Copied bytes the pipeline could not take yet
+    vector<DeltaSync::Chunk> deltaBatch; // Copy ops not read yet
+    uint64_t deltaBatchBytes = 0; // Bytes of those chunks (until they reach the pipeline)
+    uint64_t deltaCopied = 0; // Bytes rebuilt from the stored file, for the log
+    bool deltaOk = true; // False once an op was rejected (the rest is drained)
+
+    shared_ptr<PartialUpload> partial; // Ranged upload of this session UUID (after 'P')
+    uint64_t writeOffset = 0; // Offset of the range being received
+    uint32_t writeLength = 0; // Length of the range being received
+    uint32_t writeReceived = 0; // Range bytes received so far
+    uint32_t writeCRC = 0; // Running CRC of the range
+    bool writeOk = false; // True while this session holds the claim of the range and writes it
+    bool writeDuplicate = false; // True if the range was verified before (its payload is drained, not written)
+    uint32_t writeDuplicateCRC = 0; // CRC recorded for that range
+};
 
 // Main function, entry point of the program
-int main()
+int main(int argc, char *argv[])
 {
+    for (int i = 1; i < argc; ++i) // Parses command-line options
+    {
+        string arg = argv[i]; // Current option
+        if (arg == "--buffered") // Forces the copy-through-user-space download path
+            config.zeroCopy = false;
+        else if (arg == "--cache-mb" && i + 1 < argc) // Sets the content cache budget
+            config.cacheBytes = stoull(argv[++i]) * 1024 * 1024;
+        else if (arg == "--no-mmap") // Never maps served files
+            config.cacheMapping = false;
+        else if (arg == "--hash-threads" && i + 1 < argc) // Sets the number of hashing workers
+            config.hashThreads = max(1, stoi(argv[++i]));
+        else if (arg == "--worker-threads" && i + 1 < argc) // Sets the threads for blocking session work
+            config.workerThreads = max(1, stoi(argv[++i]));
+        else if (arg == "--merkle-threads" && i + 1 < argc) // Sets the threads that hash one file's chunks
+            config.merkleThreads = max(1, stoi(argv[++i]));
+        else if (arg == "--durability" && i + 1 < argc) // Sets the upload flush policy
+        {
+            string policy = argv[++i]; // Policy name
+            if (policy == "none")
+                config.durability = Durability::None;
+            else if (policy == "always")
+                config.durability = Durability::WriteThrough;
+            else
+                config.durability = Durability::OnClose;
+        }
+        else if (arg == "--sync-writes") // Writes uploads synchronously on the writer thread
+            config.overlappedWrites = false;
+        else if (arg == "--upload-buffers" && i + 1 < argc) // Sets the number of pooled 1 MiB upload buffers
+            config.uploadBuffers = max(2, stoi(argv[++i]));
+        else if (arg == "--chunk-kb" && i + 1 < argc) // Sets the size of pooled send chunks
+            config.chunkSize = static_cast<size_t>(min(max(stoi(argv[++i]), 64), 16 * 1024)) * 1024;
+        else if (arg == "--memory-mb" && i + 1 < argc) // Sets the transfer memory shared by all connections
+            config.memoryBudget = static_cast<size_t>(max(1, stoi(argv[++i]))) << 20;
+        else if (arg == "--connection-mb" && i + 1 < argc) // Sets the transfer memory of one connection
+            config.connectionMemory = static_cast<size_t>(max(1, stoi(argv[++i]))) << 20;
+        else if (arg == "--root" && i + 1 < argc) // Sets the served directory
+            config.root = argv[++i];
+        else if (arg == "--no-watch") // Indexes the root once instead of following changes
+            config.watchRoot = false;
+        else if (arg == "--bandwidth-mb" && i + 1 < argc) // Caps what the server sends to all clients together
+            config.bandwidth = stoull(argv[++i]) << 20;
+        else if (arg == "--client-bandwidth-mb" && i + 1 < argc) // Caps what one client receives
+            config.clientBandwidth = stoull(argv[++i]) << 20;
+        else if (arg == "--weight" && i + 1 < argc && string(argv[i + 1]).find('=') != string::npos) // Gives a session UUID a larger share
+        {
+            string value = argv[++i]; // UUID=N
+            size_t eq = value.find('='); // Separator
+            config.weights[value.substr(0, eq)] = static_cast<uint32_t>(max(1, stoi(value.substr(eq + 1))));
+        }
+        else if (arg == "--local-socket" && i + 1 < argc) // Sets the socket file for same-host clients
+            config.localPath = argv[++i];
+        else if (arg == "--no-local") // Accepts TCP clients only
+            config.localTransport = false;
+        else if (arg == "--no-compress") // Sends and accepts v2 streams uncompressed only
+            config.compression = false;
+        else if (arg == "--log-level" && i + 1 < argc && Logger::parseLevel(argv[i + 1], config.logLevel)) // Lowest level printed
+            ++i;
+        else
+        {
+            cerr << "Usage: server [--buffered] [--cache-mb N] [--no-mmap] [--hash-threads N] [--merkle-threads N] [--worker-threads N] [--durability none|close|always]"
+                    " [--sync-writes] [--upload-buffers N] [--chunk-kb N] [--memory-mb N] [--connection-mb N] [--no-compress]"
+                    " [--root DIR] [--no-watch] [--bandwidth-mb N] [--client-bandwidth-mb N] [--weight UUID=N]"
+                    " [--local-socket PATH] [--no-local]"
+                    " [--log-level debug|info|warn|error]\n"; // Prints usage for unknown options
+            return 1; // Exits with error code
+        }
+    }
+
+    Logger::setLevel(config.logLevel); // Filters the console log
+    Metrics::startTime(); // Starts the uptime clock
+    contentCache.reset(new ContentCache(config.cacheBytes, config.cacheMapping, config.hashThreads)); // Creates the shared cache
+    catalog.reset(new Catalog(config.root, config.watchRoot)); // Indexes the served files
+    workPool.reset(new WorkPool(config.workerThreads)); // Starts the shared workers
+    merkleTrees.reset(new Merkle::Cache(*workPool, config.merkleThreads)); // Creates the hash tree cache (hashes on the shared workers)
+    LOG_INFO("[Server] Serving " << catalog->count() << " files from " << config.root << (catalog->watching() ? "." : " (not watching for changes).")); // Prints catalog summary
+    if (config.spoolDir.empty()) // Keeps partial uploads on the root's volume, hidden from the catalog
+        config.spoolDir = catalog->pathOf(".partial");
+    uploadRegistry.reset(new UploadRegistry(config.spoolDir)); // Creates the resumable upload spool
+    uploadPipeline.reset(new UploadPipeline(config.uploadBufferSize, config.uploadBuffers, config.durability, config.overlappedWrites)); // Starts the upload stages
+    size_t connectionMemory = max(config.connectionMemory, config.chunkSize + ProtocolV2::MAX_DATA); // Room for a chunk or a held-back frame
+    bufferPool.reset(new BufferPool(config.chunkSize, max(config.memoryBudget, connectionMemory), connectionMemory)); // Creates the shared budget
+    bandwidth.reset(new Bandwidth(config.bandwidth, config.clientBandwidth, config.weights)); // Creates the send scheduler
+
     WSADATA wsaData; // Structure to hold Winsock initialization data
     if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) // Initializes Winsock version 2.2
         return 1; // Exits with error code if initialization fails
@@ -215,21 +1932,76 @@ int main()
     bind(serverSocket, (sockaddr *)&serverAddr, sizeof(serverAddr)); // Binds the socket to the address
     listen(serverSocket, SOMAXCONN); // Sets the socket to listen for connections
 
-    cout << "[Server] Waiting for clients...\n"; // Prints server start message
+    unsigned int loopCount = max(1u, thread::hardware_concurrency()); // One event loop per core
+    vector<unique_ptr<EventLoop>> loops; // Fixed pool of event loops
+    for (unsigned int i = 0; i < loopCount; ++i) // Creates and starts each loop
+    {
+        loops.emplace_back(new EventLoop()); // Creates the loop and its completion port
+        loops.back()->start(); // Starts its thread
+    }
+
+    SOCKET localSocket = INVALID_SOCKET; // AF_UNIX listener for same-host clients
+    thread localAccept; // Accepts on it
+    if (config.localTransport) // Same-host clients skip the TCP stack
+    {
+        if (config.localPath.empty())
+            config.localPath = LocalTransport::defaultPath(PORT);
+        localSocket = LocalTransport::listenOn(config.localPath);
+        if (localSocket == INVALID_SOCKET) // AF_UNIX unsupported or the path is unusable
+            LOG_WARN("[Server] Cannot listen on " << config.localPath << "; same-host clients will use TCP."); // Prints warning
+        else
+        {
+            LOG_INFO("[Server] Same-host clients can connect to " << config.localPath << "."); // Prints the socket file
+            localAccept = thread([&loops, localSocket]() { // Blocks in accept like the TCP loop below
+                size_t next = 0; // Round-robin cursor over the loops
+                while (true)
+                {
+                    SOCKET clientSocket = accept(localSocket, nullptr, nullptr); // Accepts a same-host client
+                    if (clientSocket == INVALID_SOCKET) // Listener closed at shutdown
+                        break;
+                    ClientSession *session = new ClientSession(clientSocket, true, LocalTransport::peerProcess(clientSocket)); // Knows the client's process
+                    if (!loops[next]->adopt(session)) // Hands it to the next loop
+                        delete session;
+                    next = (next + 1) % loops.size();
+                }
+            });
+        }
+    }
+
+    LOG_INFO("[Server] Waiting for clients on " << loopCount << " event loops (" << (config.zeroCopy ? "zero-copy" : "buffered")
+                                                << " downloads)..."); // Prints server start message
 
+    size_t nextLoop = 0; // Round-robin cursor over the loops
     while (true) // Main loop for accepting client connections
     {
         SOCKET clientSocket = accept(serverSocket, nullptr, nullptr); // Accepts a new client connection
         if (clientSocket == INVALID_SOCKET) // Checks for errors
             break; // Exits the loop if accept fails
 
-        cout << "[Server] Client connected.\n"; // Prints client connection message
-        thread t(handleClient, clientSocket); // Creates a new thread to handle the client
-        t.detach(); // Detaches the thread to run independently
+        LOG_DEBUG("[Server] Client connected."); // Prints client connection message
+        ClientSession *session = new ClientSession(clientSocket); // Creates the session state machine
+        if (!loops[nextLoop]->adopt(session)) // Hands it to the next loop
+            delete session; // Closes the socket if the loop could not take it
+        nextLoop = (nextLoop + 1) % loops.size(); // Spreads connections evenly across loops
     }
 
+    if (localSocket != INVALID_SOCKET) // Stops accepting same-host clients
+    {
+        closesocket(localSocket); // Wakes the accept thread
+        localAccept.join();
+        DeleteFileA(config.localPath.c_str()); // Removes the socket file
+    }
+    for (auto &loop : loops) // Stops every event loop; sessions no longer start work
+        loop->stop();
+    workPool.reset(); // Finishes queued session work (results are posted to the stopped loops)
+    uploadPipeline.reset(); // Stops the upload stages, which post back the same way
+    contentCache.reset(); // Stops the hashing workers
+    bandwidth.reset(); // Stops the scheduler, which wakes flows through their loops
+    loops.clear(); // Destroys the loops once nothing can post to them
+    bufferPool.reset(); // Frees the idle chunks
+    merkleTrees.reset(); // Frees the cached trees
+    catalog.reset(); // Stops the watcher
     closesocket(serverSocket); // Closes the server socket
     WSACleanup(); // Cleans up Winsock resources
     return 0; // Exits the program successfully
 }
-
@@ -0,0 +1,36 @@
+#ifndef SOCKET_IO_H // Prevents multiple inclusions of this header file
+#define SOCKET_IO_H // Defines the header guard macro
+
+#include <winsock2.h> // Includes the Winsock 2 library for socket programming
+
+// Blocking whole-buffer socket helpers shared by the client and the benchmark
+
+// Sends all data in the buffer, handling partial sends
+inline bool sendAll(SOCKET sock, const char *data, int totalLen)
+{
+    int sent = 0; // Tracks the number of bytes sent
+    while (sent < totalLen) // Continues until all bytes are sent
+    {
+        int r = send(sock, data + sent, totalLen - sent, 0); // Sends remaining data
+        if (r <= 0) // Checks for errors or disconnection
+            return false; // Returns false if send fails
+        sent += r; // Updates the number of bytes sent
+    }
+    return true; // Returns true if all data is sent successfully
+}
+
+// Receives exactly the specified number of bytes
+inline bool recvExact(SOCKET sock, char *buffer, int bytesToRecv)
+{
+    int received = 0; // Tracks the number of bytes received
+    while (received < bytesToRecv) // Continues until all bytes are received
+    {
+        int r = recv(sock, buffer + received, bytesToRecv - received, 0); // Receives remaining data
+        if (r <= 0) // Checks for errors or disconnection
+            return false; // Returns false if receive fails
+        received += r; // Updates the number of bytes received
+    }
+    return true; // Returns true if all data is received successfully
+}
+
+#endif // Ends the header guard
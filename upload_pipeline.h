@@ -0,0 +1,409 @@
+#ifndef UPLOAD_PIPELINE_H // Prevents multiple inclusions of this header file
+#define UPLOAD_PIPELINE_H // Defines the header guard macro
+
+#include <windows.h> // Includes IOCP and overlapped file functions
+#include <algorithm> // Includes std::min
+#include <atomic> // Includes atomic for the abort flag
+#include <condition_variable> // Includes condition_variable for the checksum queue
+#include <cstdint> // Includes standard integer types like uint64_t
+#include <cstring> // Includes memcpy
+#include <deque> // Includes deque for the stage queues
+#include <functional> // Includes std::function for callbacks
+#include <memory> // Includes shared_ptr for upload lifetime
+#include <mutex> // Includes mutex for shared state
+#include <string> // Includes the string library for paths
+#include <thread> // Includes thread for the stage workers
+#include <vector> // Includes the vector library for dynamic arrays
+#include "crc32.h" // Includes the shared CRC32 engine
+#include "file_io.h" // Includes file creation, flush and atomic replace
+#include "metrics.h" // Includes the hashing and disk counters
+
+// How far an upload is pushed to stable storage before it replaces the target
+enum class Durability
+{
+    None, // Leaves flushing to the OS; the rename is still atomic
+    OnClose, // Flushes data and metadata once, before the rename
+    WriteThrough // Every write reaches the disk before it completes
+};
+
+// Receives uploads through three stages so network, checksum and disk work overlap:
+//   event loop (copies into a pooled buffer) -> checksum thread -> disk writer thread -> temp file
+// Buffers come from a fixed pool and each upload may hold only a share of it. When an upload runs
+// out, its session pauses reading, so a slow disk pushes back on the sender through the TCP window
+// rather than through memory. Finished uploads are renamed over the target, so a half-received
+// upload never replaces it.
+class UploadPipeline
+{
+    struct Block; // One pooled buffer, defined below
+
+public:
+    typedef std::function<void(bool ok, uint32_t crc)> DoneCallback; // Called on the writer thread once the upload is published (or failed)
+
+    // One upload passing through the pipeline. push(), finish() and abort() belong to the event loop thread.
+    class Upload : public std::enable_shared_from_this<Upload>
+    {
+    public:
+        bool ok() const { return file != nullptr; } // True if the temp file could be created
+
+        // Copies payload into pooled buffers; returns bytes taken. Returns less than length when this
+        // upload has no buffer left; wake() is called once one is free again.
+        size_t push(const char *data, size_t length)
+        {
+            if (!file) // Nowhere to write: drains the payload so the stream stays in sync
+                return length;
+            size_t used = 0; // Bytes copied so far
+            while (used < length) // Fills as many buffers as needed
+            {
+                if (!current && !(current = pipeline->acquire(this))) // Out of buffers
+                    break;
+                size_t n = std::min(length - used, current->bytes.size() - current->length); // Room in the buffer
+                memcpy(current->bytes.data() + current->length, data + used, n); // Copies the payload
+                current->length += n;
+                used += n;
+                if (current->length == current->bytes.size()) // Buffer full
+                    submitCurrent(); // Hands it to the checksum stage
+            }
+            return used; // Reports consumed bytes
+        }
+
+        // Makes finish() publish only if the data's CRC equals crc (for uploads rebuilt from pieces)
+        void expect(uint32_t crc)
+        {
+            expectedCrc = crc;
+            checkCrc = true;
+        }
+
+        // Flushes the last buffer and publishes the upload once every write completed
+        void finish(DoneCallback callback)
+        {
+            done = callback; // Called by the writer thread
+            if (current && current->length > 0) // Partially filled buffer
+                submitCurrent(); // Sends it down the pipeline
+            else if (current) // Empty buffer
+            {
+                pipeline->release(current); // Returns it
+                current = nullptr;
+            }
+            pipeline->markFinishing(this); // Publishes when nothing is left in flight
+        }
+
+        // Abandons the upload (connection lost); the temp file is deleted
+        void abort()
+        {
+            aborted = true; // Prevents the rename
+            done = nullptr; // Nobody is waiting for the result
+            if (current) // Buffer being filled
+            {
+                pipeline->release(current); // Returns it
+                current = nullptr;
+            }
+            pipeline->markFinishing(this); // Cleans up when nothing is left in flight
+        }
+
+    private:
+        friend class UploadPipeline; // The stages update progress and state
+
+        Upload() {} // Created by UploadPipeline::begin()
+
+        // Passes the current buffer to the checksum stage
+        void submitCurrent()
+        {
+            current->offset = nextOffset; // File position of the buffer
+            nextOffset += current->length; // Next buffer follows it
+            pipeline->checksum(current); // Queues it
+            current = nullptr; // The next push takes a fresh buffer
+        }
+
+        UploadPipeline *pipeline = nullptr; // Owning pipeline
+        std::string target; // File the upload replaces when complete
+        std::string tempPath; // File the upload is written to
+        FileIO::Handle file; // Open temp file
+        std::function<void()> wake; // Called when a buffer becomes available after push() ran dry
+        DoneCallback done; // Completion callback
+        Block *current = nullptr; // Buffer being filled (event loop thread)
+        uint64_t nextOffset = 0; // File offset of the next submitted buffer (event loop thread)
+        uint32_t crc = 0; // Running CRC (checksum thread)
+        uint32_t expectedCrc = 0; // CRC the data must have, if checkCrc
+        bool checkCrc = false; // True to publish only on a CRC match
+        bool failed = false; // Set by the writer when a write fails (writer thread)
+        std::atomic<bool> aborted{false}; // Set by abort() on the event loop thread, read by the writer thread
+        size_t inFlight = 0; // Buffers held by this upload (pipeline mutex)
+        bool finishing = false; // True after finish() or abort() (pipeline mutex)
+        bool starved = false; // True while waiting for a buffer (pipeline mutex)
+    };
+
+    // bufferCount buffers of bufferSize bytes; overlapped selects queued asynchronous writes over plain positioned writes
+    UploadPipeline(size_t bufferSize, size_t bufferCount, Durability durability, bool overlapped)
+        : durability(durability), overlapped(overlapped), perUpload(std::max<size_t>(2, bufferCount / 4))
+    {
+        for (size_t i = 0; i < bufferCount; ++i) // Allocates the pool up front
+        {
+            blocks.emplace_back(new Block()); // Creates the buffer
+            blocks.back()->bytes.resize(bufferSize); // Sizes it
+            freeBlocks.push_back(blocks.back().get()); // Makes it available
+        }
+        port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1); // Queue of the disk writer
+        checksumThread = std::thread(&UploadPipeline::checksumLoop, this); // Starts the checksum stage
+        writerThread = std::thread(&UploadPipeline::writerLoop, this); // Starts the disk writer
+    }
+
+    ~UploadPipeline() // Stops both stages
+    {
+        {
+            std::lock_guard<std::mutex> lock(checksumMutex); // Protects the flag
+            stopping = true; // Asks the checksum stage to exit
+        }
+        checksumReady.notify_one(); // Wakes it
+        checksumThread.join(); // Waits for it
+        PostQueuedCompletionStatus(port, 0, KEY_STOP, nullptr); // Asks the writer to exit
+        writerThread.join(); // Waits for it
+        CloseHandle(port); // Releases the completion port
+    }
+
+    UploadPipeline(const UploadPipeline &) = delete; // Owns threads and buffers, not copyable
+    UploadPipeline &operator=(const UploadPipeline &) = delete;
+
+    // Starts an upload to target, written to tempPath (unique to the upload, on the target's volume so
+    // the final rename is atomic). Check ok() on the result.
+    std::shared_ptr<Upload> begin(const std::string &target, const std::string &tempPath, std::function<void()> wake)
+    {
+        std::shared_ptr<Upload> upload(new Upload()); // New upload
+        upload->pipeline = this;
+        upload->target = target;
+        upload->tempPath = tempPath;
+        upload->wake = wake;
+        DWORD flags = overlapped ? FILE_FLAG_OVERLAPPED : FILE_FLAG_SEQUENTIAL_SCAN; // Access pattern
+        if (durability == Durability::WriteThrough) // Each write is durable on completion
+            flags |= FILE_FLAG_WRITE_THROUGH;
+        upload->file = FileIO::create(upload->tempPath, flags); // Creates the temp file
+        if (upload->file && overlapped && !CreateIoCompletionPort(static_cast<HANDLE>(upload->file.get()), port, KEY_WRITTEN, 0)) // Routes write completions to the writer
+            upload->file.reset(); // Unusable without completions
+        return upload;
+    }
+
+private:
+    // One pooled buffer. OVERLAPPED comes first so completions map back to the block.
+    struct Block
+    {
+        OVERLAPPED overlapped; // Overlapped write state
+        std::vector<char> bytes; // Buffer storage
+        size_t length = 0; // Bytes filled
+        uint64_t offset = 0; // File offset of the first byte
+        std::shared_ptr<Upload> owner; // Upload the buffer belongs to while in use
+        Metrics::Clock::time_point issued; // When the overlapped write was queued
+    };
+
+    static constexpr ULONG_PTR KEY_SUBMIT = 1; // Completion key: checksummed buffer ready to write
+    static constexpr ULONG_PTR KEY_WRITTEN = 2; // Completion key: overlapped write finished
+    static constexpr ULONG_PTR KEY_FINALIZE = 3; // Completion key: uploads ready to publish
+    static constexpr ULONG_PTR KEY_STOP = 4; // Completion key: shutdown
+
+    // Takes a free buffer for upload, or marks it starved; returns null if none may be taken
+    Block *acquire(Upload *upload)
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Protects the pool
+        if (freeBlocks.empty() || upload->inFlight >= perUpload) // Pool empty or upload at its share
+        {
+            if (!upload->starved) // Registers for a wake-up once
+            {
+                upload->starved = true;
+                starved.push_back(upload->shared_from_this());
+            }
+            return nullptr;
+        }
+        Block *block = freeBlocks.back(); // Takes a buffer
+        freeBlocks.pop_back();
+        block->length = 0; // Empties it
+        block->owner = upload->shared_from_this(); // Keeps the upload alive while the buffer is in use
+        ++upload->inFlight; // Counts it against the upload's share
+        return block;
+    }
+
+    // Returns a buffer to the pool, waking starved uploads and finishing drained ones
+    void release(Block *block)
+    {
+        std::shared_ptr<Upload> upload = std::move(block->owner); // Upload the buffer belonged to
+        std::vector<std::shared_ptr<Upload>> wakeups; // Uploads to wake outside the lock
+        bool publish = false; // True if this was the upload's last buffer after finish()
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the pool
+            freeBlocks.push_back(block); // Makes the buffer available
+            publish = --upload->inFlight == 0 && upload->finishing; // Nothing left in flight
+            wakeups.swap(starved); // Everyone waiting may try again
+            for (auto &w : wakeups)
+                w->starved = false;
+        }
+        if (publish) // Last buffer of a finished upload
+            finalizeLater(upload);
+        for (auto &w : wakeups) // Wakes the sessions
+            if (w->wake)
+                w->wake();
+    }
+
+    // Records that an upload will receive no more data
+    void markFinishing(Upload *upload)
+    {
+        bool publish = false; // True if nothing is in flight
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the counters
+            upload->finishing = true;
+            publish = upload->inFlight == 0;
+        }
+        if (publish) // Already drained
+            finalizeLater(upload->shared_from_this());
+    }
+
+    // Hands an upload to the writer thread for flushing and renaming
+    void finalizeLater(std::shared_ptr<Upload> upload)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the list
+            finalizing.push_back(std::move(upload));
+        }
+        PostQueuedCompletionStatus(port, 0, KEY_FINALIZE, nullptr); // Wakes the writer
+    }
+
+    // Queues a filled buffer for the checksum stage
+    void checksum(Block *block)
+    {
+        {
+            std::lock_guard<std::mutex> lock(checksumMutex); // Protects the queue
+            checksumQueue.push_back(block);
+        }
+        checksumReady.notify_one(); // Wakes the stage
+    }
+
+    // Checksum stage: updates each upload's CRC in order, then passes the buffer to the writer
+    void checksumLoop()
+    {
+        while (true) // Runs until shutdown
+        {
+            Block *block; // Next buffer
+            {
+                std::unique_lock<std::mutex> lock(checksumMutex); // Protects the queue
+                checksumReady.wait(lock, [this] { return stopping || !checksumQueue.empty(); }); // Waits for work
+                if (checksumQueue.empty()) // Stopping with nothing left
+                    return;
+                block = checksumQueue.front();
+                checksumQueue.pop_front();
+            }
+            {
+                Metrics::Timer timer(Metrics::HASH_NS); // Checksum stage time
+                block->owner->crc = CRC32::update(block->owner->crc, block->bytes.data(), block->length); // Buffers of one upload arrive in order
+            }
+            PostQueuedCompletionStatus(port, 0, KEY_SUBMIT, &block->overlapped); // Hands it to the writer
+        }
+    }
+
+    // Disk writer: issues writes, collects their completions and publishes finished uploads
+    void writerLoop()
+    {
+        while (true) // Runs until shutdown
+        {
+            DWORD bytes = 0; // Bytes written (KEY_WRITTEN)
+            ULONG_PTR key = 0; // Event kind
+            LPOVERLAPPED ov = nullptr; // Block of the event
+            BOOL ok = GetQueuedCompletionStatus(port, &bytes, &key, &ov, INFINITE); // Waits for work or a completion
+            if (key == KEY_STOP) // Shutdown
+                return;
+            if (key == KEY_FINALIZE) // Uploads ready to publish
+            {
+                std::vector<std::shared_ptr<Upload>> ready; // Taken under the lock
+                {
+                    std::lock_guard<std::mutex> lock(mutex); // Protects the list
+                    ready.assign(finalizing.begin(), finalizing.end());
+                    finalizing.clear();
+                }
+                for (auto &upload : ready) // Publishes each
+                    finalize(*upload);
+                continue;
+            }
+            if (!ov) // Spurious wake-up
+                continue;
+            Block *block = CONTAINING_RECORD(ov, Block, overlapped); // Buffer of the event
+            if (key == KEY_SUBMIT) // Checksummed buffer to write
+                write(block);
+            else // Overlapped write finished
+            {
+                Metrics::record(Metrics::DISK_WRITE_US, Metrics::microsSince(block->issued)); // Issue to completion
+                if (!ok || bytes != block->length) // Disk error or short write
+                    block->owner->failed = true;
+                release(block); // Buffer can be refilled
+            }
+        }
+    }
+
+    // Writes one buffer at its offset
+    void write(Block *block)
+    {
+        Upload &upload = *block->owner; // Upload being written
+        if (upload.failed || upload.aborted) // Pointless to keep writing
+        {
+            release(block);
+            return;
+        }
+        if (!overlapped) // Plain positioned write on the writer thread
+        {
+            Metrics::Clock::time_point start = Metrics::Clock::now(); // Write latency
+            if (!FileIO::writeAt(upload.file, block->offset, block->bytes.data(), block->length)) // Writes the buffer
+                upload.failed = true;
+            uint64_t micros = Metrics::microsSince(start); // Time blocked in the write
+            Metrics::record(Metrics::DISK_WRITE_US, micros);
+            Metrics::add(Metrics::DISK_NS, micros * 1000);
+            release(block);
+            return;
+        }
+        memset(&block->overlapped, 0, sizeof(OVERLAPPED)); // Resets the OVERLAPPED for reuse
+        block->issued = Metrics::Clock::now(); // Start of the write latency
+        block->overlapped.Offset = static_cast<DWORD>(block->offset); // Offset, low half
+        block->overlapped.OffsetHigh = static_cast<DWORD>(block->offset >> 32); // Offset, high half
+        if (!WriteFile(static_cast<HANDLE>(upload.file.get()), block->bytes.data(), static_cast<DWORD>(block->length), nullptr, &block->overlapped) &&
+            GetLastError() != ERROR_IO_PENDING) // Failed without queuing a completion
+        {
+            upload.failed = true;
+            release(block);
+        }
+    }
+
+    // Flushes (per policy), closes and renames a drained upload, then reports the result
+    void finalize(Upload &upload)
+    {
+        bool ok = upload.file && !upload.failed && !upload.aborted; // Every write succeeded
+        if (upload.checkCrc && upload.crc != upload.expectedCrc) // Rebuilt data differs from what the client has
+        {
+            Metrics::add(Metrics::CRC_MISMATCHES);
+            ok = false;
+        }
+        Metrics::Timer timer(Metrics::DISK_NS); // Flush, close and rename block the writer
+        if (ok && durability == Durability::OnClose) // Data must be on disk before the rename points at it
+            ok = FileIO::flush(upload.file);
+        upload.file.reset(); // Closes the temp file before renaming it
+        if (ok) // Publishes atomically
+            ok = FileIO::replace(upload.tempPath, upload.target);
+        if (!ok) // Leaves the old target untouched
+            DeleteFileA(upload.tempPath.c_str());
+        if (upload.done) // Reports the result
+            upload.done(ok, upload.crc);
+    }
+
+    Durability durability; // Flush policy
+    bool overlapped; // True for queued asynchronous writes
+    size_t perUpload; // Buffers one upload may hold at once
+    std::vector<std::unique_ptr<Block>> blocks; // Every buffer of the pool
+    HANDLE port = nullptr; // Writer queue and write completions
+
+    std::mutex mutex; // Protects the pool, upload counters and lists below
+    std::vector<Block *> freeBlocks; // Buffers ready for use
+    std::vector<std::shared_ptr<Upload>> starved; // Uploads waiting for a buffer
+    std::vector<std::shared_ptr<Upload>> finalizing; // Uploads ready to publish
+
+    std::mutex checksumMutex; // Protects the checksum queue
+    std::condition_variable checksumReady; // Signals checksum work
+    std::deque<Block *> checksumQueue; // Buffers waiting for their CRC
+    bool stopping = false; // Set on shutdown
+
+    std::thread checksumThread; // Checksum stage
+    std::thread writerThread; // Disk writer stage
+};
+
+#endif // Ends the header guard
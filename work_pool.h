@@ -0,0 +1,75 @@
+#ifndef WORK_POOL_H // Prevents multiple inclusions of this header file
+#define WORK_POOL_H // Defines the header guard macro
+
+#include <condition_variable> // Includes condition_variable for idle workers
+#include <deque> // Includes deque for the task queue
+#include <functional> // Includes std::function for tasks
+#include <mutex> // Includes mutex for the task queue
+#include <thread> // Includes the thread library for the workers
+#include <vector> // Includes the vector library for the worker threads
+
+// A fixed set of threads for blocking work the event loops must not do themselves (disk flushes,
+// hashing whole files). Sessions post a task and have it post its result back to their loop, so
+// the number of threads stays bounded however many requests arrive.
+class WorkPool
+{
+public:
+    explicit WorkPool(unsigned threads)
+    {
+        for (unsigned i = 0; i < threads; ++i) // Starts the workers
+            workers.emplace_back(&WorkPool::run, this);
+    }
+
+    ~WorkPool() // Runs the queued tasks, then stops the workers
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the queue
+            stopping = true; // Tells workers to exit once the queue is empty
+        }
+        ready.notify_all(); // Wakes every worker
+        for (auto &t : workers) // Waits for each worker
+            t.join();
+    }
+
+    WorkPool(const WorkPool &) = delete; // Owns threads, not copyable
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    size_t size() const { return workers.size(); } // Number of worker threads
+
+    // Queues task to run on a worker thread
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex); // Protects the queue
+            tasks.push_back(std::move(task));
+        }
+        ready.notify_one(); // Wakes one worker
+    }
+
+private:
+    // Worker thread: runs tasks in order of arrival until the pool is destroyed
+    void run()
+    {
+        while (true) // Processes tasks until stopped
+        {
+            std::function<void()> task; // Next task
+            {
+                std::unique_lock<std::mutex> lock(mutex); // Protects the queue
+                ready.wait(lock, [this]() { return stopping || !tasks.empty(); }); // Waits for work
+                if (tasks.empty()) // Stopping and drained
+                    return;
+                task = std::move(tasks.front()); // Takes the oldest task
+                tasks.pop_front();
+            }
+            task(); // Runs it outside the lock
+        }
+    }
+
+    std::vector<std::thread> workers; // Worker threads
+    std::mutex mutex; // Protects the fields below
+    std::condition_variable ready; // Signals new tasks or shutdown
+    std::deque<std::function<void()>> tasks; // Pending tasks
+    bool stopping = false; // Set on shutdown
+};
+
+#endif // Ends the header guard